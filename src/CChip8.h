@@ -2,10 +2,36 @@
 #define CChip8_H
 
 #include <random>
+#include <vector>
+#include <memory>
+#include <functional>
+#include <algorithm>
 #include <iostream>
 #include <sstream>
+#include <cstring>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <string_view>
 #include <cassert>
 
+#if defined(__SSE2__)
+#define CCHIP8_SSE2 1
+#include <emmintrin.h>
+#endif
+
+#if defined(__unix__) || defined(__APPLE__)
+#define CCHIP8_MMAP 1
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+typedef unsigned char  uchar;
+typedef unsigned short ushort;
+typedef unsigned int   uint;
+
 class CChip8 {
  public:
   static const ushort MemStart      = 0x000;
@@ -15,6 +41,13 @@ class CChip8 {
 
   static const int MemSize = 0x1000;
 
+  // largest rom (program area MemDataStart to MemDataEnd)
+  static const int MaxRomSize = MemDataEnd + 1 - MemDataStart;
+
+  // interpreter differences (see setQuirks()), default is SCHIP behaviour
+  static const uint QuirkShiftVY    = 1<<0; // 8XY6/8XYE shift Vy into Vx (COSMAC VIP)
+  static const uint QuirkLoadStoreI = 1<<1; // FX55/FX65 leave I at I + X + 1 (COSMAC VIP)
+
   static const int CharHeight      = 5;
   static const int SuperCharHeight = 10;
 
@@ -34,8 +67,221 @@ class CChip8 {
   static const uchar  SuperDisplayHeight = 64;
   static const ushort SuperDisplaySize   = SuperDisplayWidth*SuperDisplayHeight;
 
+  static const uint64_t AllRows = ~uint64_t(0);
+
+  // save state format (see saveState()), fixed size and laid out so it is
+  // written in place (host byte order)
+  static const uint32_t StateMagic   = 0x53533843; // "C8SS"
+  static const uint16_t StateVersion = 1;
+
+  enum StateFlags : uchar {
+    STATE_SUPER    = 1<<0,
+    STATE_HIGH_RES = 1<<1,
+    STATE_WAIT_KEY = 1<<2,
+    STATE_EXITED   = 1<<3,
+    STATE_FAULT    = 1<<4,
+    STATE_SHIFT_VY = 1<<5, // QuirkShiftVY
+    STATE_LOAD_I   = 1<<6  // QuirkLoadStoreI
+  };
+
+  struct SaveState {
+    // header
+    uint32_t magic          { 0 };
+    uint16_t version        { 0 };
+    uint16_t pad            { 0 };
+    uint32_t size           { 0 }; // sizeof(SaveState)
+    uint32_t pad1           { 0 };
+    uint64_t checksum       { 0 }; // of data after header
+
+    // machine
+    uint64_t cycles;
+    uint64_t random     [4];
+    uint64_t screen     [DisplaySize/64];
+    uint64_t superScreen[SuperDisplaySize/64];
+    uint32_t cyclesPerFrame;
+    uint32_t frameCycles;
+    ushort   PC;
+    ushort   I;
+    ushort   stack      [StackSize];
+    uchar    V          [NumV];
+    uchar    R          [NumV];
+    uchar    keys       [NumKeys];
+    uchar    SP;
+    uchar    DT;
+    uchar    ST;
+    uchar    flags;     // StateFlags
+    uchar    waitInd;
+    uchar    keyPressed;
+    uchar    pad2       [6];
+    uchar    memory     [MemSize];
+  };
+
+  static const size_t StateHeaderSize = offsetof(SaveState, cycles);
+
+ public:
+  // decoded instruction type (one per distinct operation)
+  enum class OpCode : uchar {
+    NOP,
+    CLS,
+    RET,
+    SCD,
+    SCR,
+    SCL,
+    EXIT,
+    LOW,
+    HIGH,
+    SYS,
+    JP,
+    CALL,
+    SE_VX_NN,
+    SNE_VX_NN,
+    SE_VX_VY,
+    LD_VX_NN,
+    ADD_VX_NN,
+    LD_VX_VY,
+    OR_VX_VY,
+    AND_VX_VY,
+    XOR_VX_VY,
+    ADD_VX_VY,
+    SUB_VX_VY,
+    SHR_VX_VY,
+    SUBN_VX_VY,
+    SHL_VX_VY,
+    SNE_VX_VY,
+    LD_I_NNN,
+    JP_V0_NNN,
+    RND_VX_NN,
+    DRW_VX_VY_N,
+    SKP_VX,
+    SKNP_VX,
+    LD_VX_DT,
+    LD_VX_K,
+    LD_DT_VX,
+    LD_ST_VX,
+    ADD_I_VX,
+    LD_F_VX,
+    LD_B_VX,
+    LD_IM_VX,
+    LD_VX_IM,
+    LD_HF_VX,
+    LD_R_VX,
+    LD_VX_R,
+    BAD,
+    NUM_OPS
+  };
+
+  // predecoded instruction (operation plus operands)
+  struct DecodedOp {
+    OpCode code { OpCode::BAD };
+    uchar  x    { 0 };
+    uchar  y    { 0 };
+    uchar  n    { 0 };
+    uchar  nn   { 0 };
+    ushort nnn  { 0 };
+  };
+
+  // max instructions in a cached basic block
+  static const int MaxBlockOps = 64;
+
+  // native code for the first numNativeOps instructions of a block
+  // (passed V registers and I, returns new PC)
+  using NativeProc = ushort (*)(uchar *V, ushort *I);
+
+  // straight-line run of predecoded instructions ending at a control flow
+  // instruction (jump, call, return, skip, key wait, stop)
+  struct Block {
+    ushort     start        { 0 }; // address of first instruction
+    ushort     end          { 0 }; // address after last instruction
+    int        numOps       { 0 };
+    DecodedOp  ops[MaxBlockOps];
+    uint       hits         { 0 }; // number of times run
+    NativeProc native       { nullptr };
+    int        numNativeOps { 0 };
+  };
+
+  // compiles block to native code (see CChip8Jit)
+  using BlockCompiler = std::function<void (Block &block)>;
+
+  // execution engine used by runCycles()
+  enum class Engine {
+    STEP,    // step()
+    DECODED, // stepDecoded()
+    BLOCK    // stepBlock() (and native code if block compiler set)
+  };
+
+  // why runCycles()/runUntilFrame() returned
+  enum class StopReason {
+    BUDGET,     // requested cycles run
+    FRAME,      // frame completed (runUntilFrame)
+    WAIT_KEY,   // blocked on LD Vx, K
+    HALT,       // NOP
+    EXIT,       // EXIT (00FD)
+    BREAKPOINT, // PC at breakpoint (instruction not run)
+    FAULT       // bad or unsupported instruction
+  };
+
+  // why loadRom() failed
+  enum class LoadError {
+    NONE,
+    OPEN,     // file can't be opened
+    READ,     // file read (or map) failed
+    EMPTY,    // no data
+    TOO_LARGE // larger than program area (MaxRomSize)
+  };
+
+  // called at each frame boundary (after timers tick)
+  using FrameProc = std::function<void ()>;
+
+  // random number generator state (xoshiro256**)
+  struct RandomState {
+    uint64_t s[4] { 0, 0, 0, 0 };
+  };
+
+  // execution counts (see setStatsEnabled())
+  struct Stats {
+    uint64_t ops[int(OpCode::NUM_OPS)] { }; // instructions run per decoded op
+    uint64_t draws[16]                 { }; // DRW run per number of rows
+    uint64_t collisions                { 0 }; // DRW which cleared a pixel
+    uint64_t skips                     { 0 }; // SE/SNE/SKP/SKNP run
+    uint64_t skipsTaken                { 0 }; // ... which skipped
+    uint64_t waitKeyCycles             { 0 }; // cycles idle in LD Vx, K
+
+    uint64_t instructions() const {
+      uint64_t n = 0;
+
+      for (auto count : ops)
+        n += count;
+
+      return n;
+    }
+
+    uint64_t rowsDrawn() const {
+      uint64_t n = 0;
+
+      for (int i = 0; i < 16; ++i)
+        n += uint64_t(i)*draws[i];
+
+      return n;
+    }
+
+    double skipRatio() const { return (skips > 0 ? double(skipsTaken)/skips : 0.0); }
+
+    // fraction of cycles spent waiting for a key
+    double waitKeyRatio() const {
+      uint64_t n = instructions() + waitKeyCycles;
+
+      return (n > 0 ? double(waitKeyCycles)/n : 0.0);
+    }
+  };
+
  public:
-  CChip8() { }
+  CChip8() :
+   decodeTable_(decodeTable()) {
+    // non reproducible unless setSeed() called
+    std::random_device rd;
+
+    setSeed((uint64_t(rd()) << 32) | rd());
+  }
 
   ushort PC() const { return PC_; }
 
@@ -49,6 +295,9 @@ class CChip8 {
   uchar SP() const { return SP_; }
   void setSP(uchar SP) { assert(SP < StackSize); SP_ = SP; }
 
+  // return address pushed by i'th active CALL (0 is outermost)
+  ushort stack(uchar i) const { assert(i < SP_); return stack_[i]; }
+
   ushort popSP() { assert(SP_ > 0); return stack_[--SP_]; }
   void pushSP(ushort v) { assert(SP_ < StackSize); stack_[SP_++] = v; }
 
@@ -76,6 +325,138 @@ class CChip8 {
 
   //---
 
+  // size of buffer needed for saveState()
+  static constexpr size_t stateSize() { return sizeof(SaveState); }
+
+  // write complete machine state (registers, memory, display, keys, timers,
+  // wait key and RND state) to buffer (8 byte aligned, at least stateSize()
+  // bytes). Returns number of bytes written (0 if buffer unusable).
+  size_t saveState(void *buffer, size_t size) const {
+    if (size < sizeof(SaveState) || (uintptr_t(buffer) & (alignof(SaveState) - 1)))
+      return 0;
+
+    SaveState *state = static_cast<SaveState *>(buffer);
+
+    state->magic   = StateMagic;
+    state->version = StateVersion;
+    state->pad     = 0;
+    state->size    = sizeof(SaveState);
+    state->pad1    = 0;
+
+    state->cycles         = cycles_;
+    state->cyclesPerFrame = uint32_t(cyclesPerFrame_);
+    state->frameCycles    = uint32_t(frameCycles_);
+
+    memcpy(state->random     , random_.s   , sizeof(state->random));
+    memcpy(state->screen     , screen_     , sizeof(state->screen));
+    memcpy(state->superScreen, superScreen_, sizeof(state->superScreen));
+
+    state->PC = PC_;
+    state->I  = I_;
+
+    memcpy(state->stack, stack_, sizeof(state->stack));
+    memcpy(state->V    , V_    , sizeof(state->V));
+    memcpy(state->R    , R_    , sizeof(state->R));
+    memcpy(state->keys , keys_ , sizeof(state->keys));
+
+    state->SP = SP_;
+    state->DT = DT_;
+    state->ST = ST_;
+
+    state->flags = uchar((superChip48_ ? STATE_SUPER    : 0) |
+                         (highRes_     ? STATE_HIGH_RES : 0) |
+                         (waitKey_     ? STATE_WAIT_KEY : 0) |
+                         (exited_      ? STATE_EXITED   : 0) |
+                         (fault_       ? STATE_FAULT    : 0) |
+                         (quirks_ & QuirkShiftVY    ? STATE_SHIFT_VY : 0) |
+                         (quirks_ & QuirkLoadStoreI ? STATE_LOAD_I   : 0));
+
+    state->waitInd    = waitInd_;
+    state->keyPressed = keyPressed_;
+
+    memset(state->pad2, 0, sizeof(state->pad2));
+
+    memcpy(state->memory, memory_, sizeof(state->memory));
+
+    state->checksum = stateChecksum(state);
+
+    return sizeof(SaveState);
+  }
+
+  // restore state written by saveState(). Returns false (state unchanged) if
+  // buffer is not a valid state of this version.
+  bool loadState(const void *buffer, size_t size) {
+    if (size < sizeof(SaveState) || (uintptr_t(buffer) & (alignof(SaveState) - 1)))
+      return false;
+
+    const SaveState *state = static_cast<const SaveState *>(buffer);
+
+    if (state->magic   != StateMagic   || state->version != StateVersion ||
+        state->size    != sizeof(SaveState) ||
+        state->checksum != stateChecksum(state))
+      return false;
+
+    if (state->SP > StackSize || state->cyclesPerFrame == 0 ||
+        state->waitInd >= NumV || state->keyPressed > NumKeys)
+      return false;
+
+    // PC and return addresses (loaded into PC by RET) must be in program
+    // memory with room for the opcode fetch
+    auto isValidPC = [](ushort pc) { return (pc >= MemDataStart && pc <= MemDataEnd - 1); };
+
+    if (! isValidPC(state->PC))
+      return false;
+
+    for (uint i = 0; i < state->SP; ++i)
+      if (! isValidPC(state->stack[i]))
+        return false;
+
+    cycles_         = state->cycles;
+    cyclesPerFrame_ = int(state->cyclesPerFrame);
+    frameCycles_    = std::min(int(state->frameCycles), cyclesPerFrame_ - 1);
+
+    memcpy(random_.s   , state->random     , sizeof(state->random));
+    memcpy(screen_     , state->screen     , sizeof(state->screen));
+    memcpy(superScreen_, state->superScreen, sizeof(state->superScreen));
+
+    PC_ = state->PC;
+    I_  = state->I & MemDataEnd;
+
+    memcpy(stack_, state->stack, sizeof(state->stack));
+    memcpy(V_    , state->V    , sizeof(state->V));
+    memcpy(R_    , state->R    , sizeof(state->R));
+    memcpy(keys_ , state->keys , sizeof(state->keys));
+
+    SP_ = state->SP;
+    DT_ = state->DT;
+    ST_ = state->ST;
+
+    superChip48_ = (state->flags & STATE_SUPER   );
+    highRes_     = (state->flags & STATE_HIGH_RES);
+    waitKey_     = (state->flags & STATE_WAIT_KEY);
+    exited_      = (state->flags & STATE_EXITED  );
+    fault_       = (state->flags & STATE_FAULT   );
+
+    setQuirks((state->flags & STATE_SHIFT_VY ? QuirkShiftVY    : 0) |
+              (state->flags & STATE_LOAD_I   ? QuirkLoadStoreI : 0));
+
+    waitInd_    = state->waitInd;
+    keyPressed_ = state->keyPressed;
+
+    memcpy(memory_, state->memory, sizeof(state->memory));
+
+    atBreakpoint_ = false;
+    dirtyRows_    = AllRows;
+
+    predecodeAll();
+
+    flushBlocks();
+
+    return true;
+  }
+
+  //---
+
   ushort screenWidth() {
     if (isSuper() && isHighRes())
       return SuperDisplayWidth;
@@ -90,26 +471,101 @@ class CChip8 {
     return DisplayHeight;
   }
 
-  uchar *pscreen() { return (isSuper() ? superScreen_ : screen_); }
+  // display pixels as a linear bitstring of 64 bit words (one word per low res
+  // row, two per high res row) with the first pixel in the most significant bit
+  uint64_t *pscreen() { return (isSuper() ? superScreen_ : screen_); }
+
+  const uint64_t *pscreen() const { return (isSuper() ? superScreen_ : screen_); }
+
+  uchar screen(int pos) const { return (pscreen()[pos >> 6] >> (63 - (pos & 63))) & 1; }
+
+  // mask of display rows (bit y for row y) changed since last cleared
+  // (all rows after a clear, scroll or resolution change)
+  uint64_t dirtyRows() const { return dirtyRows_; }
+  void clearDirtyRows() { dirtyRows_ = 0; }
 
-  uchar screen(int pos) { return (isSuper() ? superScreen_[pos] : screen_[pos]); }
+  // FNV-1a hash of displayed pixels (on/off)
+  uint64_t screenHash() {
+    uint64_t h = 0xcbf29ce484222325ULL;
+
+    const uint64_t *screen = pscreen();
+
+    int ss = screenWidth()*screenHeight();
+
+    for (int i = 0; i < ss; ++i) {
+      h ^= (screen[i >> 6] >> (63 - (i & 63))) & 1;
+      h *= 0x100000001b3ULL;
+    }
+
+    return h;
+  }
 
   //---
 
-  uchar memory(ushort pos) { assert(pos <= MemDataEnd); return memory_[pos]; }
+  // addresses past the end (I + n) wrap like I
+  uchar memory(ushort pos) const {
+    assert(pos <= MemDataEnd + NumV); return memory_[pos & MemDataEnd]; }
 
+  // all memory (MemSize bytes)
+  const uchar *pmemory() const { return memory_; }
+
+  // (stores through I may also be below MemDataStart)
   void setMemory(ushort pos, uchar v) {
-    assert(pos >= MemDataStart && pos <= MemDataEnd);
+    assert(pos <= MemDataEnd + NumV);
+    pos &= MemDataEnd;
+
     memory_[pos] = v;
+
+    // ops at pos and before it (which includes this byte)
+    if (pos > MemStart)
+      predecode(pos - 1);
+
+    predecode(pos);
+
+    if (! blockRefs_.empty() && blockRefs_[pos])
+      invalidateBlocks(pos);
+  }
+
+  //---
+
+  // seed RND generator (same seed and inputs give identical runs)
+  void setSeed(uint64_t seed) {
+    // expand seed with splitmix64 (state must not be all zero)
+    for (int i = 0; i < 4; ++i) {
+      seed += 0x9e3779b97f4a7c15ULL;
+
+      uint64_t z = seed;
+
+      z = (z ^ (z >> 30))*0xbf58476d1ce4e5b9ULL;
+      z = (z ^ (z >> 27))*0x94d049bb133111ebULL;
+
+      random_.s[i] = z ^ (z >> 31);
+    }
   }
 
+  // generator state (saved and restored with machine state)
+  const RandomState &randomState() const { return random_; }
+  void setRandomState(const RandomState &state) { random_ = state; }
+
   //---
 
   bool isSuper() const { return superChip48_; }
-  void setSuper(bool b) { superChip48_ = b; }
+  void setSuper(bool b) { superChip48_ = b; dirtyRows_ = AllRows; }
 
   bool isHighRes() const { return highRes_; }
-  void setHighRes(bool b) { highRes_ = b; }
+  void setHighRes(bool b) { highRes_ = b; dirtyRows_ = AllRows; }
+
+  // quirk flags (QuirkShiftVY, QuirkLoadStoreI). Native code compiled for
+  // the old quirks is dropped
+  uint quirks() const { return quirks_; }
+
+  void setQuirks(uint quirks) {
+    if (quirks == quirks_) return;
+
+    quirks_ = quirks;
+
+    resetNativeBlocks();
+  }
 
   //---
 
@@ -118,6 +574,10 @@ class CChip8 {
   void setKey(uchar k, bool b) {
     assert(k < NumKeys); keys_[k] = (b ? 1 : 0); if (b) keyPressed_ = k + 1; }
 
+  // in LD Vx, K (and blocked if no key pressed yet)
+  bool isWaitKey   () const { return waitKey_; }
+  bool isWaitingKey() const { return waitKey_ && ! keyPressed_; }
+
   //---
 
   static std::string shortStr(ushort s) { std::stringstream ss;
@@ -134,6 +594,10 @@ class CChip8 {
 
     initDigitSprites();
 
+    predecodeAll();
+
+    flushBlocks();
+
     //---
 
     memset(V_, 0, NumV*sizeof(V_[0]));
@@ -153,6 +617,17 @@ class CChip8 {
 
     clearScreen();
 
+    waitKey_    = false;
+    keyPressed_ = 0;
+    exited_     = false;
+    fault_      = false;
+
+    cycles_       = 0;
+    frameCycles_  = 0;
+    atBreakpoint_ = false;
+
+    resetStats();
+
 //  memset(sprites_     , 0, 16*sizeof(Sprite));
 //  memset(superSprites_, 0, 16*sizeof(SuperSprite));
   }
@@ -161,103 +636,271 @@ class CChip8 {
 
   void setMemory(const uchar *m) {
     memcpy(&memory_[MemDataStart], &m[MemDataStart], MemSize - MemDataStart);
+
+    predecodeAll();
+
+    flushBlocks();
+  }
+
+  //---
+
+  // read only contents of rom file, memory mapped where supported (so loads
+  // of many instances copy straight from the shared mapping) else read in
+  // one fread. Size is checked when opened.
+  class RomFile {
+   public:
+    RomFile() { }
+
+    RomFile(const RomFile &) = delete;
+    RomFile &operator=(const RomFile &) = delete;
+
+   ~RomFile() { close(); }
+
+    const uchar *data() const { return data_; }
+    size_t       size() const { return size_; }
+
+    LoadError open(const char *filename) {
+      close();
+
+#ifdef CCHIP8_MMAP
+      // map regular file (pipes and devices are read)
+      int fd = ::open(filename, O_RDONLY);
+      if (fd < 0) return LoadError::OPEN;
+
+      struct stat st;
+
+      if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) {
+        LoadError error = checkRomSize(size_t(st.st_size));
+
+        if (error == LoadError::NONE) {
+          void *p = mmap(nullptr, size_t(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+
+          if (p != MAP_FAILED) {
+            map_  = p;
+            data_ = static_cast<const uchar *>(p);
+            size_ = size_t(st.st_size);
+          }
+          else
+            error = LoadError::READ;
+        }
+
+        ::close(fd);
+
+        return error;
+      }
+
+      ::close(fd);
+#endif
+
+      // read one more than largest rom to detect too large
+      FILE *fp = fopen(filename, "rb");
+      if (! fp) return LoadError::OPEN;
+
+      buffer_.resize(MaxRomSize + 1);
+
+      size_t n = fread(&buffer_[0], 1, buffer_.size(), fp);
+
+      LoadError error = (ferror(fp) ? LoadError::READ : checkRomSize(n));
+
+      fclose(fp);
+
+      if (error != LoadError::NONE) {
+        buffer_.clear();
+        return error;
+      }
+
+      buffer_.resize(n);
+
+      data_ = &buffer_[0];
+      size_ = n;
+
+      return LoadError::NONE;
+    }
+
+    void close() {
+#ifdef CCHIP8_MMAP
+      if (map_)
+        munmap(map_, size_);
+#endif
+
+      map_  = nullptr;
+      data_ = nullptr;
+      size_ = 0;
+
+      buffer_.clear();
+    }
+
+   private:
+    void*              map_  { nullptr };
+    const uchar*       data_ { nullptr };
+    size_t             size_ { 0 };
+    std::vector<uchar> buffer_;           // read contents (no mapping)
+  };
+
+  // load rom into program area, clearing the rest of it (registers, display
+  // and reset state unchanged). Memory unchanged if rom empty or too large.
+  LoadError loadRom(const uchar *rom, size_t len) {
+    LoadError error = checkRomSize(len);
+    if (error != LoadError::NONE) return error;
+
+    memcpy(&memory_[MemDataStart], rom, len);
+    memset(&memory_[MemDataStart + len], 0, MaxRomSize - len);
+
+    predecodeAll();
+
+    flushBlocks();
+
+    return LoadError::NONE;
+  }
+
+  // load rom file (see RomFile)
+  LoadError loadRom(const char *filename) {
+    RomFile file;
+
+    LoadError error = file.open(filename);
+    if (error != LoadError::NONE) return error;
+
+    return loadRom(file.data(), file.size());
+  }
+
+  static const char *loadErrorMessage(LoadError error) {
+    switch (error) {
+      case LoadError::NONE     : return "ok";
+      case LoadError::OPEN     : return "can't open file";
+      case LoadError::READ     : return "read failed";
+      case LoadError::EMPTY    : return "empty rom";
+      case LoadError::TOO_LARGE: return "rom larger than program memory (3584 bytes)";
+      default                  : return "";
+    }
+  }
+
+  static LoadError checkRomSize(size_t len) {
+    if (len == 0                ) return LoadError::EMPTY;
+    if (len > size_t(MaxRomSize)) return LoadError::TOO_LARGE;
+
+    return LoadError::NONE;
   }
 
   //---
 
+  // rows from n move up and the bottom n rows move to the top
   void scrollDown(uchar n) {
-    int sw = screenWidth ();
     int sh = screenHeight();
-    int ss = sw*sh;
+    int rw = screenWidth()/64;
 
-    uchar *screen = this->pscreen();
+    uint64_t *screen = this->pscreen();
 
     //---
 
-    int len   = n*sw;
-    int start = ss - len;
+    int len   = n*rw;
+    int start = (sh - n)*rw;
+
+    uint64_t scrollBuffer[16*SuperDisplayWidth/64];
 
     // bottom n lines to buffer
-    memcpy(scrollBuffer, &screen[start], len);
+    memcpy(scrollBuffer, &screen[start], len*sizeof(uint64_t));
 
     // scroll down n
-    memmove(screen, &screen[len], start);
+    memmove(screen, &screen[len], start*sizeof(uint64_t));
 
     // buffer to top n lines
-    memcpy(screen, scrollBuffer, len);
+    memcpy(screen, scrollBuffer, len*sizeof(uint64_t));
+
+    if (n > 0)
+      dirtyRows_ = AllRows;
   }
 
+  // rotate each row left by n pixels
   void scrollLeft(uchar n) {
-    int sw = screenWidth ();
-    int sh = screenHeight();
+    int sw = screenWidth();
 
-    uchar *screen = this->pscreen();
+    rotateRows((sw - n % sw) % sw);
+  }
 
-    //---
+  // rotate each row right by n pixels
+  void scrollRight(uchar n) {
+    rotateRows(n % screenWidth());
+  }
 
-    int n1 = sw - n;
+  // rotate each row right by n (0 to width - 1) pixels
+  void rotateRows(int n) {
+    int sh = screenHeight();
+    int rw = screenWidth()/64;
+    int nw = sh*rw;
 
-    int pos = 0;
+    uint64_t *screen = this->pscreen();
 
-    for (int y = 0; y < sh; ++y) {
-      // left n to buffer
-      memcpy(scrollBuffer, &screen[pos], n);
+    // for high res rows 64 or more is a swap of row words and a rotate by
+    // the rest
+    bool swap = (n >= 64);
 
-      // scroll left (width - n)
-      memmove(&screen[pos], &screen[pos + n], n1);
+    n &= 63;
 
-      // buffer to right n
-      memcpy(&screen[pos + n1], scrollBuffer, n);
+    if (n == 0 && ! swap)
+      return;
 
-      pos += sw;
-    }
-  }
+    dirtyRows_ = AllRows;
 
-  void scrollRight(uchar n) {
-    int sw = screenWidth ();
-    int sh = screenHeight();
+#ifdef CCHIP8_SSE2
+    // one high res or two low res rows per register. Each word is shifted
+    // right and the bits shifted out of the row word to its left (itself for
+    // low res) are shifted in (a shift by 64 gives zero)
+    const __m128i sr = _mm_cvtsi32_si128(n);
+    const __m128i sl = _mm_cvtsi32_si128(64 - n);
 
-    uchar *screen = this->pscreen();
+    for (int i = 0; i < nw; i += 2) {
+      __m128i *p = reinterpret_cast<__m128i *>(&screen[i]);
 
-    //---
+      __m128i v = _mm_load_si128(p);
+      __m128i o = (rw == 1 ? v : _mm_shuffle_epi32(v, 0x4E));
 
-    int n1 = sw - n;
+      if (swap)
+        std::swap(v, o);
 
-    int pos = 0;
+      _mm_store_si128(p, _mm_or_si128(_mm_srl_epi64(v, sr), _mm_sll_epi64(o, sl)));
+    }
+#else
+    for (int i = 0; i < nw; i += rw) {
+      uint64_t l = screen[i], r = screen[i + rw - 1];
 
-    for (int y = 0; y < sh; ++y) {
-      // right n to buffer
-      memcpy(scrollBuffer, &screen[pos + n1], n);
+      if (swap)
+        std::swap(l, r);
 
-      // scroll right (width - n)
-      memmove(&screen[pos + n], &screen[pos], n1);
+      if (n > 0) {
+        uint64_t l1 = (l >> n) | (r << (64 - n));
+        uint64_t r1 = (r >> n) | (l << (64 - n));
 
-      // buffer to left n
-      memcpy(&screen[pos], scrollBuffer, n);
+        l = l1;
+        r = r1;
+      }
 
-      pos += sw;
+      screen[i]          = l;
+      screen[i + rw - 1] = r;
     }
+#endif
   }
 
-  void quit() { }
+  // EXIT (stops execution)
+  bool quit() { exited_ = true; return false; }
+
+  // bad or unsupported instruction (stops execution)
+  bool fault() { fault_ = true; return false; }
+
+  bool isExited() const { return exited_; }
+  bool isFault () const { return fault_; }
 
   //---
 
   bool step() {
     bool rc = true;
 
-    if (waitKey_) {
-      if (keyPressed_) {
-        setV(waitInd_, keyPressed_ - 1);
-        keyPressed_  = 0;
-        waitKey_     = false;
-      }
-
-      return rc;
-    }
+    if (waitKey_)
+      return checkWaitKey();
 
     //---
 
+    ushort pc = PC();
+
     uchar b0   = memory(PC()    );
     uchar byte = memory(PC() + 1);
 
@@ -291,37 +934,37 @@ class CChip8 {
           if (isSuper())
             scrollDown(v3); // SCD nibble
           else
-            assert(false);
+            rc = fault();
         }
         else if (byte == 0xFB) {
           if (isSuper())
             scrollRight(isHighRes() ? 4 : 2); // SCR (4 or 2 pixels)
           else
-            assert(false);
+            rc = fault();
         }
         else if (byte == 0xFC) {
           if (isSuper())
             scrollLeft(isHighRes() ? 4 : 2); // SCL (4 or 2 pixels)
           else
-            assert(false);
+            rc = fault();
         }
         else if (byte == 0xFD) {
           if (isSuper())
-            quit(); // EXIT
+            rc = quit(); // EXIT
           else
-            assert(false);
+            rc = fault();
         }
         else if (byte == 0xFE) {
           if (isSuper())
             setHighRes(false); // LOW
           else
-            assert(false);
+            rc = fault();
         }
         else if (byte == 0xFF) {
           if (isSuper())
             setHighRes(true); // HIGH (128x64)
           else
-            assert(false);
+            rc = fault();
         }
         else {
           setPC(addr()); // SYS addr
@@ -371,18 +1014,18 @@ class CChip8 {
         else if (v3 == 0x5) { setVF(V(x) >= V(y) ? 1 : 0); setV(x, V(x) - V(y)); }
         // SHR Vx, Vy
         else if (v3 == 0x6) {
-        //setVF(V(y) & 1 ? 1 : 0); setV(x, V(y) >> 1);
-          setVF(V(x) & 1 ? 1 : 0); setV(x, V(x) >> 1); // depends on mode if y used
+          uchar s = (quirks_ & QuirkShiftVY ? y : x);
+          setVF(V(s) & 1 ? 1 : 0); setV(x, V(s) >> 1);
         }
         // SUBN Vx, Vy
         else if (v3 == 0x7) { setVF(V(y) >= V(x) ? 1 : 0); setV(x, V(y) - V(x)); }
         // SHL Vx, Vy
         else if (v3 == 0xE) {
-        //setVF(V(y) & 0x80 ? 1 : 0); setV(x, V(y) << 1);
-          setVF(V(x) & 0x80 ? 1 : 0); setV(x, V(x) << 1); // depends on mode if y used
+          uchar s = (quirks_ & QuirkShiftVY ? y : x);
+          setVF(V(s) & 0x80 ? 1 : 0); setV(x, V(s) << 1);
         }
 
-        else assert(false);
+        else rc = fault();
 
         break;
       }
@@ -418,7 +1061,7 @@ class CChip8 {
             nextOp();
         }
 
-        else assert(false);
+        else rc = fault();
 
         break;
       }
@@ -453,14 +1096,16 @@ class CChip8 {
           for (int i = 0; i <= x; ++i)
             setMemory(I() + i, V(i));
 
-          //setI(I() + x + 1);
+          if (quirks_ & QuirkLoadStoreI)
+            setI(I() + x + 1);
         }
         // LD Vx, [I]
         else if (byte == 0x65) {
           for (int i = 0; i <= x; ++i)
             setV(i, memory(I() + i));
 
-          //setI(I() + x + 1);
+          if (quirks_ & QuirkLoadStoreI)
+            setI(I() + x + 1);
         }
 
         else if (byte == 0x30) {
@@ -468,7 +1113,7 @@ class CChip8 {
             // I = HighSpriteAddr + V(x)*10; // LD HF, Vx
           }
           else
-            assert(false);
+            rc = fault();
         }
         else if (byte == 0x75) {
           if (isSuper()) {
@@ -477,7 +1122,7 @@ class CChip8 {
               setR(i, V(i));
           }
           else
-            assert(false);
+            rc = fault();
         }
         else if (byte == 0x85) {
           if (isSuper()) {
@@ -486,64 +1131,491 @@ class CChip8 {
               setV(i, R(i));
           }
           else
-            assert(false);
+            rc = fault();
         }
 
-        else assert(false);
+        else rc = fault();
 
         break;
       }
       default: {
-        assert(false);
+        rc = fault();
         break;
       }
     }
 
+    // count fetched op (op may have overwritten itself)
+    if (isStatsEnabled())
+      countOp(decodeTable_[(b0 << 8) | byte].code, v3, pc);
+
     return rc;
   }
 
   //---
 
-  void tick() {
-    if (DT() > 0) setDT(DT() - 1);
-    if (ST() > 0) setST(ST() - 1);
-  }
+  // decode opcode (same rules as step())
+  static DecodedOp decodeOp(ushort opcode) {
+    DecodedOp op;
 
-  //---
+    uchar b0   = (opcode >> 8) & 0xFF;
+    uchar byte =  opcode       & 0xFF;
 
-  void disassemble(std::ostream &os, bool showAddr=true) {
-    disassemble(PC(), os, showAddr);
-  }
+    // <op> <x> <y> <n>
+    uchar c = (b0 & 0xF0) >> 4;
 
-  void disassemble(ushort PC, std::ostream &os, bool showAddr=true) {
-    if (showAddr)
-      os << shortStr(PC) << " : ";
+    op.x   =  b0   & 0x0F;
+    op.y   = (byte & 0xF0) >> 4;
+    op.n   =  byte & 0x0F;
+    op.nn  =  byte;
+    op.nnn =  opcode & 0x0FFF;
 
-    //---
+    switch (c) {
+      case 0x0: {
+        if      (byte == 0x00) op.code = OpCode::NOP;
+        else if (byte == 0xE0) op.code = OpCode::CLS;
+        else if (byte == 0xEE) op.code = OpCode::RET;
+        else if (op.y == 0xC ) op.code = OpCode::SCD;
+        else if (byte == 0xFB) op.code = OpCode::SCR;
+        else if (byte == 0xFC) op.code = OpCode::SCL;
+        else if (byte == 0xFD) op.code = OpCode::EXIT;
+        else if (byte == 0xFE) op.code = OpCode::LOW;
+        else if (byte == 0xFF) op.code = OpCode::HIGH;
+        else                   op.code = OpCode::SYS;
 
-    uchar b0   = memory(PC++);
-    uchar byte = memory(PC++);
+        break;
+      }
+      case 0x1: op.code = OpCode::JP       ; break;
+      case 0x2: op.code = OpCode::CALL     ; break;
+      case 0x3: op.code = OpCode::SE_VX_NN ; break;
+      case 0x4: op.code = OpCode::SNE_VX_NN; break;
+      case 0x5: op.code = OpCode::SE_VX_VY ; break;
+      case 0x6: op.code = OpCode::LD_VX_NN ; break;
+      case 0x7: op.code = OpCode::ADD_VX_NN; break;
+      case 0x8: {
+        if      (op.n == 0x0) op.code = OpCode::LD_VX_VY;
+        else if (op.n == 0x1) op.code = OpCode::OR_VX_VY;
+        else if (op.n == 0x2) op.code = OpCode::AND_VX_VY;
+        else if (op.n == 0x3) op.code = OpCode::XOR_VX_VY;
+        else if (op.n == 0x4) op.code = OpCode::ADD_VX_VY;
+        else if (op.n == 0x5) op.code = OpCode::SUB_VX_VY;
+        else if (op.n == 0x6) op.code = OpCode::SHR_VX_VY;
+        else if (op.n == 0x7) op.code = OpCode::SUBN_VX_VY;
+        else if (op.n == 0xE) op.code = OpCode::SHL_VX_VY;
+        else                  op.code = OpCode::BAD;
 
-    // <op> <x> <y> <v3>
-    uchar op = (b0   & 0xF0) >> 4;
-    uchar x  =  b0   & 0x0F;
-    uchar y  = (byte & 0xF0) >> 4;
-    uchar v3 =  byte & 0x0F;
+        break;
+      }
+      case 0x9: op.code = OpCode::SNE_VX_VY  ; break;
+      case 0xa: op.code = OpCode::LD_I_NNN   ; break;
+      case 0xb: op.code = OpCode::JP_V0_NNN  ; break;
+      case 0xc: op.code = OpCode::RND_VX_NN  ; break;
+      case 0xd: op.code = OpCode::DRW_VX_VY_N; break;
+      case 0xe: {
+        if      (byte == 0x9E) op.code = OpCode::SKP_VX;
+        else if (byte == 0xA1) op.code = OpCode::SKNP_VX;
+        else                   op.code = OpCode::BAD;
 
-    auto addr = [&]() { return (x << 8) | byte; };
+        break;
+      }
+      case 0xf: {
+        if      (byte == 0x07) op.code = OpCode::LD_VX_DT;
+        else if (byte == 0x0A) op.code = OpCode::LD_VX_K;
+        else if (byte == 0x15) op.code = OpCode::LD_DT_VX;
+        else if (byte == 0x18) op.code = OpCode::LD_ST_VX;
+        else if (byte == 0x1e) op.code = OpCode::ADD_I_VX;
+        else if (byte == 0x29) op.code = OpCode::LD_F_VX;
+        else if (byte == 0x33) op.code = OpCode::LD_B_VX;
+        else if (byte == 0x55) op.code = OpCode::LD_IM_VX;
+        else if (byte == 0x65) op.code = OpCode::LD_VX_IM;
+        else if (byte == 0x30) op.code = OpCode::LD_HF_VX;
+        else if (byte == 0x75) op.code = OpCode::LD_R_VX;
+        else if (byte == 0x85) op.code = OpCode::LD_VX_R;
+        else                   op.code = OpCode::BAD;
 
-    //---
+        break;
+      }
+      default: {
+        op.code = OpCode::BAD;
+        break;
+      }
+    }
 
-    auto badOp = [&]() { os << "Bad OP " << charStr(b0) << " " << charStr(byte) << "\n"; };
+    return op;
+  }
 
-    //---
+  // encode instruction (inverse of decodeOp, operands not used by the
+  // instruction are ignored). BAD gives 0 (no encoding). Opcodes which
+  // decodeOp maps to an instruction with a different (canonical) encoding,
+  // e.g. 5XY1 to SE Vx, Vy, don't round trip.
+  static ushort encodeOp(const DecodedOp &op) {
+    auto xy = [&](int c, int n) { return ushort((c << 12) | (op.x << 8) | (op.y << 4) | n); };
+    auto xb = [&](int c, int b) { return ushort((c << 12) | (op.x << 8) | b); };
+    auto a  = [&](int c       ) { return ushort((c << 12) | (op.nnn & 0x0FFF)); };
+
+    switch (op.code) {
+      case OpCode::NOP        : return 0x0000;
+      case OpCode::CLS        : return 0x00E0;
+      case OpCode::RET        : return 0x00EE;
+      case OpCode::SCD        : return ushort(0x00C0 | (op.n & 0xF));
+      case OpCode::SCR        : return 0x00FB;
+      case OpCode::SCL        : return 0x00FC;
+      case OpCode::EXIT       : return 0x00FD;
+      case OpCode::LOW        : return 0x00FE;
+      case OpCode::HIGH       : return 0x00FF;
+      case OpCode::SYS        : return a(0x0);
+      case OpCode::JP         : return a(0x1);
+      case OpCode::CALL       : return a(0x2);
+      case OpCode::SE_VX_NN   : return xb(0x3, op.nn);
+      case OpCode::SNE_VX_NN  : return xb(0x4, op.nn);
+      case OpCode::SE_VX_VY   : return xy(0x5, 0x0);
+      case OpCode::LD_VX_NN   : return xb(0x6, op.nn);
+      case OpCode::ADD_VX_NN  : return xb(0x7, op.nn);
+      case OpCode::LD_VX_VY   : return xy(0x8, 0x0);
+      case OpCode::OR_VX_VY   : return xy(0x8, 0x1);
+      case OpCode::AND_VX_VY  : return xy(0x8, 0x2);
+      case OpCode::XOR_VX_VY  : return xy(0x8, 0x3);
+      case OpCode::ADD_VX_VY  : return xy(0x8, 0x4);
+      case OpCode::SUB_VX_VY  : return xy(0x8, 0x5);
+      case OpCode::SHR_VX_VY  : return xy(0x8, 0x6);
+      case OpCode::SUBN_VX_VY : return xy(0x8, 0x7);
+      case OpCode::SHL_VX_VY  : return xy(0x8, 0xE);
+      case OpCode::SNE_VX_VY  : return xy(0x9, 0x0);
+      case OpCode::LD_I_NNN   : return a(0xA);
+      case OpCode::JP_V0_NNN  : return a(0xB);
+      case OpCode::RND_VX_NN  : return xb(0xC, op.nn);
+      case OpCode::DRW_VX_VY_N: return xy(0xD, op.n & 0xF);
+      case OpCode::SKP_VX     : return xb(0xE, 0x9E);
+      case OpCode::SKNP_VX    : return xb(0xE, 0xA1);
+      case OpCode::LD_VX_DT   : return xb(0xF, 0x07);
+      case OpCode::LD_VX_K    : return xb(0xF, 0x0A);
+      case OpCode::LD_DT_VX   : return xb(0xF, 0x15);
+      case OpCode::LD_ST_VX   : return xb(0xF, 0x18);
+      case OpCode::ADD_I_VX   : return xb(0xF, 0x1E);
+      case OpCode::LD_F_VX    : return xb(0xF, 0x29);
+      case OpCode::LD_B_VX    : return xb(0xF, 0x33);
+      case OpCode::LD_IM_VX   : return xb(0xF, 0x55);
+      case OpCode::LD_VX_IM   : return xb(0xF, 0x65);
+      case OpCode::LD_HF_VX   : return xb(0xF, 0x30);
+      case OpCode::LD_R_VX    : return xb(0xF, 0x75);
+      case OpCode::LD_VX_R    : return xb(0xF, 0x85);
+      default                 : return 0x0000;
+    }
+  }
 
-    switch (op) {
-      case 0x0: {
-        if      (byte == 0x00) os << "NOP\n";
-        else if (byte == 0xE0) os << "CLS\n";
-        else if (byte == 0xEE) os << "RET\n";
-        else if (y    == 0xC) {
+  // true if opcode decodes to an instruction which encodes back to it
+  // (else disassembled as raw DW word so listings reassemble exactly)
+  static bool isCanonicalOp(ushort opcode) {
+    const DecodedOp &op = decodeTable()[opcode];
+
+    return (op.code == OpCode::BAD || encodeOp(op) == opcode);
+  }
+
+  // shared table of all 64K opcodes decoded
+  static const DecodedOp *decodeTable() {
+    static const std::vector<DecodedOp> table = []() {
+      std::vector<DecodedOp> table(0x10000);
+
+      for (int i = 0; i < 0x10000; ++i)
+        table[i] = decodeOp(ushort(i));
+
+      return table;
+    }();
+
+    return &table[0];
+  }
+
+  ushort opcode(ushort pos) { return ushort((memory(pos) << 8) | memory(pos + 1)); }
+
+  // predecoded instruction at address (kept in step with memory writes)
+  const DecodedOp &decodedOp(ushort pos) const { assert(pos <= MemDataEnd); return decoded_[pos]; }
+
+  //---
+
+  // step using predecoded instruction and dense jump table dispatch
+  // (same behavior as step())
+  bool stepDecoded() {
+    if (waitKey_)
+      return checkWaitKey();
+
+    return runOp(decoded_[PC_]);
+  }
+
+  // run op (a copy of decodedOp(PC())) as stepDecoded() would (used to run
+  // one decoded op for many instances of the same rom)
+  bool stepOp(const DecodedOp &op) {
+    if (waitKey_)
+      return checkWaitKey();
+
+    return runOp(op);
+  }
+
+  //---
+
+  // execute cached basic block at PC, stopping after maxOps instructions
+  // (returns number of instructions executed and false in rc if stopped)
+  int stepBlock(int maxOps, bool &rc) {
+    if (waitKey_) {
+      rc = checkWaitKey();
+      return 1;
+    }
+
+    //---
+
+    Block *block = lookupBlock(PC());
+
+    if (! block->native && blockCompiler_ && ++block->hits == blockCompileHits_)
+      blockCompiler_(*block);
+
+    int n = std::min(block->numOps, maxOps);
+
+    int i = 0;
+
+    // run native prefix (exits at first instruction needing the runtime,
+    // not used when counting instructions)
+    if (block->native && block->numNativeOps <= n && ! isStatsEnabled()) {
+      PC_ = block->native(V_, &I_);
+
+      i = block->numNativeOps;
+    }
+
+    runningBlock_ = block;
+
+    rc = true;
+
+    while (i < n) {
+      if (! runOp(block->ops[i++])) {
+        rc = false;
+        break;
+      }
+
+      // block overwritten by its own instruction
+      if (! runningBlock_)
+        break;
+    }
+
+    runningBlock_ = nullptr;
+
+    if (retiredBlock_)
+      retiredBlock_.reset();
+
+    return i;
+  }
+
+  // number of cached basic blocks
+  int numBlocks() const {
+    int n = 0;
+
+    for (const auto &block : blocks_)
+      if (block)
+        ++n;
+
+    return n;
+  }
+
+  void flushBlocks() {
+    assert(! runningBlock_);
+
+    blocks_   .clear();
+    blockRefs_.clear();
+  }
+
+  // set compiler called when a block has been run hits times
+  void setBlockCompiler(const BlockCompiler &compiler, uint hits=16) {
+    blockCompiler_    = compiler;
+    blockCompileHits_ = hits;
+
+    resetNativeBlocks();
+  }
+
+  // drop native code of all cached blocks
+  void resetNativeBlocks() {
+    assert(! runningBlock_);
+
+    for (auto &block : blocks_) {
+      if (! block) continue;
+
+      block->hits         = 0;
+      block->native       = nullptr;
+      block->numNativeOps = 0;
+    }
+  }
+
+  //---
+
+  Engine engine() const { return engine_; }
+  void setEngine(Engine engine) { engine_ = engine; }
+
+  // instructions per 60Hz frame (timers tick once per frame)
+  int cyclesPerFrame() const { return cyclesPerFrame_; }
+  void setCyclesPerFrame(int n) {
+    assert(n > 0);
+
+    cyclesPerFrame_ = n;
+
+    // keep part run frame within new frame size
+    frameCycles_ = std::min(frameCycles_, n - 1);
+  }
+
+  // total cycles run and cycles into current frame
+  uint64_t cycles() const { return cycles_; }
+  int frameCycles() const { return frameCycles_; }
+
+  void setFrameProc(const FrameProc &proc) { frameProc_ = proc; }
+
+  void setBreakpoint(ushort pos, bool b) {
+    assert(pos <= MemDataEnd);
+
+    if (breakpoints_.empty())
+      breakpoints_.resize(MemSize);
+
+    breakpoints_[pos] = b;
+
+    numBreakpoints_ = int(std::count(breakpoints_.begin(), breakpoints_.end(), true));
+  }
+
+  bool isBreakpoint(ushort pos) const {
+    return (numBreakpoints_ > 0 && breakpoints_[pos]);
+  }
+
+  void clearBreakpoints() {
+    breakpoints_.clear();
+
+    numBreakpoints_ = 0;
+  }
+
+  //---
+
+  // execution counts are only compiled in when CCHIP8_STATS is defined and
+  // then only counted while enabled (native blocks are not used while enabled)
+  static bool isStatsSupported() {
+#ifdef CCHIP8_STATS
+    return true;
+#else
+    return false;
+#endif
+  }
+
+  bool isStatsEnabled() const {
+#ifdef CCHIP8_STATS
+    return statsEnabled_;
+#else
+    return false;
+#endif
+  }
+
+  void setStatsEnabled(bool b) { statsEnabled_ = (b && isStatsSupported()); }
+
+  const Stats &stats() const { return stats_; }
+
+  void resetStats() { stats_ = Stats(); }
+
+  static const char *opCodeName(OpCode code) {
+    static const char *names[] = {
+      "NOP", "CLS", "RET", "SCD", "SCR", "SCL", "EXIT", "LOW", "HIGH", "SYS", "JP", "CALL",
+      "SE_VX_NN", "SNE_VX_NN", "SE_VX_VY", "LD_VX_NN", "ADD_VX_NN", "LD_VX_VY", "OR_VX_VY",
+      "AND_VX_VY", "XOR_VX_VY", "ADD_VX_VY", "SUB_VX_VY", "SHR_VX_VY", "SUBN_VX_VY",
+      "SHL_VX_VY", "SNE_VX_VY", "LD_I_NNN", "JP_V0_NNN", "RND_VX_NN", "DRW_VX_VY_N",
+      "SKP_VX", "SKNP_VX", "LD_VX_DT", "LD_VX_K", "LD_DT_VX", "LD_ST_VX", "ADD_I_VX",
+      "LD_F_VX", "LD_B_VX", "LD_IM_VX", "LD_VX_IM", "LD_HF_VX", "LD_R_VX", "LD_VX_R", "BAD"
+    };
+
+    static_assert(sizeof(names)/sizeof(names[0]) == size_t(OpCode::NUM_OPS),
+                  "missing op code name");
+
+    return (code < OpCode::NUM_OPS ? names[int(code)] : "");
+  }
+
+  //---
+
+  // run n cycles (one instruction per cycle, idle while waiting for a key),
+  // ticking the timers and calling the frame proc at each frame boundary
+  StopReason runCycles(uint64_t n) {
+    if (exited_) return StopReason::EXIT;
+    if (fault_ ) return StopReason::FAULT;
+
+    uint64_t end = cycles_ + n;
+
+    while (cycles_ < end) {
+      uint64_t n1 = std::min(end - cycles_, uint64_t(cyclesPerFrame_ - frameCycles_));
+
+      StopReason reason;
+
+      uint64_t n2 = execCycles(n1, reason);
+
+      cycles_      += n2;
+      frameCycles_ += int(n2);
+
+      if (frameCycles_ >= cyclesPerFrame_) {
+        frameCycles_ = 0;
+
+        tick();
+
+        if (frameProc_)
+          frameProc_();
+      }
+
+      if (reason != StopReason::BUDGET)
+        return reason;
+    }
+
+    return (waitKey_ && ! keyPressed_ ? StopReason::WAIT_KEY : StopReason::BUDGET);
+  }
+
+  // run to end of current frame
+  StopReason runUntilFrame() {
+    StopReason reason = runCycles(uint64_t(cyclesPerFrame_ - frameCycles_));
+
+    return (reason == StopReason::BUDGET ? StopReason::FRAME : reason);
+  }
+
+  //---
+
+  void tick() {
+    if (DT() > 0) setDT(DT() - 1);
+    if (ST() > 0) setST(ST() - 1);
+  }
+
+  //---
+
+  void disassemble(std::ostream &os, bool showAddr=true) {
+    disassemble(PC(), os, showAddr);
+  }
+
+  void disassemble(ushort PC, std::ostream &os, bool showAddr=true) {
+    if (showAddr)
+      os << shortStr(PC) << " : ";
+
+    //---
+
+    uchar b0   = memory(PC++);
+    uchar byte = memory(PC++);
+
+    // <op> <x> <y> <v3>
+    uchar op = (b0   & 0xF0) >> 4;
+    uchar x  =  b0   & 0x0F;
+    uchar y  = (byte & 0xF0) >> 4;
+    uchar v3 =  byte & 0x0F;
+
+    auto addr = [&]() { return (x << 8) | byte; };
+
+    //---
+
+    auto badOp = [&]() { os << "Bad OP " << charStr(b0) << " " << charStr(byte) << "\n"; };
+
+    //---
+
+    // non canonical encoding (e.g. 5XY1) as raw word
+    if (! isCanonicalOp(ushort((b0 << 8) | byte))) {
+      os << "DW " << shortStr(ushort((b0 << 8) | byte)) << "\n";
+      return;
+    }
+
+    switch (op) {
+      case 0x0: {
+        if      (byte == 0x00) os << "NOP\n";
+        else if (byte == 0xE0) os << "CLS\n";
+        else if (byte == 0xEE) os << "RET\n";
+        else if (y    == 0xC) {
           os << "SCD " << charStr(v3) << "\n";
         }
         else if (byte == 0xFB) {
@@ -679,6 +1751,139 @@ class CChip8 {
     }
   }
 
+  //---
+
+  // buffer size for one disassembled instruction (with address)
+  static const size_t MaxDisasmSize = 32;
+
+  // buffer size for listing of all of memory
+  static const size_t MaxListingSize = (MemSize/2)*MaxDisasmSize;
+
+  // disassembly format of instruction: mnemonic and operands with %x, %y
+  // (register), %n (nibble), %b (byte), %a (address) and %h (opcode high byte)
+  // for operand values (also the syntax accepted by CChip8Assembler)
+  static const char *opFormat(OpCode code) {
+    static const char *formats[] = {
+      "NOP", "CLS", "RET", "SCD %n", "SCR", "SCL", "EXIT", "LOW", "HIGH", "SYS %a",
+      "JP %a", "CALL %a", "SE V%x, %b", "SNE V%x, %b", "SE V%x, V%y", "LD V%x, %b",
+      "ADD V%x, %b", "LD V%x, V%y", "OR V%x, V%y", "AND V%x, V%y", "XOR V%x, V%y",
+      "ADD V%x, V%y", "SUB V%x, V%y", "SHR V%x, V%y", "SUBN V%x, V%y", "SHL V%x, V%y",
+      "SNE V%x, V%y", "LD I, %a", "JP V0, %a", "RND V%x, %b", "DRW V%x, V%y, %n",
+      "SKP V%x", "SKNP V%x", "LD V%x, DT", "LD V%x, K", "LD DT, V%x", "LD ST, V%x",
+      "ADD I, V%x", "LD F, V%x", "LD B, V%x", "LD [I], V%x", "LD V%x, [I]", "LD HF, V%x",
+      "LD R, V%x", "LD V%x, R", "Bad OP %h %b"
+    };
+
+    static_assert(sizeof(formats)/sizeof(formats[0]) == size_t(OpCode::NUM_OPS),
+                  "missing disassembly format");
+
+    return formats[int(code)];
+  }
+
+  // disassemble opcode into buf (same text as disassemble(PC, os) without
+  // address and newline). Table driven, no allocation. Returns length
+  // (buf nul terminated, size at least MaxDisasmSize).
+  static size_t disassembleOp(ushort opcode, char *buf) {
+    const DecodedOp &op = decodeTable()[opcode];
+
+    const char *format = (isCanonicalOp(opcode) ? opFormat(op.code) : "DW %w");
+
+    char *p = buf;
+
+    for (const char *f = format; *f; ++f) {
+      if (*f != '%') { *p++ = *f; continue; }
+
+      switch (*++f) {
+        case 'x': p = hexStr(op.x        , p); break;
+        case 'y': p = hexStr(op.y        , p); break;
+        case 'n': p = hexStr(op.n        , p); break;
+        case 'b': p = hexStr(op.nn       , p); break;
+        case 'a': p = hexStr(op.nnn      , p); break;
+        case 'h': p = hexStr(opcode >> 8 , p); break;
+        case 'w': p = hexStr(opcode      , p); break;
+        default :                              break;
+      }
+    }
+
+    *p = '\0';
+
+    return size_t(p - buf);
+  }
+
+  // disassemble instruction at PC into buf ("<addr> : " prefix if showAddr,
+  // no newline). Returns length (buf nul terminated, size at least MaxDisasmSize).
+  size_t disassemble(ushort PC, char *buf, bool showAddr=true) const {
+    char *p = buf;
+
+    if (showAddr) {
+      p = hexStr(PC, p);
+
+      *p++ = ' '; *p++ = ':'; *p++ = ' ';
+    }
+
+    ushort opcode = ushort((memory(PC) << 8) | memory((PC + 1) & MemDataEnd));
+
+    return size_t(p - buf) + disassembleOp(opcode, p);
+  }
+
+  // list instructions from start to end (inclusive, every 2 bytes) into buf in one
+  // pass, one line per instruction as disassemble(PC, os) writes them. Stops at
+  // last full line which fits. Returns listing text (in buf).
+  std::string_view listing(char *buf, size_t size, ushort start=MemDataStart,
+                           ushort end=MemDataEnd - 1) const {
+    size_t len = 0;
+
+    char line[MaxDisasmSize + 1];
+
+    for (int pc = start; pc <= end; pc += 2) {
+      size_t n = disassemble(ushort(pc), line);
+
+      line[n++] = '\n';
+
+      if (len + n > size)
+        break;
+
+      memcpy(buf + len, line, n);
+
+      len += n;
+    }
+
+    return std::string_view(buf, len);
+  }
+
+  // write listing (see listing()) to file, 256 lines at a time through a
+  // stack buffer
+  bool writeListing(FILE *fp, ushort start=MemDataStart, ushort end=MemDataEnd - 1) const {
+    const int chunkLines = 256;
+
+    char buffer[chunkLines*MaxDisasmSize];
+
+    for (int pc = start; pc <= end; pc += 2*chunkLines) {
+      int end1 = std::min(pc + 2*(chunkLines - 1), int(end));
+
+      std::string_view text = listing(buffer, sizeof(buffer), ushort(pc), ushort(end1));
+
+      if (fwrite(text.data(), 1, text.size(), fp) != text.size())
+        return false;
+    }
+
+    return true;
+  }
+
+ private:
+  // append unpadded upper case hex of v (as shortStr()/charStr())
+  static char *hexStr(uint v, char *p) {
+    static const char digits[] = "0123456789ABCDEF";
+
+    if (v >= 0x1000) *p++ = digits[(v >> 12) & 0xF];
+    if (v >= 0x100 ) *p++ = digits[(v >>  8) & 0xF];
+    if (v >= 0x10  ) *p++ = digits[(v >>  4) & 0xF];
+
+    *p++ = digits[v & 0xF];
+
+    return p;
+  }
+
  private:
   void initDigitSprites() {
     // "0"
@@ -876,69 +2081,616 @@ class CChip8 {
 
   //---
 
+  void predecode(ushort pos) {
+    pos &= MemDataEnd;
+
+    ushort opcode = ushort(memory_[pos] << 8);
+
+    if (pos < MemDataEnd)
+      opcode |= memory_[pos + 1];
+
+    decoded_[pos] = decodeTable_[opcode];
+  }
+
+  void predecodeAll() {
+    for (int pos = MemStart; pos <= MemDataEnd; ++pos)
+      predecode(pos);
+  }
+
+  //---
+
+  Block *lookupBlock(ushort pos) {
+    if (! blocks_.empty() && blocks_[pos])
+      return blocks_[pos].get();
+
+    if (blocks_.empty()) {
+      blocks_   .resize(MemSize);
+      blockRefs_.resize(MemSize);
+    }
+
+    auto &block = blocks_[pos];
+
+    if (! block)
+      block = buildBlock(pos);
+
+    return block.get();
+  }
+
+  std::unique_ptr<Block> buildBlock(ushort pos) {
+    auto block = std::make_unique<Block>();
+
+    block->start = pos;
+
+    while (block->numOps < MaxBlockOps && pos <= MemDataEnd) {
+      const DecodedOp &op = decoded_[pos];
+
+      block->ops[block->numOps++] = op;
+
+      pos += 2;
+
+      if (isBlockEnd(op.code))
+        break;
+    }
+
+    block->end = pos;
+
+    for (int i = block->start; i < block->end && i < MemSize; ++i)
+      ++blockRefs_[i];
+
+    return block;
+  }
+
+  static bool isBlockEnd(OpCode code) {
+    switch (code) {
+      case OpCode::NOP:
+      case OpCode::RET:
+      case OpCode::EXIT:
+      case OpCode::SYS:
+      case OpCode::JP:
+      case OpCode::CALL:
+      case OpCode::SE_VX_NN:
+      case OpCode::SNE_VX_NN:
+      case OpCode::SE_VX_VY:
+      case OpCode::SNE_VX_VY:
+      case OpCode::JP_V0_NNN:
+      case OpCode::SKP_VX:
+      case OpCode::SKNP_VX:
+      case OpCode::LD_VX_K:
+      case OpCode::BAD:
+        return true;
+      default:
+        return false;
+    }
+  }
+
+  // remove cached blocks containing written address
+  void invalidateBlocks(ushort pos) {
+    int start = std::max(int(MemDataStart), pos - 2*MaxBlockOps + 1);
+
+    for (int i = start; i <= pos; ++i) {
+      auto &block = blocks_[i];
+
+      if (! block || pos >= block->end)
+        continue;
+
+      for (int j = block->start; j < block->end && j < MemSize; ++j)
+        --blockRefs_[j];
+
+      // keep running block alive until stepBlock() returns
+      if (block.get() == runningBlock_) {
+        retiredBlock_ = std::move(block);
+        runningBlock_ = nullptr;
+      }
+      else
+        block.reset();
+    }
+  }
+
+  //---
+
+  // run up to n instructions without crossing a frame boundary
+  uint64_t execCycles(uint64_t n, StopReason &reason) {
+    reason = StopReason::BUDGET;
+
+    uint64_t i = 0;
+
+    while (i < n) {
+      // idle until key pressed (keys only change between calls or in frame proc)
+      if (waitKey_ && ! keyPressed_) {
+        if (isStatsEnabled())
+          stats_.waitKeyCycles += n - i;
+
+        return n;
+      }
+
+      if (numBreakpoints_ > 0) {
+        if (breakpoints_[PC_] && ! atBreakpoint_) {
+          atBreakpoint_ = true;
+          reason        = StopReason::BREAKPOINT;
+          break;
+        }
+
+        atBreakpoint_ = false;
+      }
+
+      bool rc = true;
+
+      if      (engine_ == Engine::STEP)
+        rc = step();
+      else if (engine_ == Engine::DECODED || numBreakpoints_ > 0)
+        rc = stepDecoded();
+      else {
+        i += stepBlock(int(std::min(n - i, uint64_t(MaxBlockOps))), rc) - 1;
+      }
+
+      ++i;
+
+      if (! rc) {
+        reason = (fault_ ? StopReason::FAULT : exited_ ? StopReason::EXIT : StopReason::HALT);
+        break;
+      }
+    }
+
+    return i;
+  }
+
+  //---
+
+  bool checkWaitKey() {
+    if (keyPressed_) {
+      setV(waitInd_, keyPressed_ - 1);
+      keyPressed_  = 0;
+      waitKey_     = false;
+    }
+
+    return true;
+  }
+
+  //---
+
+  // advance PC and run decoded op
+  bool runOp(const DecodedOp &op) {
+    if (isStatsEnabled()) {
+      // op may be freed by running it (block overwritten)
+      OpCode code = op.code;
+      uchar  n    = op.n;
+      ushort pc   = PC_;
+
+      nextOp();
+
+      bool rc = execOp(op);
+
+      countOp(code, n, pc);
+
+      return rc;
+    }
+
+    nextOp();
+
+    return execOp(op);
+  }
+
+  // count op run at pc (PC now after op)
+  void countOp(OpCode code, uchar n, ushort pc) {
+    ++stats_.ops[int(code)];
+
+    switch (code) {
+      case OpCode::SE_VX_NN:
+      case OpCode::SNE_VX_NN:
+      case OpCode::SE_VX_VY:
+      case OpCode::SNE_VX_VY:
+      case OpCode::SKP_VX:
+      case OpCode::SKNP_VX:
+        ++stats_.skips;
+
+        if (PC_ == ((pc + 4) & 0xFFFF))
+          ++stats_.skipsTaken;
+
+        break;
+      case OpCode::DRW_VX_VY_N:
+        ++stats_.draws[n];
+
+        if (*VF_)
+          ++stats_.collisions;
+
+        break;
+      default:
+        break;
+    }
+  }
+
+  bool execOp(const DecodedOp &op) {
+    switch (op.code) {
+      case OpCode::NOP:         return execNOP(op);
+      case OpCode::CLS:         return execCLS(op);
+      case OpCode::RET:         return execRET(op);
+      case OpCode::SCD:         return execSCD(op);
+      case OpCode::SCR:         return execSCR(op);
+      case OpCode::SCL:         return execSCL(op);
+      case OpCode::EXIT:        return execEXIT(op);
+      case OpCode::LOW:         return execLOW(op);
+      case OpCode::HIGH:        return execHIGH(op);
+      case OpCode::SYS:         return execSYS(op);
+      case OpCode::JP:          return execJP(op);
+      case OpCode::CALL:        return execCALL(op);
+      case OpCode::SE_VX_NN:    return execSE_VX_NN(op);
+      case OpCode::SNE_VX_NN:   return execSNE_VX_NN(op);
+      case OpCode::SE_VX_VY:    return execSE_VX_VY(op);
+      case OpCode::LD_VX_NN:    return execLD_VX_NN(op);
+      case OpCode::ADD_VX_NN:   return execADD_VX_NN(op);
+      case OpCode::LD_VX_VY:    return execLD_VX_VY(op);
+      case OpCode::OR_VX_VY:    return execOR_VX_VY(op);
+      case OpCode::AND_VX_VY:   return execAND_VX_VY(op);
+      case OpCode::XOR_VX_VY:   return execXOR_VX_VY(op);
+      case OpCode::ADD_VX_VY:   return execADD_VX_VY(op);
+      case OpCode::SUB_VX_VY:   return execSUB_VX_VY(op);
+      case OpCode::SHR_VX_VY:   return execSHR_VX_VY(op);
+      case OpCode::SUBN_VX_VY:  return execSUBN_VX_VY(op);
+      case OpCode::SHL_VX_VY:   return execSHL_VX_VY(op);
+      case OpCode::SNE_VX_VY:   return execSNE_VX_VY(op);
+      case OpCode::LD_I_NNN:    return execLD_I_NNN(op);
+      case OpCode::JP_V0_NNN:   return execJP_V0_NNN(op);
+      case OpCode::RND_VX_NN:   return execRND_VX_NN(op);
+      case OpCode::DRW_VX_VY_N: return execDRW_VX_VY_N(op);
+      case OpCode::SKP_VX:      return execSKP_VX(op);
+      case OpCode::SKNP_VX:     return execSKNP_VX(op);
+      case OpCode::LD_VX_DT:    return execLD_VX_DT(op);
+      case OpCode::LD_VX_K:     return execLD_VX_K(op);
+      case OpCode::LD_DT_VX:    return execLD_DT_VX(op);
+      case OpCode::LD_ST_VX:    return execLD_ST_VX(op);
+      case OpCode::ADD_I_VX:    return execADD_I_VX(op);
+      case OpCode::LD_F_VX:     return execLD_F_VX(op);
+      case OpCode::LD_B_VX:     return execLD_B_VX(op);
+      case OpCode::LD_IM_VX:    return execLD_IM_VX(op);
+      case OpCode::LD_VX_IM:    return execLD_VX_IM(op);
+      case OpCode::LD_HF_VX:    return execLD_HF_VX(op);
+      case OpCode::LD_R_VX:     return execLD_R_VX(op);
+      case OpCode::LD_VX_R:     return execLD_VX_R(op);
+      case OpCode::BAD:         return execBAD(op);
+      default         : return execBAD(op);
+    }
+  }
+
+  // handlers for each OpCode (dispatched from execOp())
+  bool execNOP(const DecodedOp &) { return false; }
+
+  bool execCLS(const DecodedOp &) { clearScreen(); return true; }
+
+  bool execRET(const DecodedOp &) { setPC(popSP()); return true; }
+
+  bool execSCD(const DecodedOp &op) {
+    if (isSuper()) scrollDown(op.n); else return fault();
+    return true;
+  }
+
+  bool execSCR(const DecodedOp &) {
+    if (isSuper()) scrollRight(isHighRes() ? 4 : 2); else return fault();
+    return true;
+  }
+
+  bool execSCL(const DecodedOp &) {
+    if (isSuper()) scrollLeft(isHighRes() ? 4 : 2); else return fault();
+    return true;
+  }
+
+  bool execEXIT(const DecodedOp &) {
+    if (isSuper()) return quit(); else return fault();
+  }
+
+  bool execLOW(const DecodedOp &) {
+    if (isSuper()) setHighRes(false); else return fault();
+    return true;
+  }
+
+  bool execHIGH(const DecodedOp &) {
+    if (isSuper()) setHighRes(true); else return fault();
+    return true;
+  }
+
+  bool execSYS(const DecodedOp &op) { setPC(op.nnn); return true; }
+
+  bool execJP(const DecodedOp &op) { setPC(op.nnn); return true; }
+
+  bool execCALL(const DecodedOp &op) { pushSP(PC()); setPC(op.nnn); return true; }
+
+  bool execSE_VX_NN(const DecodedOp &op) {
+    if (V(op.x) == op.nn) nextOp();
+    return true;
+  }
+
+  bool execSNE_VX_NN(const DecodedOp &op) {
+    if (V(op.x) != op.nn) nextOp();
+    return true;
+  }
+
+  bool execSE_VX_VY(const DecodedOp &op) {
+    if (V(op.x) == V(op.y)) nextOp();
+    return true;
+  }
+
+  bool execLD_VX_NN(const DecodedOp &op) { setV(op.x, op.nn); return true; }
+
+  bool execADD_VX_NN(const DecodedOp &op) { setV(op.x, V(op.x) + op.nn); return true; }
+
+  bool execLD_VX_VY(const DecodedOp &op) { setV(op.x, V(op.y)); return true; }
+
+  bool execOR_VX_VY(const DecodedOp &op) { setV(op.x, V(op.x) | V(op.y)); return true; }
+
+  bool execAND_VX_VY(const DecodedOp &op) { setV(op.x, V(op.x) & V(op.y)); return true; }
+
+  bool execXOR_VX_VY(const DecodedOp &op) { setV(op.x, V(op.x) ^ V(op.y)); return true; }
+
+  bool execADD_VX_VY(const DecodedOp &op) {
+    ushort sum = V(op.x) + V(op.y); setVF(sum > 0xFF ? 1 : 0); setV(op.x, sum & 0xFF);
+    return true;
+  }
+
+  bool execSUB_VX_VY(const DecodedOp &op) {
+    setVF(V(op.x) >= V(op.y) ? 1 : 0); setV(op.x, V(op.x) - V(op.y));
+    return true;
+  }
+
+  bool execSHR_VX_VY(const DecodedOp &op) {
+    uchar s = (quirks_ & QuirkShiftVY ? op.y : op.x);
+    setVF(V(s) & 1 ? 1 : 0); setV(op.x, V(s) >> 1);
+    return true;
+  }
+
+  bool execSUBN_VX_VY(const DecodedOp &op) {
+    setVF(V(op.y) >= V(op.x) ? 1 : 0); setV(op.x, V(op.y) - V(op.x));
+    return true;
+  }
+
+  bool execSHL_VX_VY(const DecodedOp &op) {
+    uchar s = (quirks_ & QuirkShiftVY ? op.y : op.x);
+    setVF(V(s) & 0x80 ? 1 : 0); setV(op.x, V(s) << 1);
+    return true;
+  }
+
+  bool execSNE_VX_VY(const DecodedOp &op) {
+    if (V(op.x) != V(op.y)) nextOp();
+    return true;
+  }
+
+  bool execLD_I_NNN(const DecodedOp &op) { setI(op.nnn); return true; }
+
+  bool execJP_V0_NNN(const DecodedOp &op) { setPC(op.nnn + V(0)); return true; }
+
+  bool execRND_VX_NN(const DecodedOp &op) { setV(op.x, rand() & op.nn); return true; }
+
+  bool execDRW_VX_VY_N(const DecodedOp &op) {
+    setVF(drawSprite(&memory_[I()], op.n, V(op.x), V(op.y)));
+    return true;
+  }
+
+  bool execSKP_VX(const DecodedOp &op) {
+    if (isKey(V(op.x))) nextOp();
+    return true;
+  }
+
+  bool execSKNP_VX(const DecodedOp &op) {
+    if (! isKey(V(op.x))) nextOp();
+    return true;
+  }
+
+  bool execLD_VX_DT(const DecodedOp &op) { setV(op.x, DT()); return true; }
+
+  bool execLD_VX_K(const DecodedOp &op) {
+    keyPressed_ = 0; waitInd_ = op.x; waitKey_ = true;
+    return true;
+  }
+
+  bool execLD_DT_VX(const DecodedOp &op) { setDT(V(op.x)); return true; }
+
+  bool execLD_ST_VX(const DecodedOp &op) { setST(V(op.x)); return true; }
+
+  bool execADD_I_VX(const DecodedOp &op) { setVF(setI(I() + V(op.x))); return true; }
+
+  bool execLD_F_VX(const DecodedOp &op) { setI(SpriteAddr + V(op.x)*CharHeight); return true; }
+
+  bool execLD_B_VX(const DecodedOp &op) {
+    uchar i = V(op.x);
+
+    setMemory(I()    ,  i / 100);
+    setMemory(I() + 1, (i % 100)/10);
+    setMemory(I() + 2,  i % 10);
+
+    return true;
+  }
+
+  bool execLD_IM_VX(const DecodedOp &op) {
+    // op is redecoded if store overwrites it
+    int x = op.x;
+
+    for (int i = 0; i <= x; ++i)
+      setMemory(I() + i, V(i));
+
+    if (quirks_ & QuirkLoadStoreI)
+      setI(I() + x + 1);
+
+    return true;
+  }
+
+  bool execLD_VX_IM(const DecodedOp &op) {
+    for (int i = 0; i <= op.x; ++i)
+      setV(i, memory(I() + i));
+
+    if (quirks_ & QuirkLoadStoreI)
+      setI(I() + op.x + 1);
+
+    return true;
+  }
+
+  bool execLD_HF_VX(const DecodedOp &) {
+    if (! isSuper()) return fault();
+    return true;
+  }
+
+  bool execLD_R_VX(const DecodedOp &op) {
+    if (isSuper()) {
+      for (int i = 0; i <= op.x; ++i)
+        setR(i, V(i));
+    }
+    else
+      return fault();
+
+    return true;
+  }
+
+  bool execLD_VX_R(const DecodedOp &op) {
+    if (isSuper()) {
+      for (int i = 0; i <= op.x; ++i)
+        setV(i, R(i));
+    }
+    else
+      return fault();
+
+    return true;
+  }
+
+  bool execBAD(const DecodedOp &) { return fault(); }
+
+  //---
+
+  // xor sprite rows into display (rows wrap from the end of the display to the
+  // start and pixels past the end of a row continue on the next row) and
+  // return 1 if any set pixel is cleared
   uchar drawSprite(const uchar *addr, uchar len, uchar x, uchar y) {
-    uchar hit = 0;
+    uint64_t hit = 0;
 
     int sw = screenWidth ();
     int sh = screenHeight();
     int ss = sw*sh;
+    int nw = ss/64;
+    uint64_t *screen = this->pscreen();
+
+    // (display sizes are powers of 2)
+    int pos = (y*sw + x) & (ss - 1);
 
-    uchar *screen = this->pscreen();
+    int sb = (sw == 64 ? 6 : 7);
 
-    ushort pos = y*sw + x;
+    int row = pos >> sb;
+    int nr  = len + ((pos & (sw - 1)) > sw - 8 ? 1 : 0);
 
     for (int i = 0; i < len; ++i) {
-      while (pos >= ss)
-        pos -= ss;
+      uint64_t pixels = addr[i];
 
-      uchar pixels = addr[i];
+      int w   = pos >> 6;
+      int off = pos & 63;
 
-      for (int px = 0; px < 8; ++px) {
-        int px1 = 7 - px;
+      // sprite row at pixel offset in word
+      uint64_t m1 = (pixels << 56) >> off;
 
-        uchar pixel = (pixels & (1 << px1));
+      hit       |= screen[w] & m1;
+      screen[w] ^= m1;
 
-        if (pixel && screen[pos + px])
-          hit = 1;
+      // remainder in next word (dropped at end of display)
+      if (off > 56 && w + 1 < nw) {
+        uint64_t m2 = pixels << (120 - off);
 
-        screen[pos + px] ^= pixel;
+        hit           |= screen[w + 1] & m2;
+        screen[w + 1] ^= m2;
       }
 
       pos += sw;
+
+      if (pos >= ss)
+        pos -= ss;
     }
 
-    return hit;
+    markDirtyRows(row, nr, sh);
+
+    return (hit ? 1 : 0);
+  }
+
+  // mark n display rows from row as dirty (wrapping to top)
+  void markDirtyRows(int row, int n, int sh) {
+    if (n >= sh) {
+      dirtyRows_ = AllRows;
+      return;
+    }
+
+    uint64_t mask = (uint64_t(1) << n) - 1;
+
+    uint64_t rows = mask << row;
+
+    // rows past bottom to top
+    if (row + n > sh)
+      rows |= mask >> (sh - row);
+
+    dirtyRows_ |= rows & (AllRows >> (64 - sh));
   }
 
   //---
 
-  class IntInRange {
-   public:
-    IntInRange(int min, int max) :
-     eng_(rd_()), idis_(min, max) {
-    }
+  // FNV-1a style hash of state data (8 bytes at a time in four independent
+  // streams so the multiplies overlap)
+  static uint64_t stateChecksum(const SaveState *state) {
+    const uchar *data = reinterpret_cast<const uchar *>(state) + StateHeaderSize;
+
+    size_t n = (sizeof(SaveState) - StateHeaderSize)/8;
+
+    uint64_t h[4] = { 0xcbf29ce484222325ULL, 0x84222325cbf29ce4ULL,
+                      0xcbf29ce484222326ULL, 0x84222326cbf29ce4ULL };
+
+    auto mix = [](uint64_t &h, const uchar *p) {
+      uint64_t w; memcpy(&w, p, 8);
 
-    int gen() {
-      return idis_(eng_);
+      h ^= w;
+      h *= 0x100000001b3ULL;
+      h ^= h >> 32;
+    };
+
+    size_t i = 0;
+
+    for ( ; i + 4 <= n; i += 4) {
+      mix(h[0], data + 8*i     );
+      mix(h[1], data + 8*i +  8);
+      mix(h[2], data + 8*i + 16);
+      mix(h[3], data + 8*i + 24);
     }
 
-   private:
-    std::random_device                 rd_;
-    std::default_random_engine         eng_;
-    std::uniform_int_distribution<int> idis_;
-  };
+    for ( ; i < n; ++i)
+      mix(h[i & 3], data + 8*i);
+
+    return (h[0] ^ (h[1]*3) ^ (h[2]*5) ^ (h[3]*7));
+  }
 
+  //---
+
+  // RND byte (top bits of xoshiro256** are best)
   uchar rand() {
-    IntInRange ir(0, 255);
+    return uchar(nextRandom() >> 56);
+  }
+
+  // xoshiro256** step
+  uint64_t nextRandom() {
+    auto rotl = [](uint64_t x, int k) { return (x << k) | (x >> (64 - k)); };
+
+    uint64_t *s = random_.s;
+
+    uint64_t r = rotl(s[1]*5, 7)*9;
+    uint64_t t = s[1] << 17;
 
-    return ir.gen();
+    s[2] ^= s[0];
+    s[3] ^= s[1];
+    s[1] ^= s[2];
+    s[0] ^= s[3];
+
+    s[2] ^= t;
+
+    s[3] = rotl(s[3], 45);
+
+    return r;
   }
 
   //---
 
   void clearScreen() {
-    memset(screen_     , 0, DisplaySize*sizeof(uchar));
-    memset(superScreen_, 0, SuperDisplaySize*sizeof(uchar));
+    memset(screen_     , 0, sizeof(screen_));
+    memset(superScreen_, 0, sizeof(superScreen_));
+
+    dirtyRows_ = AllRows;
   }
 
  private:
@@ -977,10 +2729,10 @@ class CChip8 {
   //  A 0 B F
   uchar keys_[NumKeys]; // pressed: 1, not pressed 0
 
-  // display
-  uchar screen_     [DisplaySize];
-  uchar superScreen_[SuperDisplaySize];
-  uchar scrollBuffer[DisplaySize];
+  // display (1 bit per pixel)
+  alignas(16) uint64_t screen_     [DisplaySize/64];
+  alignas(16) uint64_t superScreen_[SuperDisplaySize/64];
+  uint64_t             dirtyRows_ { AllRows };
 
   // sprites (8x16)
 //using Sprite      = uchar  [16];
@@ -989,14 +2741,50 @@ class CChip8 {
 //Sprite      sprites_     [16];
 //SuperSprite superSprites_[16];
 
+  // RND generator
+  RandomState random_;
+
   // config
   bool superChip48_ = false;
   bool highRes_     = false;
+  uint quirks_      = 0;
 
   // wait key
   bool  waitKey_    { false };
   uchar waitInd_    { 0 };
   uchar keyPressed_ { 0 };
+
+  // run state
+  bool      exited_         { false };
+  bool      fault_          { false };
+  Engine    engine_         { Engine::DECODED };
+  int       cyclesPerFrame_ { 9 };
+  uint64_t  cycles_         { 0 };
+  int       frameCycles_    { 0 };
+  FrameProc frameProc_;
+
+  // breakpoints (indexed by address, allocated on first use)
+  std::vector<bool> breakpoints_;
+  int               numBreakpoints_ { 0 };
+  bool              atBreakpoint_   { false };
+
+  // shared opcode decode table
+  const DecodedOp* decodeTable_ { nullptr };
+
+  // predecoded instruction per address
+  DecodedOp decoded_[MemSize];
+
+  // basic block cache (indexed by start address, allocated on first use)
+  std::vector<std::unique_ptr<Block>> blocks_;
+  std::vector<uchar>                  blockRefs_;    // number of blocks covering address
+  const Block*                        runningBlock_ { nullptr };
+  std::unique_ptr<Block>              retiredBlock_;
+  BlockCompiler                       blockCompiler_;
+  uint                                blockCompileHits_ { 16 };
+
+  // execution counts (CCHIP8_STATS)
+  bool  statsEnabled_ { false };
+  Stats stats_;
 };
 
 #endif
@@ -0,0 +1,430 @@
+#ifndef CChip8Analyze_H
+#define CChip8Analyze_H
+
+#include <CChip8.h>
+
+#include <cstdio>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+// Static analysis of a CChip8 program in memory.
+//
+// Follows control flow (recursive descent) from the program start (and any
+// added entries) through JP, CALL and skip edges, so only reachable bytes
+// are decoded as instructions and code at odd addresses is found. Bytes
+// addressed by LD I, NNN ahead of a DRW in the same block are marked as
+// sprite data and those read or written through I by LD B/[I] as data.
+// Everything else is unknown. Reachable code is split into basic blocks
+// with their successor edges (a control flow graph). BNNN jumps have
+// targets only known at runtime so are flagged as indirect and not followed.
+class CChip8Analyzer {
+ public:
+  using OpCode    = CChip8::OpCode;
+  using DecodedOp = CChip8::DecodedOp;
+
+  enum class ByteType : uchar {
+    UNKNOWN,
+    CODE,
+    SPRITE,
+    DATA
+  };
+
+  // how block ends
+  enum class BlockEnd : uchar {
+    FALL,     // next instruction is a block start
+    JUMP,     // JP/SYS to target
+    BRANCH,   // skip (next or one after)
+    CALL,     // CALL (target then return to next)
+    RET,      // RET
+    INDIRECT, // JP V0, NNN (target unknown)
+    STOP      // NOP, EXIT or bad instruction
+  };
+
+  // basic block [start, end)
+  struct Block {
+    ushort              start    { 0 };
+    ushort              end      { 0 };
+    int                 numOps   { 0 };
+    BlockEnd            blockEnd { BlockEnd::FALL };
+    std::vector<ushort> succs;           // successor block starts
+  };
+
+  using Blocks = std::map<ushort, Block>;
+
+ public:
+  CChip8Analyzer() { }
+
+  // extra entry point (e.g. known interrupt/jump table targets)
+  void addEntry(ushort addr) { entries_.insert(addr); }
+
+  // analyze memory of chip from program start and added entries
+  void analyze(const CChip8 &chip) {
+    std::fill(&types_[0], &types_[CChip8::MemSize], ByteType::UNKNOWN);
+    std::fill(&insts_[0], &insts_[CChip8::MemSize], false);
+    std::fill(&leaders_[0], &leaders_[CChip8::MemSize], false);
+
+    blocks_       .clear();
+    functions_    .clear();
+    indirectJumps_.clear();
+
+    //---
+
+    // trace code
+    std::vector<ushort> work;
+
+    auto addWork = [&](int addr, bool leader) {
+      if (addr < CChip8::MemDataStart || addr >= CChip8::MemDataEnd)
+        return;
+
+      if (leader)
+        leaders_[addr] = true;
+
+      if (! insts_[addr])
+        work.push_back(ushort(addr));
+    };
+
+    addWork(CChip8::MemDataStart, true);
+
+    for (auto addr : entries_)
+      addWork(addr, true);
+
+    while (! work.empty()) {
+      int pc = work.back(); work.pop_back();
+
+      // run of instructions to end of flow or already traced
+      while (pc >= CChip8::MemDataStart && pc < CChip8::MemDataEnd && ! insts_[pc]) {
+        insts_[pc] = true;
+
+        types_[pc] = types_[pc + 1] = ByteType::CODE;
+
+        DecodedOp op = decode(chip, ushort(pc));
+
+        int next = pc + 2;
+
+        bool cont = true;
+
+        switch (op.code) {
+          case OpCode::JP:
+          case OpCode::SYS:
+            addWork(op.nnn, true);
+            cont = false;
+            break;
+          case OpCode::CALL:
+            functions_.insert(op.nnn);
+            addWork(op.nnn, true);
+            addWork(next, true);
+            cont = false;
+            break;
+          case OpCode::SE_VX_NN:
+          case OpCode::SNE_VX_NN:
+          case OpCode::SE_VX_VY:
+          case OpCode::SNE_VX_VY:
+          case OpCode::SKP_VX:
+          case OpCode::SKNP_VX:
+            addWork(next    , true);
+            addWork(next + 2, true);
+            cont = false;
+            break;
+          case OpCode::JP_V0_NNN:
+            indirectJumps_.insert(ushort(pc));
+            cont = false;
+            break;
+          case OpCode::RET:
+          case OpCode::EXIT:
+          case OpCode::NOP:
+          case OpCode::BAD:
+            cont = false;
+            break;
+          default:
+            break;
+        }
+
+        if (! cont)
+          break;
+
+        pc = next;
+      }
+
+      // following instruction traced on another path starts a block
+      if (pc >= CChip8::MemDataStart && pc < CChip8::MemDataEnd && insts_[pc])
+        leaders_[pc] = true;
+    }
+
+    //---
+
+    buildBlocks(chip);
+
+    markData(chip);
+  }
+
+  //---
+
+  ByteType byteType(ushort addr) const { return types_[addr & CChip8::MemDataEnd]; }
+
+  // true if reachable instruction starts at addr
+  bool isInstruction(ushort addr) const { return insts_[addr & CChip8::MemDataEnd]; }
+
+  const Blocks &blocks() const { return blocks_; }
+
+  // block containing address (nullptr if not code)
+  const Block *block(ushort addr) const {
+    auto p = blocks_.upper_bound(addr);
+
+    if (p == blocks_.begin()) return nullptr;
+
+    --p;
+
+    return (addr < (*p).second.end ? &(*p).second : nullptr);
+  }
+
+  // CALL targets
+  const std::set<ushort> &functions() const { return functions_; }
+
+  // addresses of BNNN (indirect) jumps
+  const std::set<ushort> &indirectJumps() const { return indirectJumps_; }
+
+  int numBytes(ByteType type) const {
+    int n = 0;
+
+    for (int i = CChip8::MemDataStart; i <= CChip8::MemDataEnd; ++i)
+      if (types_[i] == type)
+        ++n;
+
+    return n;
+  }
+
+  //---
+
+  // label of block start (sub_XXX for CALL targets, L_XXX for others) or empty
+  std::string label(ushort addr) const {
+    if (! blocks_.count(addr))
+      return "";
+
+    char buffer[16];
+
+    snprintf(buffer, sizeof(buffer), "%s_%03X", functions_.count(addr) ? "sub" : "L", addr);
+
+    return buffer;
+  }
+
+  // write listing of analyzed memory (to end of last non zero byte): labelled
+  // instructions, sprite rows as pixels and other bytes as data
+  bool writeListing(const CChip8 &chip, FILE *fp) const {
+    int end = CChip8::MemDataEnd;
+
+    while (end >= CChip8::MemDataStart && chip.memory(ushort(end)) == 0 &&
+           types_[end] == ByteType::UNKNOWN)
+      --end;
+
+    char inst[CChip8::MaxDisasmSize];
+
+    for (int pc = CChip8::MemDataStart; pc <= end; ) {
+      if (insts_[pc]) {
+        if (leaders_[pc])
+          fprintf(fp, "%s:\n", label(ushort(pc)).c_str());
+
+        chip.disassemble(ushort(pc), inst);
+
+        fprintf(fp, "  %s%s\n", inst, indirectJumps_.count(ushort(pc)) ? " ; indirect" : "");
+
+        pc += 2;
+      }
+      else if (types_[pc] == ByteType::CODE) {
+        // second byte of instruction at odd address after data
+        ++pc;
+      }
+      else if (types_[pc] == ByteType::SPRITE) {
+        // sprite row as pixels
+        uchar b = chip.memory(ushort(pc));
+
+        fprintf(fp, "  %03X : DB %02X ; ", pc, b);
+
+        for (int i = 7; i >= 0; --i)
+          fputc((b >> i) & 1 ? '#' : '.', fp);
+
+        fputc('\n', fp);
+
+        ++pc;
+      }
+      else {
+        // up to 8 bytes of same type per line
+        ByteType type = types_[pc];
+
+        fprintf(fp, "  %03X : DB", pc);
+
+        int n = 0;
+
+        for ( ; n < 8 && pc <= end && types_[pc] == type && ! insts_[pc]; ++n, ++pc)
+          fprintf(fp, " %02X", chip.memory(ushort(pc)));
+
+        fputs(type == ByteType::DATA ? " ; data\n" : "\n", fp);
+      }
+    }
+
+    return (ferror(fp) == 0);
+  }
+
+ private:
+  static DecodedOp decode(const CChip8 &chip, ushort pc) {
+    return CChip8::decodeOp(ushort((chip.memory(pc) << 8) | chip.memory(pc + 1)));
+  }
+
+  static bool isBlockEnd(OpCode code) {
+    switch (code) {
+      case OpCode::JP:
+      case OpCode::SYS:
+      case OpCode::CALL:
+      case OpCode::SE_VX_NN:
+      case OpCode::SNE_VX_NN:
+      case OpCode::SE_VX_VY:
+      case OpCode::SNE_VX_VY:
+      case OpCode::SKP_VX:
+      case OpCode::SKNP_VX:
+      case OpCode::JP_V0_NNN:
+      case OpCode::RET:
+      case OpCode::EXIT:
+      case OpCode::NOP:
+      case OpCode::BAD:
+        return true;
+      default:
+        return false;
+    }
+  }
+
+  // split traced instructions into blocks at leaders and control flow
+  void buildBlocks(const CChip8 &chip) {
+    for (int start = CChip8::MemDataStart; start < CChip8::MemDataEnd; ++start) {
+      if (! insts_[start] || ! leaders_[start])
+        continue;
+
+      Block block;
+
+      block.start = ushort(start);
+
+      int pc = start;
+
+      for (;;) {
+        DecodedOp op = decode(chip, ushort(pc));
+
+        ++block.numOps;
+
+        int next = pc + 2;
+
+        if (isBlockEnd(op.code)) {
+          block.end = ushort(next);
+
+          switch (op.code) {
+            case OpCode::JP:
+            case OpCode::SYS:
+              block.blockEnd = BlockEnd::JUMP;
+              addSucc(block, op.nnn);
+              break;
+            case OpCode::CALL:
+              block.blockEnd = BlockEnd::CALL;
+              addSucc(block, op.nnn);
+              addSucc(block, next);
+              break;
+            case OpCode::JP_V0_NNN:
+              block.blockEnd = BlockEnd::INDIRECT;
+              break;
+            case OpCode::RET:
+              block.blockEnd = BlockEnd::RET;
+              break;
+            case OpCode::EXIT:
+            case OpCode::NOP:
+            case OpCode::BAD:
+              block.blockEnd = BlockEnd::STOP;
+              break;
+            default:
+              block.blockEnd = BlockEnd::BRANCH;
+              addSucc(block, next);
+              addSucc(block, next + 2);
+              break;
+          }
+
+          break;
+        }
+
+        // fall into next block (or end of memory)
+        if (next >= CChip8::MemDataEnd || ! insts_[next] || leaders_[next]) {
+          block.end      = ushort(next);
+          block.blockEnd = BlockEnd::FALL;
+
+          addSucc(block, next);
+
+          break;
+        }
+
+        pc = next;
+      }
+
+      blocks_[block.start] = block;
+    }
+  }
+
+  void addSucc(Block &block, int addr) const {
+    if (addr >= CChip8::MemDataStart && addr < CChip8::MemDataEnd && insts_[addr])
+      block.succs.push_back(ushort(addr));
+  }
+
+  // mark bytes addressed through I in each block (I from LD I, NNN in block)
+  void markData(const CChip8 &chip) {
+    for (const auto &pb : blocks_) {
+      const Block &block = pb.second;
+
+      int I = -1;
+
+      for (int pc = block.start; pc < block.end; pc += 2) {
+        DecodedOp op = decode(chip, ushort(pc));
+
+        switch (op.code) {
+          case OpCode::LD_I_NNN:
+            I = op.nnn;
+            break;
+          case OpCode::ADD_I_VX:
+          case OpCode::LD_F_VX:
+          case OpCode::LD_HF_VX:
+            I = -1;
+            break;
+          case OpCode::DRW_VX_VY_N:
+            // 16x16 sprite for DRW n = 0 (SCHIP)
+            if (I >= 0)
+              markBytes(I, (op.n ? op.n : 32), ByteType::SPRITE);
+            break;
+          case OpCode::LD_B_VX:
+            if (I >= 0)
+              markBytes(I, 3, ByteType::DATA);
+            break;
+          case OpCode::LD_IM_VX:
+          case OpCode::LD_VX_IM:
+            if (I >= 0)
+              markBytes(I, op.x + 1, ByteType::DATA);
+            break;
+          default:
+            break;
+        }
+      }
+    }
+  }
+
+  // mark bytes not already code
+  void markBytes(int addr, int n, ByteType type) {
+    for (int i = addr; i < addr + n && i <= CChip8::MemDataEnd; ++i) {
+      if (types_[i] == ByteType::UNKNOWN || (types_[i] == ByteType::DATA && type == ByteType::SPRITE))
+        types_[i] = type;
+    }
+  }
+
+ private:
+  std::set<ushort> entries_;
+  ByteType         types_  [CChip8::MemSize] { };
+  bool             insts_  [CChip8::MemSize] { }; // instruction start
+  bool             leaders_[CChip8::MemSize] { }; // block start
+  Blocks           blocks_;
+  std::set<ushort> functions_;
+  std::set<ushort> indirectJumps_;
+};
+
+#endif
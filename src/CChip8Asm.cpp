@@ -0,0 +1,126 @@
+#include <CChip8Asm.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+// Assemble CChip8 source files to .ch8 roms.
+
+namespace {
+
+void usage() {
+  fprintf(stderr,
+    "Usage: CChip8Asm [options] <file.asm>...\n"
+    "\n"
+    "  -o <file>  output rom (single input, default input with .ch8 extension)\n"
+    "  -l         print listing of assembled rom\n"
+    "  -c         check listing of assembled rom reassembles to same bytes\n");
+  exit(1);
+}
+
+// input name with extension replaced by .ch8
+std::string romName(const std::string &filename) {
+  size_t slash = filename.rfind('/');
+  size_t dot   = filename.rfind('.');
+
+  if (dot == std::string::npos || (slash != std::string::npos && dot < slash))
+    return filename + ".ch8";
+
+  return filename.substr(0, dot) + ".ch8";
+}
+
+}
+
+int
+main(int argc, char **argv)
+{
+  const char *outFile = nullptr;
+  bool        list    = false;
+  bool        check   = false;
+
+  std::vector<std::string> files;
+
+  for (int i = 1; i < argc; ++i) {
+    if (argv[i][0] == '-') {
+      if      (strcmp(argv[i], "-o") == 0 && i < argc - 1)
+        outFile = argv[++i];
+      else if (strcmp(argv[i], "-l") == 0)
+        list = true;
+      else if (strcmp(argv[i], "-c") == 0)
+        check = true;
+      else
+        usage();
+    }
+    else
+      files.push_back(argv[i]);
+  }
+
+  if (files.empty() || (outFile && files.size() > 1))
+    usage();
+
+  //---
+
+  CChip8Assembler assembler;
+
+  int rc = 0;
+
+  for (const auto &file : files) {
+    if (! assembler.assembleFile(file)) {
+      for (const auto &error : assembler.errors())
+        fprintf(stderr, "%s\n", error.c_str());
+
+      rc = 1;
+
+      continue;
+    }
+
+    std::string romFile = (outFile ? outFile : romName(file));
+
+    if (! assembler.writeRom(romFile.c_str())) {
+      fprintf(stderr, "Failed to write '%s'\n", romFile.c_str());
+      rc = 1;
+      continue;
+    }
+
+    //---
+
+    const auto &rom = assembler.rom();
+
+    if ((! list && ! check) || rom.empty())
+      continue;
+
+    CChip8 chip;
+
+    chip.reset();
+
+    chip.loadRom(rom.data(), rom.size());
+
+    // listing of rom (odd size lists one more byte)
+    std::vector<char> buffer(CChip8::MaxListingSize);
+
+    ushort end = ushort(CChip8::MemDataStart + rom.size() - 1);
+
+    std::string_view text = chip.listing(&buffer[0], buffer.size(), CChip8::MemDataStart, end);
+
+    if (list)
+      fwrite(text.data(), 1, text.size(), stdout);
+
+    if (check) {
+      CChip8Assembler::Bytes bytes = rom;
+
+      if (bytes.size() & 1)
+        bytes.push_back(0);
+
+      CChip8Assembler assembler1;
+
+      if (! assembler1.assemble(std::string(text), romFile) || assembler1.rom() != bytes) {
+        fprintf(stderr, "%s: listing does not reassemble to same bytes\n", romFile.c_str());
+        rc = 1;
+      }
+    }
+  }
+
+  return rc;
+}
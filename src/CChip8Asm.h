@@ -0,0 +1,833 @@
+#ifndef CChip8Asm_H
+#define CChip8Asm_H
+
+#include <CChip8.h>
+
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+// Two pass assembler of CChip8 programs.
+//
+// Accepts the syntax printed by CChip8::disassemble() (one statement per line):
+//   [<addr> :] [<label>:] <instruction|directive> [; comment]
+// Instructions are the disassembly formats (see CChip8::opFormat()), e.g.
+// "LD V0, 5", "DRW V1, V2, F", "SCD 4", "LD HF, V3", including "Bad OP <hi> <lo>".
+// Numbers are hex as printed by the disassembler (or 0x hex, 0b binary) and
+// expressions are numbers, labels, equates and $ (current address) added or
+// subtracted. A defined label takes precedence over a hex number of the same
+// text. A listing address prefix (hex then space then ':') sets the address
+// as ORG does.
+//
+// Directives:
+//   ORG <addr>               set address (from 200)
+//   DB <byte>[, <byte>...]   bytes (comma or space separated)
+//   DW <word>[, <word>...]   big endian words
+//   DS <count>[, <fill>]     count fill bytes (default 0)
+//   <name> EQU <value>       constant
+//   INCLUDE "<file>"         assemble file (relative to including file)
+//
+// Pass one assigns addresses to labels, pass two encodes. Output is the
+// bytes from 200 to the last one written (gaps zero), as a .ch8 file.
+// Listings (CChip8::listing()) reassemble to the bytes they list.
+class CChip8Assembler {
+ public:
+  using OpCode    = CChip8::OpCode;
+  using DecodedOp = CChip8::DecodedOp;
+  using Bytes     = std::vector<uchar>;
+  using Errors    = std::vector<std::string>;
+
+ public:
+  CChip8Assembler() { }
+
+  // assemble file (and includes). Returns false on error (see errors())
+  bool assembleFile(const std::string &filename) {
+    init();
+
+    std::string text;
+
+    if (! readFile(filename, text)) {
+      errors_.push_back(filename + ": cannot read file");
+      return false;
+    }
+
+    addSource(filename, std::move(text), 0);
+
+    return assembleSource();
+  }
+
+  // assemble text (name used in errors, includes relative to current directory)
+  bool assemble(const std::string &text, const std::string &name="<text>") {
+    init();
+
+    addSource(name, text, 0);
+
+    return assembleSource();
+  }
+
+  // program bytes (from MemDataStart)
+  const Bytes &rom() const { return rom_; }
+
+  // errors of last assemble ("<file>:<line>: <message>")
+  const Errors &errors() const { return errors_; }
+
+  // value of label or equate (false if not defined)
+  bool symbol(const std::string &name, int &value) const {
+    auto p = symbols_.find(name);
+    if (p == symbols_.end()) return false;
+
+    value = (*p).second;
+
+    return true;
+  }
+
+  // write rom to file (.ch8)
+  bool writeRom(const char *filename) const {
+    FILE *fp = fopen(filename, "wb");
+    if (! fp) return false;
+
+    bool rc = (fwrite(rom_.data(), 1, rom_.size(), fp) == rom_.size());
+
+    if (fclose(fp) != 0)
+      rc = false;
+
+    return rc;
+  }
+
+ private:
+  // parsed source line
+  struct Stmt {
+    int              file    { 0 };
+    int              line    { 0 };
+    int              addr    { -1 }; // listing address prefix
+    std::string_view label;
+    std::string_view name;           // mnemonic or directive
+    std::string_view args;           // operands
+    std::string_view equ;            // EQU name
+  };
+
+  enum class Directive {
+    NONE,
+    ORG,
+    DB,
+    DW,
+    DS,
+    EQU,
+    INCLUDE
+  };
+
+  // instruction format split into mnemonic and operand pattern
+  struct Format {
+    OpCode      code { OpCode::BAD };
+    std::string args;
+    int         numExprs { 0 };      // operand values which are expressions
+  };
+
+  using Formats = std::unordered_map<std::string, std::vector<Format>>;
+  using Symbols = std::unordered_map<std::string, int>;
+
+  static const int MaxIncludeDepth = 16;
+
+  //---
+
+  void init() {
+    files_  .clear();
+    sources_.clear();
+    stmts_  .clear();
+    symbols_.clear();
+    errors_ .clear();
+    rom_    .clear();
+  }
+
+  static bool readFile(const std::string &filename, std::string &text) {
+    FILE *fp = fopen(filename.c_str(), "rb");
+    if (! fp) return false;
+
+    char buffer[4096];
+
+    size_t n;
+
+    while ((n = fread(buffer, 1, sizeof(buffer), fp)) > 0)
+      text.append(buffer, n);
+
+    bool rc = (ferror(fp) == 0);
+
+    fclose(fp);
+
+    return rc;
+  }
+
+  // split source into statements (expanding includes)
+  void addSource(const std::string &filename, std::string text, int depth) {
+    int file = int(files_.size());
+
+    files_  .push_back(filename);
+    sources_.push_back(std::make_unique<std::string>(std::move(text)));
+
+    std::string_view src(*sources_.back());
+
+    int lineNum = 0;
+
+    while (! src.empty()) {
+      size_t pos = src.find('\n');
+
+      std::string_view line = src.substr(0, pos);
+
+      src = (pos == std::string_view::npos ? std::string_view() : src.substr(pos + 1));
+
+      ++lineNum;
+
+      Stmt stmt;
+
+      stmt.file = file;
+      stmt.line = lineNum;
+
+      if (! parseLine(line, stmt))
+        continue;
+
+      if (directive(stmt.name) != Directive::INCLUDE) {
+        stmts_.push_back(stmt);
+        continue;
+      }
+
+      // include file (relative to including file)
+      std::string_view arg = trim(stmt.args);
+
+      if (arg.size() >= 2 && arg.front() == '"' && arg.back() == '"')
+        arg = arg.substr(1, arg.size() - 2);
+
+      std::string includeName(arg);
+
+      size_t slash = filename.rfind('/');
+
+      if (! includeName.empty() && includeName[0] != '/' && slash != std::string::npos)
+        includeName = filename.substr(0, slash + 1) + includeName;
+
+      std::string includeText;
+
+      if      (arg.empty())
+        error(stmt, "missing include file name");
+      else if (depth >= MaxIncludeDepth)
+        error(stmt, "includes nested too deep");
+      else if (! readFile(includeName, includeText))
+        error(stmt, "cannot read include file '" + includeName + "'");
+      else
+        addSource(includeName, std::move(includeText), depth + 1);
+    }
+  }
+
+  // split line into address prefix, label, name and operands (false if empty)
+  bool parseLine(std::string_view line, Stmt &stmt) const {
+    // strip comment (outside quotes)
+    bool quoted = false;
+
+    for (size_t i = 0; i < line.size(); ++i) {
+      if      (line[i] == '"') quoted = ! quoted;
+      else if (line[i] == ';' && ! quoted) { line = line.substr(0, i); break; }
+    }
+
+    line = trim(line);
+
+    // listing address ("<hex> :")
+    size_t i = 0;
+
+    while (i < line.size() && isxdigit(uchar(line[i])))
+      ++i;
+
+    if (i > 0) {
+      size_t j = i;
+
+      while (j < line.size() && isspace(uchar(line[j])))
+        ++j;
+
+      if (j > i && j < line.size() && line[j] == ':') {
+        stmt.addr = int(strtol(std::string(line.substr(0, i)).c_str(), nullptr, 16));
+
+        line = trim(line.substr(j + 1));
+      }
+    }
+
+    // label ("<name>:")
+    i = identLen(line);
+
+    if (i > 0 && i < line.size() && line[i] == ':') {
+      stmt.label = line.substr(0, i);
+
+      line = trim(line.substr(i + 1));
+    }
+
+    // name and operands (or "<name> EQU <value>")
+    i = 0;
+
+    while (i < line.size() && ! isspace(uchar(line[i])))
+      ++i;
+
+    stmt.name = line.substr(0, i);
+    stmt.args = trim(line.substr(i));
+
+    if (! stmt.args.empty()) {
+      size_t j = 0;
+
+      while (j < stmt.args.size() && ! isspace(uchar(stmt.args[j])))
+        ++j;
+
+      if (equalNoCase(stmt.args.substr(0, j), "EQU")) {
+        stmt.equ  = stmt.name;
+        stmt.name = stmt.args.substr(0, j);
+        stmt.args = trim(stmt.args.substr(j));
+      }
+    }
+
+    return (stmt.addr >= 0 || ! stmt.label.empty() || ! stmt.name.empty());
+  }
+
+  //---
+
+  bool assembleSource() {
+    for (int pass = 1; pass <= 2; ++pass) {
+      pass_ = pass;
+      loc_  = CChip8::MemDataStart;
+
+      std::fill(&bytes_  [0], &bytes_  [CChip8::MemSize], 0);
+      std::fill(&written_[0], &written_[CChip8::MemSize], false);
+
+      end_ = CChip8::MemDataStart;
+
+      for (const auto &stmt : stmts_)
+        assembleStmt(stmt);
+
+      if (! errors_.empty())
+        return false;
+    }
+
+    rom_.assign(&bytes_[CChip8::MemDataStart], &bytes_[end_]);
+
+    return true;
+  }
+
+  void assembleStmt(const Stmt &stmt) {
+    if (stmt.addr >= 0)
+      setLoc(stmt, stmt.addr);
+
+    if (! stmt.label.empty()) {
+      std::string label(stmt.label);
+
+      if (pass_ == 1) {
+        if (! symbols_.emplace(label, loc_).second)
+          error(stmt, "duplicate symbol '" + label + "'");
+      }
+      else if (symbols_[label] != loc_)
+        error(stmt, "address of '" + label + "' changed between passes");
+    }
+
+    if (stmt.name.empty())
+      return;
+
+    //---
+
+    int value;
+
+    switch (directive(stmt.name)) {
+      case Directive::ORG: {
+        if (evalArg(stmt, stmt.args, value, /*defined*/true))
+          setLoc(stmt, value);
+
+        break;
+      }
+      case Directive::DB:
+      case Directive::DW: {
+        bool word = (directive(stmt.name) == Directive::DW);
+
+        std::string_view args = stmt.args;
+
+        if (args.empty())
+          error(stmt, "missing value");
+
+        while (! args.empty()) {
+          std::string_view arg = nextArg(args);
+
+          value = 0;
+
+          if (pass_ == 2 && evalArg(stmt, arg, value, /*defined*/false)) {
+            if (word ? (value < -0x8000 || value > 0xFFFF) : (value < -0x80 || value > 0xFF))
+              error(stmt, "value '" + std::string(arg) + "' out of range");
+          }
+
+          if (word)
+            emit(stmt, uchar((value >> 8) & 0xFF));
+
+          emit(stmt, uchar(value & 0xFF));
+        }
+
+        break;
+      }
+      case Directive::DS: {
+        std::string_view args  = stmt.args;
+        std::string_view count = nextArg(args);
+
+        int fill = 0;
+
+        if (! args.empty() && pass_ == 2 && evalArg(stmt, args, fill, /*defined*/false)) {
+          if (fill < -0x80 || fill > 0xFF)
+            error(stmt, "fill value out of range");
+        }
+
+        if (evalArg(stmt, count, value, /*defined*/true)) {
+          if (value < 0 || loc_ + value > CChip8::MemSize)
+            error(stmt, "bad size");
+          else {
+            for (int i = 0; i < value; ++i)
+              emit(stmt, uchar(fill & 0xFF));
+          }
+        }
+
+        break;
+      }
+      case Directive::EQU: {
+        std::string name(stmt.equ);
+
+        if (pass_ == 1 && evalArg(stmt, stmt.args, value, /*defined*/true)) {
+          if (! symbols_.emplace(name, value).second)
+            error(stmt, "duplicate symbol '" + name + "'");
+        }
+
+        break;
+      }
+      default: {
+        ushort opcode = 0;
+
+        if (pass_ == 2)
+          encode(stmt, opcode);
+
+        emit(stmt, uchar(opcode >> 8));
+        emit(stmt, uchar(opcode & 0xFF));
+
+        break;
+      }
+    }
+  }
+
+  //---
+
+  // encode instruction by matching operands against formats of mnemonic
+  // (format with fewest expression operands wins, so "LD V0, DT" is not
+  // "LD V0, <byte>" of symbol DT)
+  bool encode(const Stmt &stmt, ushort &opcode) {
+    const Formats &formats = opFormats();
+
+    char mnemonic[16];
+
+    size_t len = std::min(stmt.name.size(), sizeof(mnemonic) - 1);
+
+    for (size_t i = 0; i < len; ++i)
+      mnemonic[i] = char(toupper(uchar(stmt.name[i])));
+
+    mnemonic[len] = '\0';
+
+    auto p = formats.find(mnemonic);
+
+    if (p == formats.end()) {
+      error(stmt, "unknown instruction '" + std::string(stmt.name) + "'");
+      return false;
+    }
+
+    const Format     *match = nullptr;
+    std::string_view  values[6], values1[6];
+
+    for (const auto &format : (*p).second) {
+      if ((! match || format.numExprs < match->numExprs) &&
+          matchArgs(format.args, stmt.args, values1)) {
+        match = &format;
+
+        std::copy(&values1[0], &values1[6], &values[0]);
+      }
+    }
+
+    if (! match) {
+      error(stmt, "bad operands for '" + std::string(stmt.name) + "'");
+      return false;
+    }
+
+    //---
+
+    // value of operand in [min, max] (negative bytes two's complement)
+    auto operand = [&](int i, int min, int max, int &value) {
+      if (values[i].empty()) { value = 0; return true; }
+
+      if (i < 2) { value = hexValue(values[i][0]); return true; }
+
+      if (! evalArg(stmt, values[i], value, /*defined*/false))
+        return false;
+
+      if (value < min || value > max) {
+        error(stmt, "value '" + std::string(values[i]) + "' out of range");
+        return false;
+      }
+
+      return true;
+    };
+
+    int x, y, n, b, a, h;
+
+    if (! operand(0, 0, 0xF, x) || ! operand(1, 0, 0xF, y) || ! operand(2, 0, 0xF, n) ||
+        ! operand(3, -0x80, 0xFF, b) || ! operand(4, 0, 0xFFF, a) || ! operand(5, 0, 0xFF, h))
+      return false;
+
+    if (match->code == OpCode::BAD) {
+      opcode = ushort((h << 8) | (b & 0xFF));
+      return true;
+    }
+
+    DecodedOp op;
+
+    op.code = match->code;
+    op.x    = uchar(x);
+    op.y    = uchar(y);
+    op.n    = uchar(n);
+    op.nn   = uchar(b & 0xFF);
+    op.nnn  = ushort(a);
+
+    opcode = CChip8::encodeOp(op);
+
+    return true;
+  }
+
+  // match operands against format pattern, setting value text of x, y, n, b, a, h
+  static bool matchArgs(const std::string &format, std::string_view args,
+                        std::string_view values[6]) {
+    for (int i = 0; i < 6; ++i)
+      values[i] = std::string_view();
+
+    size_t i = 0;
+
+    auto skipSpace = [&]() { while (i < args.size() && isspace(uchar(args[i]))) ++i; };
+
+    for (size_t f = 0; f < format.size(); ++f) {
+      char c = format[f];
+
+      if      (c == ' ') {
+        skipSpace();
+      }
+      else if (c == ',') {
+        skipSpace();
+
+        if (i >= args.size() || args[i] != ',') return false;
+
+        ++i;
+      }
+      else if (c == '%') {
+        char v = format[++f];
+
+        if (v == 'x' || v == 'y') {
+          // register digit (not followed by more of a name)
+          if (i >= args.size() || ! isxdigit(uchar(args[i]))) return false;
+
+          if (i + 1 < args.size() && isIdentChar(args[i + 1])) return false;
+
+          values[v == 'x' ? 0 : 1] = args.substr(i, 1);
+
+          ++i;
+        }
+        else {
+          // expression (to separator)
+          size_t j = i;
+
+          while (j < args.size() && args[j] != ',' && ! isspace(uchar(args[j])))
+            ++j;
+
+          if (j == i) return false;
+
+          int ind = (v == 'n' ? 2 : v == 'b' ? 3 : v == 'a' ? 4 : 5);
+
+          values[ind] = args.substr(i, j - i);
+
+          i = j;
+        }
+      }
+      else {
+        if (i >= args.size() || toupper(uchar(args[i])) != c) return false;
+
+        ++i;
+      }
+    }
+
+    skipSpace();
+
+    return (i == args.size());
+  }
+
+  // formats of each mnemonic (from disassembly formats)
+  static const Formats &opFormats() {
+    static const Formats formats = []() {
+      Formats formats;
+
+      for (int i = 0; i < int(OpCode::NUM_OPS); ++i) {
+        std::string str = CChip8::opFormat(OpCode(i));
+
+        size_t pos = str.find(' ');
+
+        std::string mnemonic = str.substr(0, pos);
+
+        for (auto &c : mnemonic)
+          c = char(toupper(uchar(c)));
+
+        Format format;
+
+        format.code = OpCode(i);
+        format.args = (pos != std::string::npos ? str.substr(pos + 1) : "");
+
+        for (size_t j = 0; j + 1 < format.args.size(); ++j) {
+          if (format.args[j] == '%' && strchr("nbah", format.args[j + 1]))
+            ++format.numExprs;
+        }
+
+        formats[mnemonic].push_back(format);
+      }
+
+      return formats;
+    }();
+
+    return formats;
+  }
+
+  //---
+
+  // evaluate expression (<term> {+|- <term>}), defined requires symbols
+  // defined in pass one (value needed to assign addresses)
+  bool evalArg(const Stmt &stmt, std::string_view str, int &value, bool defined) {
+    str = trim(str);
+
+    if (str.empty()) {
+      error(stmt, "missing value");
+      return false;
+    }
+
+    value = 0;
+
+    int    sign = 1;
+    size_t i    = 0;
+
+    if (str[0] == '-' || str[0] == '+') {
+      sign = (str[0] == '-' ? -1 : 1);
+      ++i;
+    }
+
+    for (;;) {
+      size_t j = i;
+
+      while (j < str.size() && str[j] != '+' && str[j] != '-')
+        ++j;
+
+      std::string_view term = trim(str.substr(i, j - i));
+
+      int termValue;
+
+      if (! evalTerm(stmt, term, termValue, defined))
+        return false;
+
+      value += sign*termValue;
+
+      if (j >= str.size())
+        break;
+
+      sign = (str[j] == '-' ? -1 : 1);
+      i    = j + 1;
+    }
+
+    return true;
+  }
+
+  bool evalTerm(const Stmt &stmt, std::string_view term, int &value, bool defined) {
+    if (term == "$") {
+      value = loc_;
+      return true;
+    }
+
+    if (term.size() > 2 && term[0] == '0' && (term[1] == 'x' || term[1] == 'X'))
+      return parseNumber(stmt, term.substr(2), 16, value);
+
+    if (term.size() > 2 && term[0] == '0' && (term[1] == 'b' || term[1] == 'B'))
+      return parseNumber(stmt, term.substr(2), 2, value);
+
+    if (identLen(term) == term.size() && ! term.empty()) {
+      auto p = symbols_.find(std::string(term));
+
+      if (p != symbols_.end()) {
+        value = (*p).second;
+        return true;
+      }
+    }
+
+    // hex number (else undefined symbol)
+    bool isHex = ! term.empty();
+
+    for (auto c : term)
+      if (! isxdigit(uchar(c))) isHex = false;
+
+    if (isHex)
+      return parseNumber(stmt, term, 16, value);
+
+    if (pass_ == 1 && ! defined) {
+      value = 0;
+      return true;
+    }
+
+    error(stmt, "undefined symbol '" + std::string(term) + "'");
+
+    return false;
+  }
+
+  bool parseNumber(const Stmt &stmt, std::string_view str, int base, int &value) {
+    value = 0;
+
+    for (auto c : str) {
+      int d = (base == 16 ? hexValue(c) : (c == '0' || c == '1' ? c - '0' : -1));
+
+      if (d < 0 || value > 0xFFFFFF) {
+        error(stmt, "bad number '" + std::string(str) + "'");
+        return false;
+      }
+
+      value = value*base + d;
+    }
+
+    return true;
+  }
+
+  //---
+
+  void setLoc(const Stmt &stmt, int addr) {
+    if (addr < CChip8::MemDataStart || addr > CChip8::MemSize)
+      error(stmt, "address out of range");
+    else
+      loc_ = addr;
+  }
+
+  // output byte at current address (pass two checks for overlap)
+  void emit(const Stmt &stmt, uchar b) {
+    if (loc_ > CChip8::MemDataEnd) {
+      if (loc_ == CChip8::MemSize)
+        error(stmt, "program too large");
+
+      ++loc_;
+
+      return;
+    }
+
+    if (pass_ == 2) {
+      if (written_[loc_]) {
+        char buffer[64];
+
+        snprintf(buffer, sizeof(buffer), "address %03X already written", loc_);
+
+        error(stmt, buffer);
+      }
+
+      bytes_  [loc_] = b;
+      written_[loc_] = true;
+    }
+
+    ++loc_;
+
+    end_ = std::max(end_, loc_);
+  }
+
+  void error(const Stmt &stmt, const std::string &msg) {
+    errors_.push_back(files_[stmt.file] + ":" + std::to_string(stmt.line) + ": " + msg);
+  }
+
+  //---
+
+  static Directive directive(std::string_view name) {
+    if (name.size() < 2 || name.size() > 7) return Directive::NONE;
+
+    if (equalNoCase(name, "ORG"    )) return Directive::ORG;
+    if (equalNoCase(name, "DB"     )) return Directive::DB;
+    if (equalNoCase(name, "DW"     )) return Directive::DW;
+    if (equalNoCase(name, "DS"     )) return Directive::DS;
+    if (equalNoCase(name, "EQU"    )) return Directive::EQU;
+    if (equalNoCase(name, "INCLUDE")) return Directive::INCLUDE;
+
+    return Directive::NONE;
+  }
+
+  // next comma or space separated value of list
+  static std::string_view nextArg(std::string_view &args) {
+    size_t i = 0;
+
+    while (i < args.size() && args[i] != ',' && ! isspace(uchar(args[i])))
+      ++i;
+
+    std::string_view arg = args.substr(0, i);
+
+    while (i < args.size() && (args[i] == ',' || isspace(uchar(args[i]))))
+      ++i;
+
+    args = args.substr(i);
+
+    return arg;
+  }
+
+  static std::string_view trim(std::string_view str) {
+    while (! str.empty() && isspace(uchar(str.front()))) str.remove_prefix(1);
+    while (! str.empty() && isspace(uchar(str.back ()))) str.remove_suffix(1);
+
+    return str;
+  }
+
+  static bool isIdentChar(char c) { return (isalnum(uchar(c)) || c == '_' || c == '.'); }
+
+  // length of identifier at start of str (letter, '_' or '.' then also digits)
+  static size_t identLen(std::string_view str) {
+    if (str.empty() || isdigit(uchar(str[0])) || ! isIdentChar(str[0]))
+      return 0;
+
+    size_t i = 1;
+
+    while (i < str.size() && isIdentChar(str[i]))
+      ++i;
+
+    return i;
+  }
+
+  static bool equalNoCase(std::string_view str, const char *s) {
+    size_t i = 0;
+
+    for ( ; i < str.size() && s[i]; ++i)
+      if (toupper(uchar(str[i])) != s[i]) return false;
+
+    return (i == str.size() && ! s[i]);
+  }
+
+  static int hexValue(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+
+    return -1;
+  }
+
+ private:
+  using Sources = std::vector<std::unique_ptr<std::string>>;
+
+  std::vector<std::string> files_;
+  Sources                  sources_;                  // file text (statements view it)
+  std::vector<Stmt>        stmts_;
+  Symbols                  symbols_;
+  Errors                   errors_;
+  int                      pass_ { 1 };
+  int                      loc_  { CChip8::MemDataStart };
+  int                      end_  { CChip8::MemDataStart }; // end of output
+  uchar                    bytes_  [CChip8::MemSize] { };
+  bool                     written_[CChip8::MemSize] { };
+  Bytes                    rom_;
+};
+
+#endif
@@ -0,0 +1,29 @@
+TEMPLATE = app
+
+CONFIG -= qt
+CONFIG += console release
+
+TARGET = CChip8Asm
+
+DEPENDPATH += .
+
+INCLUDEPATH += . ../include
+
+QMAKE_CXXFLAGS += -std=c++17
+
+SOURCES += \
+CChip8Asm.cpp \
+
+HEADERS += \
+CChip8.h \
+CChip8Asm.h \
+
+DESTDIR     = ../bin
+OBJECTS_DIR = ../obj
+LIB_DIR     = ../lib
+
+INCLUDEPATH += \
+. ../include \
+
+unix:LIBS += \
+-L$$LIB_DIR \
@@ -0,0 +1,908 @@
+#ifndef CChip8Batch_H
+#define CChip8Batch_H
+
+#include <CChip8.h>
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#define CCHIP8_BATCH_AVX2 1
+#include <immintrin.h>
+#endif
+
+// Lockstep interpreter for many copies of the same ROM.
+//
+// The V registers, I, PC and timers of all lanes are held as structure of
+// arrays. Each step picks the lowest PC of the lanes still running the
+// current frame and runs that instruction for every lane at that PC (and
+// with the same opcode). Register only instructions are run for all these
+// lanes at once (with AVX2 when available) and everything else (memory,
+// display, stack, keys, RND) is run per lane by the lane's CChip8 (with
+// CChip8::stepDecoded()) up to the next run of register only instructions.
+//
+// Lane chips hold memory, display, stack (and SP) and keys. Only the registers
+// an op uses are copied to and from a lane chip to run it (see syncRegs()),
+// all are copied when accessed with lane().
+//
+// Lanes which diverge from the others are run by their chips (which then hold
+// all their state) and are regularly gathered back into the arrays so lanes
+// which converge again are run together.
+class CChip8Batch {
+ public:
+  // lanes at PC needed to run them together, as a count and as a fraction
+  // (1/n) of the lanes still running the frame (fewer are run by their chips)
+  static const int MinGroupLanes    = 4;
+  static const int MinGroupFraction = 8;
+
+  // register only ops needed in a row to stop running lanes on their chips
+  static const int VectorRunOps = 2;
+
+  // frames between gathering lanes run by their chips (doubled up to max
+  // while gathered lanes diverge again)
+  static const int RegroupFrames    = 32;
+  static const int MaxRegroupFrames = 1024;
+
+  using OpCode     = CChip8::OpCode;
+  using DecodedOp  = CChip8::DecodedOp;
+  using StopReason = CChip8::StopReason;
+
+ public:
+  CChip8Batch(int numLanes) :
+   numLanes_(numLanes) {
+    assert(numLanes > 0);
+
+    // pad to multiple of 32 lanes (one AVX2 register of bytes)
+    stride_ = (numLanes + 31) & ~31;
+
+    for (int k = 0; k < numLanes; ++k)
+      lanes_.push_back(std::make_unique<CChip8>());
+
+    V_        .resize(16*stride_);
+    I_        .resize(stride_);
+    PC_       .resize(stride_);
+    DT_       .resize(stride_);
+    ST_       .resize(stride_);
+    mask_     .resize(stride_);
+    active_   .resize(stride_);
+    group_    .resize(stride_);
+    remaining_.resize(stride_);
+    stopped_  .resize(stride_);
+    solo_     .resize(stride_);
+    waitKey_  .resize(stride_);
+    dirtyLo_  .resize(stride_);
+    dirtyHi_  .resize(stride_);
+    reasons_  .resize(stride_, StopReason::FRAME);
+    cycles_   .resize(stride_);
+
+#ifdef CCHIP8_BATCH_AVX2
+    useAVX2_ = __builtin_cpu_supports("avx2");
+#endif
+  }
+
+  int numLanes() const { return numLanes_; }
+
+  // lane chip with registers updated from the batch (register changes made
+  // through it are not seen by the batch, keys and memory are)
+  CChip8 &lane(int k) {
+    if (solo_[k] != SoloChip)
+      storeLane(k);
+
+    return chip(k);
+  }
+
+  // load rom into all lanes (and reset them) with super mode and quirks (see
+  // CChip8::setQuirks()). Lanes unchanged if rom empty or too large
+  CChip8::LoadError load(const uchar *rom, size_t len, bool super=false, uint quirks=0) {
+    CChip8::LoadError error = CChip8::checkRomSize(len);
+    if (error != CChip8::LoadError::NONE) return error;
+
+    quirks_ = quirks;
+
+    for (int k = 0; k < numLanes_; ++k) {
+      chip(k).setSuper(super);
+
+      chip(k).setQuirks(quirks);
+
+      chip(k).setCyclesPerFrame(cyclesPerFrame_);
+
+      chip(k).reset();
+
+      chip(k).loadRom(rom, len);
+
+      loadLane(k);
+
+      stopped_ [k] = 0;
+      solo_    [k] = 0;
+      dirtyLo_ [k] = 0xFFFF;
+      dirtyHi_ [k] = 0;
+      reasons_ [k] = StopReason::FRAME;
+      cycles_  [k] = 0;
+    }
+
+    loadMemory_.assign(chip(0).pmemory(), chip(0).pmemory() + CChip8::MemSize);
+
+    numMemDirty_   = 0;
+    numSolo_       = 0;
+    numRegrouped_  = 0;
+    numFrames_     = 0;
+    regroupFrame_  = 0;
+    regroupFrames_ = RegroupFrames;
+
+    return CChip8::LoadError::NONE;
+  }
+
+  // seed lane RND generator (not changed by load)
+  void setSeed(int k, uint64_t seed) { chip(k).setSeed(seed); }
+
+  int cyclesPerFrame() const { return cyclesPerFrame_; }
+  void setCyclesPerFrame(int n) {
+    assert(n > 0);
+
+    cyclesPerFrame_ = n;
+
+    for (int k = 0; k < numLanes_; ++k)
+      chip(k).setCyclesPerFrame(n);
+  }
+
+  bool isUseAVX2() const { return useAVX2_; }
+  void setUseAVX2(bool b) {
+#ifdef CCHIP8_BATCH_AVX2
+    useAVX2_ = (b && __builtin_cpu_supports("avx2"));
+#else
+    (void) b;
+#endif
+  }
+
+  bool isStopped(int k) const { return stopped_[k]; }
+
+  // FRAME while running, else why lane stopped
+  StopReason stopReason(int k) const { return reasons_[k]; }
+
+  uint64_t cycles(int k) const { return cycles_[k]; }
+
+  // lane instructions run vectorized and run by lane chip (includes idle key
+  // wait cycles of lanes held by their chips)
+  uint64_t numVectorOps() const { return numVectorOps_; }
+  uint64_t numScalarOps() const { return numScalarOps_; }
+
+  //---
+
+  // run one frame on all running lanes (returns false if all stopped)
+  bool runFrame() {
+    if (numSolo_ > 0 && numFrames_ >= regroupFrame_)
+      gatherLanes();
+
+    ++numFrames_;
+
+    // lanes still running frame (lanes which diverged in the last frame are
+    // run by their chips from this one)
+    numActive_ = 0;
+
+    for (int k = 0; k < numLanes_; ++k) {
+      remaining_[k] = 0;
+
+      if (stopped_[k])
+        continue;
+
+      if (solo_[k] == SoloNext) {
+        storeLane(k);
+
+        solo_[k] = SoloChip;
+      }
+
+      if (solo_[k] == SoloChip)
+        runChip(k);
+      else {
+        remaining_[k] = cyclesPerFrame_;
+
+        active_[numActive_++] = k;
+      }
+    }
+
+    for (;;) {
+      // resolve key waits (idle rest of frame if no key pressed)
+      if (numWaitKey_ > 0) {
+        for (int j = 0; j < numActive_; ++j) {
+          int k = active_[j];
+
+          if (! waitKey_[k] || remaining_[k] == 0)
+            continue;
+
+          if (chip(k).isWaitingKey())
+            remaining_[k] = 0;
+          else
+            runLane(k, true);
+        }
+      }
+
+      // drop lanes which finished frame and find lanes at lowest PC of the
+      // others
+      ushort minPC = 0xFFFF;
+
+      int n = 0;
+
+      numGroup_ = 0;
+
+      for (int j = 0; j < numActive_; ++j) {
+        int k = active_[j];
+
+        if (remaining_[k] == 0)
+          continue;
+
+        active_[n++] = k;
+
+        ushort pc = PC_[k];
+
+        if (pc > minPC)
+          continue;
+
+        if (pc < minPC) {
+          minPC     = pc;
+          numGroup_ = 0;
+        }
+
+        group_[numGroup_++] = k;
+      }
+
+      numActive_ = n;
+
+      if (numActive_ == 0)
+        break;
+
+      int leader = group_[0];
+
+      // if any lane (leader included) has written memory at PC the lanes may
+      // differ in opcode there, so only keep lanes with the leader's opcode
+      // (the others are run by their chips)
+      if (numMemDirty_ > 0) {
+        bool dirty = false;
+
+        for (int g = 0; g < numGroup_ && ! dirty; ++g) {
+          int k = group_[g];
+
+          dirty = (minPC + 1 >= dirtyLo_[k] && minPC <= dirtyHi_[k]);
+        }
+
+        if (dirty) {
+          ushort opcode = chip(leader).opcode(minPC);
+
+          int n1 = 1;
+
+          for (int g = 1; g < numGroup_; ++g) {
+            int k = group_[g];
+
+            if (chip(k).opcode(minPC) == opcode)
+              group_[n1++] = k;
+            else
+              runLane(k, true);
+          }
+
+          numGroup_ = n1;
+        }
+      }
+
+      const DecodedOp &op = chip(leader).decodedOp(minPC);
+
+      // lanes which have diverged from the others are run alone for the rest
+      // of the frame and by their chips from the next one (a small group
+      // would pay for a pass over all running lanes per instruction)
+      if (numGroup_ < MinGroupLanes || numGroup_*MinGroupFraction < numActive_) {
+        for (int g = 0; g < numGroup_; ++g) {
+          int k = group_[g];
+
+          runLane(k, false);
+
+          if (! stopped_[k]) {
+            solo_[k] = SoloNext;
+
+            ++numSolo_;
+          }
+        }
+      }
+      // register only ops are run from the arrays
+      else if (isVectorOp(op.code)) {
+#ifdef CCHIP8_BATCH_AVX2
+        if (useAVX2_) {
+          for (int g = 0; g < numGroup_; ++g)
+            mask_[group_[g]] = 0xFF;
+
+          execLanesAVX2(op);
+
+          for (int g = 0; g < numGroup_; ++g)
+            mask_[group_[g]] = 0;
+        }
+        else
+#endif
+          execLanes(op);
+
+        for (int g = 0; g < numGroup_; ++g)
+          --remaining_[group_[g]];
+
+        numVectorOps_ += numGroup_;
+      }
+      // other ops are run by each lane's chip up to the next run of register
+      // only ops (where the lanes can be grouped again)
+      else {
+        for (int g = 0; g < numGroup_; ++g)
+          runLane(group_[g], true);
+      }
+    }
+
+    //---
+
+    // tick timers of lanes which completed the frame (lanes waiting for a
+    // key idle for the rest of the frame). Chips running lanes tick their own
+    bool running = false;
+
+    for (int k = 0; k < numLanes_; ++k) {
+      if (stopped_[k])
+        continue;
+
+      running = true;
+
+      if (solo_[k] == SoloChip)
+        continue;
+
+      cycles_[k] += cyclesPerFrame_;
+
+      if (DT_[k] > 0) --DT_[k];
+      if (ST_[k] > 0) --ST_[k];
+    }
+
+    return running;
+  }
+
+ private:
+  // lane run by its chip from next frame, lane run by its chip
+  static const uchar SoloNext = 1;
+  static const uchar SoloChip = 2;
+
+  CChip8 &chip(int k) { return *lanes_[k]; }
+
+  uchar *V(int i) { return &V_[i*stride_]; }
+
+  // registers copied between arrays and lane chip (bit i for Vi). PC and wait
+  // key state are always copied
+  static const uint SyncI      = 1<<16;
+  static const uint SyncTimers = 1<<17;
+  static const uint SyncAll    = 0x3FFFF;
+
+  // registers read or written when lane chip runs op
+  static uint syncRegs(const DecodedOp &op) {
+    uint vx = 1U << op.x;
+    uint vy = 1U << op.y;
+    uint vf = 1U << 0xF;
+
+    switch (op.code) {
+      case OpCode::SE_VX_VY:
+      case OpCode::SNE_VX_VY:
+      case OpCode::LD_VX_VY:
+      case OpCode::OR_VX_VY:
+      case OpCode::AND_VX_VY:
+      case OpCode::XOR_VX_VY:
+        return vx | vy;
+      case OpCode::ADD_VX_VY:
+      case OpCode::SUB_VX_VY:
+      case OpCode::SHR_VX_VY:
+      case OpCode::SUBN_VX_VY:
+      case OpCode::SHL_VX_VY:
+        return vx | vy | vf;
+      case OpCode::LD_I_NNN:
+        return SyncI;
+      case OpCode::ADD_I_VX:
+        return vx | vf | SyncI;
+      case OpCode::JP_V0_NNN:
+        return 1;
+      case OpCode::SE_VX_NN:
+      case OpCode::SNE_VX_NN:
+      case OpCode::LD_VX_NN:
+      case OpCode::ADD_VX_NN:
+      case OpCode::RND_VX_NN:
+      case OpCode::SKP_VX:
+      case OpCode::SKNP_VX:
+      case OpCode::LD_VX_K:
+        return vx;
+      case OpCode::LD_VX_DT:
+      case OpCode::LD_DT_VX:
+      case OpCode::LD_ST_VX:
+        return vx | SyncTimers;
+      case OpCode::LD_F_VX:
+      case OpCode::LD_B_VX:
+      case OpCode::LD_HF_VX:
+        return vx | SyncI;
+      case OpCode::DRW_VX_VY_N:
+        return vx | vy | vf | SyncI;
+      case OpCode::LD_IM_VX:
+      case OpCode::LD_VX_IM:
+        return (2*vx - 1) | SyncI;
+      case OpCode::LD_R_VX:
+      case OpCode::LD_VX_R:
+        return 2*vx - 1;
+      case OpCode::BAD:
+        return SyncAll;
+      default:
+        return 0;
+    }
+  }
+
+  // lane chip registers to arrays
+  void loadLane(int k, uint regs=SyncAll) {
+    const CChip8 &chip = this->chip(k);
+
+    for (uint v = regs & 0xFFFF; v; v &= v - 1) {
+      int i = __builtin_ctz(v);
+
+      V_[i*stride_ + k] = chip.V(i);
+    }
+
+    if (regs & SyncI)
+      I_[k] = chip.I();
+
+    if (regs & SyncTimers) {
+      DT_[k] = chip.DT();
+      ST_[k] = chip.ST();
+    }
+
+    PC_[k] = chip.PC();
+
+    uchar waitKey = chip.isWaitKey();
+
+    numWaitKey_ += waitKey - waitKey_[k];
+
+    waitKey_[k] = waitKey;
+  }
+
+  // arrays to lane chip registers
+  void storeLane(int k, uint regs=SyncAll) {
+    storeRegs(k, regs);
+
+    chip(k).setPC(PC_[k]);
+  }
+
+  void storeRegs(int k, uint regs) {
+    CChip8 &chip = this->chip(k);
+
+    for (uint v = regs & 0xFFFF; v; v &= v - 1) {
+      int i = __builtin_ctz(v);
+
+      chip.setV(i, V_[i*stride_ + k]);
+    }
+
+    if (regs & SyncI)
+      chip.setI(I_[k]);
+
+    if (regs & SyncTimers) {
+      chip.setDT(DT_[k]);
+      chip.setST(ST_[k]);
+    }
+  }
+
+  // run frame of lane held by its chip
+  void runChip(int k) {
+    CChip8 &chip = this->chip(k);
+
+    uint64_t n = chip.cycles();
+
+    StopReason reason = chip.runUntilFrame();
+
+    n = chip.cycles() - n;
+
+    cycles_[k] += n;
+
+    numScalarOps_ += n;
+
+    if (reason != StopReason::FRAME && reason != StopReason::WAIT_KEY) {
+      stopped_[k] = 1;
+      reasons_[k] = reason;
+
+      loadLane(k);
+
+      solo_[k] = 0;
+
+      --numSolo_;
+    }
+  }
+
+  // gather lanes held by their chips back into the arrays
+  void gatherLanes() {
+    // gather less often while gathered lanes keep diverging
+    if (numRegrouped_ > 0 && numSolo_ >= numRegrouped_)
+      regroupFrames_ = std::min(2*regroupFrames_, int(MaxRegroupFrames));
+    else
+      regroupFrames_ = RegroupFrames;
+
+    regroupFrame_ = numFrames_ + regroupFrames_;
+
+    numRegrouped_ = 0;
+
+    for (int k = 0; k < numLanes_; ++k) {
+      if (solo_[k] != SoloChip)
+        continue;
+
+      loadLane(k);
+
+      solo_[k] = 0;
+
+      --numSolo_;
+
+      ++numRegrouped_;
+
+      // memory written while held by chip (differs from memory after load)
+      const uchar *m = chip(k).pmemory();
+
+      int lo = CChip8::MemDataStart, hi = CChip8::MemDataEnd;
+
+      // (8 bytes at a time, memory data size is a multiple of 8)
+      while (lo <= hi && memcmp(&m[lo], &loadMemory_[lo], 8) == 0) lo += 8;
+      while (hi >= lo && memcmp(&m[hi - 7], &loadMemory_[hi - 7], 8) == 0) hi -= 8;
+
+      while (lo <= hi && m[lo] == loadMemory_[lo]) ++lo;
+      while (hi >= lo && m[hi] == loadMemory_[hi]) --hi;
+
+      if (lo <= hi)
+        setDirty(k, std::min(lo, int(dirtyLo_[k])), std::max(hi, int(dirtyHi_[k])));
+    }
+  }
+
+  // run lane alone on its chip for rest of frame or (if toVector) until it
+  // reaches a run of register only ops. Lane idles for rest of frame when it
+  // waits for a key
+  void runLane(int k, bool toVector) {
+    CChip8 &chip = this->chip(k);
+
+    // registers copied to chip (as needed by ops run)
+    uint regs = (waitKey_[k] ? SyncAll : 0);
+
+    storeLane(k, regs);
+
+    int n = remaining_[k], i = 0;
+
+    int lo = dirtyLo_[k], hi = dirtyHi_[k];
+
+    bool rc = true, idle = false;
+
+    for ( ; i < n && rc; ++i) {
+      if (chip.isWaitingKey()) {
+        idle = true;
+        break;
+      }
+
+      if (toVector && i > 0 && isVectorRun(chip, chip.PC()))
+        break;
+
+      if (! chip.isWaitKey()) {
+        const DecodedOp &op = chip.decodedOp(chip.PC());
+
+        uint regs1 = syncRegs(op) & ~regs;
+
+        if (regs1) {
+          storeRegs(k, regs1);
+
+          regs |= regs1;
+        }
+
+        // extend range of memory written by lane
+        if (op.code == OpCode::LD_B_VX || op.code == OpCode::LD_IM_VX)
+          writeRange(chip.I(), op.code == OpCode::LD_B_VX ? 2 : op.x, lo, hi);
+      }
+
+      rc = chip.stepDecoded();
+    }
+
+    setDirty(k, lo, hi);
+
+    numScalarOps_ += i;
+
+    if (! rc)
+      stopLane(k, cyclesPerFrame_ - n + i);
+
+    remaining_[k] = (rc && ! idle && toVector ? n - i : 0);
+
+    loadLane(k, regs);
+  }
+
+  // add n + 1 bytes written at i to range lo-hi (all memory if it wraps)
+  static void writeRange(int i, int n, int &lo, int &hi) {
+    if (i + n > CChip8::MemDataEnd) {
+      lo = 0;
+      hi = CChip8::MemDataEnd;
+    }
+    else {
+      lo = std::min(lo, i);
+      hi = std::max(hi, i + n);
+    }
+  }
+
+  void setDirty(int k, int lo, int hi) {
+    if (lo > hi)
+      return;
+
+    if (dirtyLo_[k] > dirtyHi_[k])
+      ++numMemDirty_;
+
+    dirtyLo_[k] = ushort(lo);
+    dirtyHi_[k] = ushort(hi);
+  }
+
+  // stop lane after running n cycles of frame
+  void stopLane(int k, int n) {
+    const CChip8 &chip = this->chip(k);
+
+    cycles_ [k] += n;
+    stopped_[k]  = 1;
+    reasons_[k]  = (chip.isFault() ? StopReason::FAULT :
+                    chip.isExited() ? StopReason::EXIT : StopReason::HALT);
+  }
+
+  // ops at pos start a run of register only ops
+  static bool isVectorRun(const CChip8 &chip, ushort pos) {
+    if (pos + 2*(VectorRunOps - 1) > CChip8::MemDataEnd)
+      return false;
+
+    for (int i = 0; i < VectorRunOps; ++i)
+      if (! isVectorOp(chip.decodedOp(pos + 2*i).code))
+        return false;
+
+    return true;
+  }
+
+  static bool isVectorOp(OpCode code) {
+    switch (code) {
+      case OpCode::JP:
+      case OpCode::SE_VX_NN:
+      case OpCode::SNE_VX_NN:
+      case OpCode::SE_VX_VY:
+      case OpCode::SNE_VX_VY:
+      case OpCode::LD_VX_NN:
+      case OpCode::ADD_VX_NN:
+      case OpCode::LD_VX_VY:
+      case OpCode::OR_VX_VY:
+      case OpCode::AND_VX_VY:
+      case OpCode::XOR_VX_VY:
+      case OpCode::ADD_VX_VY:
+      case OpCode::SUB_VX_VY:
+      case OpCode::SHR_VX_VY:
+      case OpCode::SUBN_VX_VY:
+      case OpCode::SHL_VX_VY:
+      case OpCode::LD_I_NNN:
+      case OpCode::ADD_I_VX:
+        return true;
+      default:
+        return false;
+    }
+  }
+
+  // source lanes of SHR/SHL (Vy for shift quirk)
+  uchar *shiftSrc(const DecodedOp &op) {
+    return V(quirks_ & CChip8::QuirkShiftVY ? op.y : op.x);
+  }
+
+  // run register only op for group lanes (portable version)
+  void execLanes(const DecodedOp &op) {
+    uchar *vx = V(op.x), *vy = V(op.y), *vf = V(0xF), *vs = shiftSrc(op);
+
+    for (int g = 0; g < numGroup_; ++g) {
+      int k = group_[g];
+
+      ushort pc = PC_[k] + 2;
+
+      switch (op.code) {
+        case OpCode::JP       : pc = op.nnn; break;
+        case OpCode::SE_VX_NN : if (vx[k] == op.nn) pc += 2; break;
+        case OpCode::SNE_VX_NN: if (vx[k] != op.nn) pc += 2; break;
+        case OpCode::SE_VX_VY : if (vx[k] == vy[k]) pc += 2; break;
+        case OpCode::SNE_VX_VY: if (vx[k] != vy[k]) pc += 2; break;
+        case OpCode::LD_VX_NN : vx[k] = op.nn; break;
+        case OpCode::ADD_VX_NN: vx[k] += op.nn; break;
+        case OpCode::LD_VX_VY : vx[k] = vy[k]; break;
+        case OpCode::OR_VX_VY : vx[k] |= vy[k]; break;
+        case OpCode::AND_VX_VY: vx[k] &= vy[k]; break;
+        case OpCode::XOR_VX_VY: vx[k] ^= vy[k]; break;
+        case OpCode::ADD_VX_VY: {
+          ushort sum = vx[k] + vy[k]; vf[k] = (sum > 0xFF ? 1 : 0); vx[k] = sum & 0xFF;
+          break;
+        }
+        case OpCode::SUB_VX_VY:
+          vf[k] = (vx[k] >= vy[k] ? 1 : 0); vx[k] = vx[k] - vy[k];
+          break;
+        case OpCode::SHR_VX_VY:
+          vf[k] = (vs[k] & 1 ? 1 : 0); vx[k] = vs[k] >> 1;
+          break;
+        case OpCode::SUBN_VX_VY:
+          vf[k] = (vy[k] >= vx[k] ? 1 : 0); vx[k] = vy[k] - vx[k];
+          break;
+        case OpCode::SHL_VX_VY:
+          vf[k] = (vs[k] & 0x80 ? 1 : 0); vx[k] = vs[k] << 1;
+          break;
+        case OpCode::LD_I_NNN:
+          I_[k] = op.nnn & CChip8::MemDataEnd;
+          break;
+        case OpCode::ADD_I_VX: {
+          ushort sum = I_[k] + vx[k]; I_[k] = sum & CChip8::MemDataEnd;
+          vf[k] = (sum > CChip8::MemDataEnd ? 1 : 0);
+          break;
+        }
+        default:
+          assert(false);
+          break;
+      }
+
+      PC_[k] = pc;
+    }
+  }
+
+#ifdef CCHIP8_BATCH_AVX2
+  // run register only op for masked (group) lanes (32 lanes at a time)
+  __attribute__((target("avx2")))
+  void execLanesAVX2(const DecodedOp &op) {
+    uchar *vx = V(op.x), *vy = V(op.y), *vf = V(0xF), *vs = shiftSrc(op);
+
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i ones = _mm256_set1_epi8(char(0xFF));
+    const __m256i one  = _mm256_set1_epi8(1);
+    const __m256i nn   = _mm256_set1_epi8(char(op.nn));
+
+    for (int c = 0; c < stride_; c += 32) {
+      __m256i m = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(&mask_[c]));
+
+      if (_mm256_testz_si256(m, m))
+        continue;
+
+      // (macros as lambdas do not inherit the avx2 target)
+#define ld(p) _mm256_loadu_si256(reinterpret_cast<const __m256i *>((p) + c))
+
+      // store masked lanes
+#define st(p, r) _mm256_storeu_si256(reinterpret_cast<__m256i *>((p) + c), \
+                                     _mm256_blendv_epi8(ld(p), (r), m))
+
+      __m256i skip = zero;
+
+      switch (op.code) {
+        case OpCode::SE_VX_NN : skip = _mm256_cmpeq_epi8(ld(vx), nn); break;
+        case OpCode::SNE_VX_NN: skip = _mm256_xor_si256(_mm256_cmpeq_epi8(ld(vx), nn), ones); break;
+        case OpCode::SE_VX_VY : skip = _mm256_cmpeq_epi8(ld(vx), ld(vy)); break;
+        case OpCode::SNE_VX_VY:
+          skip = _mm256_xor_si256(_mm256_cmpeq_epi8(ld(vx), ld(vy)), ones); break;
+        case OpCode::LD_VX_NN : st(vx, nn); break;
+        case OpCode::ADD_VX_NN: st(vx, _mm256_add_epi8(ld(vx), nn)); break;
+        case OpCode::LD_VX_VY : st(vx, ld(vy)); break;
+        case OpCode::OR_VX_VY : st(vx, _mm256_or_si256 (ld(vx), ld(vy))); break;
+        case OpCode::AND_VX_VY: st(vx, _mm256_and_si256(ld(vx), ld(vy))); break;
+        case OpCode::XOR_VX_VY: st(vx, _mm256_xor_si256(ld(vx), ld(vy))); break;
+        case OpCode::ADD_VX_VY: {
+          // carry if sum < Vx
+          __m256i a = ld(vx), s = _mm256_add_epi8(a, ld(vy));
+          __m256i nc = _mm256_cmpeq_epi8(_mm256_max_epu8(s, a), s);
+          st(vf, _mm256_andnot_si256(nc, one));
+          st(vx, s);
+          break;
+        }
+        // flag is written before the result is calculated (as in CChip8)
+        case OpCode::SUB_VX_VY: {
+          __m256i a = ld(vx);
+          st(vf, _mm256_and_si256(_mm256_cmpeq_epi8(_mm256_max_epu8(a, ld(vy)), a), one));
+          st(vx, _mm256_sub_epi8(ld(vx), ld(vy)));
+          break;
+        }
+        case OpCode::SHR_VX_VY: {
+          st(vf, _mm256_and_si256(ld(vs), one));
+          st(vx, _mm256_and_si256(_mm256_srli_epi16(ld(vs), 1), _mm256_set1_epi8(0x7F)));
+          break;
+        }
+        case OpCode::SUBN_VX_VY: {
+          __m256i b = ld(vy);
+          st(vf, _mm256_and_si256(_mm256_cmpeq_epi8(_mm256_max_epu8(b, ld(vx)), b), one));
+          st(vx, _mm256_sub_epi8(ld(vy), ld(vx)));
+          break;
+        }
+        case OpCode::SHL_VX_VY: {
+          st(vf, _mm256_and_si256(_mm256_srli_epi16(ld(vs), 7), one));
+          __m256i a = ld(vs);
+          st(vx, _mm256_add_epi8(a, a));
+          break;
+        }
+        default:
+          break;
+      }
+
+#undef ld
+#undef st
+
+      //---
+
+      // I and PC (16 bit) for each half of the 32 lanes
+      for (int h = 0; h < 2; ++h) {
+        int c1 = c + 16*h;
+
+        __m128i m8 = (h ? _mm256_extracti128_si256(m, 1) : _mm256_castsi256_si128(m));
+        __m128i s8 = (h ? _mm256_extracti128_si256(skip, 1) : _mm256_castsi256_si128(skip));
+
+        __m256i m16 = _mm256_cvtepi8_epi16(m8);
+
+        if (op.code == OpCode::LD_I_NNN || op.code == OpCode::ADD_I_VX) {
+          __m256i *ip = reinterpret_cast<__m256i *>(&I_[c1]);
+
+          __m256i i = _mm256_loadu_si256(ip);
+
+          __m256i i1;
+
+          if (op.code == OpCode::LD_I_NNN)
+            i1 = _mm256_set1_epi16(short(op.nnn & CChip8::MemDataEnd));
+          else {
+            __m128i *fp = reinterpret_cast<__m128i *>(&vf[c1]);
+
+            __m256i sum = _mm256_add_epi16(i, _mm256_cvtepu8_epi16(
+              _mm_loadu_si128(reinterpret_cast<const __m128i *>(&vx[c1]))));
+
+            i1 = _mm256_and_si256(sum, _mm256_set1_epi16(CChip8::MemDataEnd));
+
+            __m256i f16 = _mm256_srli_epi16(sum, 12);
+
+            __m128i f8 = _mm_packus_epi16(_mm256_castsi256_si128(f16),
+                                          _mm256_extracti128_si256(f16, 1));
+
+            _mm_storeu_si128(fp, _mm_blendv_epi8(_mm_loadu_si128(fp), f8, m8));
+          }
+
+          _mm256_storeu_si256(ip, _mm256_blendv_epi8(i, i1, m16));
+        }
+
+        __m256i *pcp = reinterpret_cast<__m256i *>(&PC_[c1]);
+
+        __m256i pc = _mm256_loadu_si256(pcp);
+
+        __m256i pc1;
+
+        if (op.code == OpCode::JP)
+          pc1 = _mm256_set1_epi16(short(op.nnn));
+        else {
+          __m256i two = _mm256_set1_epi16(2);
+
+          pc1 = _mm256_add_epi16(pc, _mm256_add_epi16(two,
+                  _mm256_and_si256(_mm256_cvtepi8_epi16(s8), two)));
+        }
+
+        _mm256_storeu_si256(pcp, _mm256_blendv_epi8(pc, pc1, m16));
+      }
+    }
+  }
+#endif
+
+ private:
+  using ChipP = std::unique_ptr<CChip8>;
+
+  int                     numLanes_       { 0 };
+  int                     stride_         { 0 };
+  int                     cyclesPerFrame_ { 9 };
+  bool                    useAVX2_        { false };
+  uint                    quirks_         { 0 };  // all lanes (see load())
+  std::vector<ChipP>      lanes_;
+  std::vector<uchar>      V_;         // V[i] of lane k at [i*stride_ + k]
+  std::vector<ushort>     I_;
+  std::vector<ushort>     PC_;
+  std::vector<uchar>      DT_;
+  std::vector<uchar>      ST_;
+  std::vector<uchar>      mask_;      // 0xFF if lane runs current instruction (AVX2)
+  std::vector<int>        active_;    // lanes still running frame
+  std::vector<int>        group_;     // lanes running current instruction
+  std::vector<int>        remaining_; // cycles left in frame
+  std::vector<uchar>      stopped_;
+  std::vector<uchar>      solo_;      // lane run by its chip (SoloNext, SoloChip)
+  std::vector<uchar>      waitKey_;   // lane waiting for key (LD Vx, K)
+  std::vector<ushort>     dirtyLo_;   // range of memory written by lane
+  std::vector<ushort>     dirtyHi_;
+  std::vector<StopReason> reasons_;
+  std::vector<uint64_t>   cycles_;
+  std::vector<uchar>      loadMemory_; // lane memory after load
+  int                     numActive_      { 0 };
+  int                     numGroup_       { 0 };
+  int                     numWaitKey_     { 0 };
+  int                     numMemDirty_    { 0 };
+  int                     numSolo_        { 0 };  // lanes run by their chips
+  int                     numRegrouped_   { 0 };  // lanes gathered by last gatherLanes()
+  uint64_t                numFrames_      { 0 };
+  uint64_t                regroupFrame_   { 0 };  // frame of next gatherLanes()
+  int                     regroupFrames_  { RegroupFrames };
+  uint64_t                numVectorOps_   { 0 };
+  uint64_t                numScalarOps_   { 0 };
+};
+
+#endif
@@ -0,0 +1,1139 @@
+#include <CChip8.h>
+#include <CChip8Jit.h>
+#include <CChip8Pool.h>
+#include <CChip8Rewind.h>
+#include <CChip8Movie.h>
+#include <CChip8Batch.h>
+#include <CChip8Asm.h>
+
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <sstream>
+#include <vector>
+
+namespace {
+
+// ALU/skip/call/draw mix which loops forever
+std::vector<uchar> mixRom() {
+  static const ushort ops[] = {
+    0xA300, // 200: LD I, 300
+    0x6000, // 202: LD V0, 0
+    0x6105, // 204: LD V1, 5
+    0x620A, // 206: LD V2, A
+    0x7001, // 208: ADD V0, 1
+    0x8014, // 20A: ADD V0, V1
+    0x8206, // 20C: SHR V2, V0
+    0x8205, // 20E: SUB V2, V0
+    0x8313, // 210: XOR V3, V1
+    0x3000, // 212: SE V0, 0
+    0x8312, // 214: AND V3, V1
+    0x4301, // 216: SNE V3, 1
+    0x8311, // 218: OR V3, V1
+    0x2230, // 21A: CALL 230
+    0x8E07, // 21C: SUBN VE, V0
+    0x8E0E, // 21E: SHL VE, V0
+    0x1208, // 220: JP 208
+    0x0000, // 222:
+    0x0000, // 224:
+    0x0000, // 226:
+    0x0000, // 228:
+    0x0000, // 22A:
+    0x0000, // 22C:
+    0x0000, // 22E:
+    0xA300, // 230: LD I, 300
+    0xF033, // 232: LD B, V0
+    0xF265, // 234: LD V2, [I]
+    0xD125, // 236: DRW V1, V2, 5
+    0x00EE, // 238: RET
+  };
+
+  std::vector<uchar> rom;
+
+  for (auto op : ops) {
+    rom.push_back(uchar(op >> 8));
+    rom.push_back(uchar(op & 0xFF));
+  }
+
+  return rom;
+}
+
+// loop where lanes with RND bit set patch the instruction at 212 (lane
+// divergent self modifying code for batch check)
+std::vector<uchar> smcRom() {
+  static const ushort ops[] = {
+    0x6065, // 200: LD V0, 65
+    0xC101, // 202: RND V1, 1
+    0x3101, // 204: SE V1, 1
+    0x1210, // 206: JP 210
+    0xA212, // 208: LD I, 212
+    0xC177, // 20A: RND V1, 77
+    0xF155, // 20C: LD [I], V1
+    0x7301, // 20E: ADD V3, 1
+    0x7401, // 210: ADD V4, 1
+    0x6500, // 212: LD V5, 0 (patched)
+    0x8654, // 214: ADD V6, V5
+    0x1202, // 216: JP 202
+  };
+
+  std::vector<uchar> rom;
+
+  for (auto op : ops) {
+    rom.push_back(uchar(op >> 8));
+    rom.push_back(uchar(op & 0xFF));
+  }
+
+  return rom;
+}
+
+// sprite draw loop (4 DRW in every 9 instructions) at unaligned positions
+// (switches to high res in super mode)
+std::vector<uchar> drawRom(bool super) {
+  static const ushort ops[] = {
+    0x00FF, // 200: HIGH
+    0xA220, // 202: LD I, 220
+    0xD018, // 204: DRW V0, V1, 8
+    0xD238, // 206: DRW V2, V3, 8
+    0xD458, // 208: DRW V4, V5, 8
+    0xD67F, // 20A: DRW V6, V7, 15
+    0x7003, // 20C: ADD V0, 3
+    0x7105, // 20E: ADD V1, 5
+    0x7207, // 210: ADD V2, 7
+    0x7509, // 212: ADD V5, 9
+    0x1204, // 214: JP 204
+    0x0000, // 216:
+    0x0000, // 218:
+    0x0000, // 21A:
+    0x0000, // 21C:
+    0x0000, // 21E:
+    0xF0F0, // 220: sprite data
+    0x9999,
+    0xFF81,
+    0x3C66,
+    0xA55A,
+    0x1824,
+    0x4281,
+    0x7E00,
+  };
+
+  std::vector<uchar> rom;
+
+  for (auto op : ops) {
+    rom.push_back(uchar(op >> 8));
+    rom.push_back(uchar(op & 0xFF));
+  }
+
+  // CLS instead of HIGH (SCHIP only)
+  if (! super)
+    rom[1] = 0xE0;
+
+  return rom;
+}
+
+CChip8::LoadError loadRom(const char *filename, std::vector<uchar> &rom) {
+  CChip8::RomFile file;
+
+  CChip8::LoadError error = file.open(filename);
+
+  if (error == CChip8::LoadError::NONE)
+    rom.assign(file.data(), file.data() + file.size());
+
+  return error;
+}
+
+// quirks of all chips (-q)
+uint chipQuirks = 0;
+
+void initChip(CChip8 &chip, const std::vector<uchar> &rom, bool super) {
+  chip.setSuper(super);
+
+  chip.setQuirks(chipQuirks);
+
+  chip.reset();
+
+  chip.loadRom(&rom[0], rom.size());
+
+  // same RND sequence in all compared/timed instances
+  chip.setSeed(1);
+}
+
+enum class Engine {
+  STEP,
+  DECODED,
+  BLOCK,
+  JIT
+};
+
+const char *engineName(Engine engine) {
+  switch (engine) {
+    case Engine::STEP   : return "step";
+    case Engine::DECODED: return "decoded";
+    case Engine::BLOCK  : return "block";
+    case Engine::JIT    : return "jit";
+    default             : return "";
+  }
+}
+
+// run up to n instructions with engine (returns number run)
+long runEngine(CChip8 &chip, Engine engine, long n, bool &rc) {
+  switch (engine) {
+    case Engine::STEP:
+      rc = chip.step();
+      return 1;
+    case Engine::DECODED:
+      rc = chip.stepDecoded();
+      return 1;
+    default:
+      return chip.stepBlock(int(std::min(n, long(CChip8::MaxBlockOps))), rc);
+  }
+}
+
+double runBench(Engine engine, const std::vector<uchar> &rom, bool super, long count) {
+  CChip8 chip;
+
+  initChip(chip, rom, super);
+
+  std::unique_ptr<CChip8Jit> jit;
+
+  if (engine == Engine::JIT)
+    jit = std::make_unique<CChip8Jit>(&chip);
+
+  auto t1 = std::chrono::steady_clock::now();
+
+  long i  = 0;
+  bool rc = true;
+
+  while (rc && i < count)
+    i += runEngine(chip, engine, count - i, rc);
+
+  auto t2 = std::chrono::steady_clock::now();
+
+  double secs = std::chrono::duration<double>(t2 - t1).count();
+  double ips  = (secs > 0.0 ? i/secs : 0.0);
+
+  printf("%-8s: %ld instructions in %.3f s = %.0f instructions/s\n",
+         engineName(engine), i, secs, ips);
+
+  return ips;
+}
+
+// sprite draw throughput
+void drawBench(bool super, long count) {
+  auto rom = drawRom(super);
+
+  CChip8 chip;
+
+  initChip(chip, rom, super);
+
+  auto t1 = std::chrono::steady_clock::now();
+
+  long i  = 0;
+  bool rc = true;
+
+  while (rc && i < count) {
+    rc = chip.stepDecoded();
+    ++i;
+  }
+
+  auto t2 = std::chrono::steady_clock::now();
+
+  double secs  = std::chrono::duration<double>(t2 - t1).count();
+  long   draws = 4*(i/9);
+
+  printf("draw    : %dx%d %ld sprites in %.3f s = %.0f sprites/s (%.1f ns/instruction)\n",
+         chip.screenWidth(), chip.screenHeight(), draws, secs,
+         (secs > 0.0 ? draws/secs : 0.0), (i > 0 ? secs*1E9/i : 0.0));
+}
+
+// byte per pixel display with reference draw and scroll behavior
+struct RefDisplay {
+  int   sw { 0 }, sh { 0 };
+  uchar pixels[128*64];
+
+  RefDisplay(int sw, int sh) :
+   sw(sw), sh(sh) {
+    memset(pixels, 0, sizeof(pixels));
+  }
+
+  uchar draw(const uchar *addr, uchar len, uchar x, uchar y) {
+    int ss = sw*sh;
+
+    uchar hit = 0;
+
+    int pos = y*sw + x;
+
+    for (int i = 0; i < len; ++i) {
+      while (pos >= ss)
+        pos -= ss;
+
+      for (int px = 0; px < 8 && pos + px < ss; ++px) {
+        uchar pixel = (addr[i] >> (7 - px)) & 1;
+
+        if (pixel && pixels[pos + px])
+          hit = 1;
+
+        pixels[pos + px] ^= pixel;
+      }
+
+      pos += sw;
+    }
+
+    return hit;
+  }
+
+  void scrollDown(int n) {
+    uchar buffer[128*64];
+
+    int len   = n*sw;
+    int start = sw*sh - len;
+
+    memcpy(buffer, &pixels[start], len);
+    memmove(pixels, &pixels[len], start);
+    memcpy(pixels, buffer, len);
+  }
+
+  void scrollLeft(int n) {
+    uchar buffer[128];
+
+    for (int y = 0; y < sh; ++y) {
+      uchar *row = &pixels[y*sw];
+
+      memcpy(buffer, row, n);
+      memmove(row, row + n, sw - n);
+      memcpy(row + sw - n, buffer, n);
+    }
+  }
+
+  void scrollRight(int n) {
+    uchar buffer[128];
+
+    for (int y = 0; y < sh; ++y) {
+      uchar *row = &pixels[y*sw];
+
+      memcpy(buffer, row + sw - n, n);
+      memmove(row + n, row, sw - n);
+      memcpy(row, buffer, n);
+    }
+  }
+};
+
+// check display kernels (draw and scroll) against byte per pixel reference
+// for random sprites and scrolls in each display mode and time scrolls
+bool displayCheck(long count) {
+  using Clock = std::chrono::steady_clock;
+
+  std::mt19937 rng(1);
+
+  // DRW V0, V1, n at 200 + 2*n and random sprite data
+  std::vector<uchar> rom;
+
+  for (int n = 0; n < 16; ++n) {
+    rom.push_back(0xD0);
+    rom.push_back(uchar(0x10 | n));
+  }
+
+  while (rom.size() < CChip8::MemSize - CChip8::MemDataStart)
+    rom.push_back(uchar(rng()));
+
+  bool rc = true;
+
+  for (int mode = 0; mode < 3; ++mode) {
+    CChip8 chip;
+
+    initChip(chip, rom, mode > 0);
+
+    chip.setHighRes(mode == 2);
+
+    int sw = chip.screenWidth ();
+    int sh = chip.screenHeight();
+
+    RefDisplay ref(sw, sh);
+
+    const char *diff = nullptr;
+
+    long i = 0;
+
+    for ( ; ! diff && i < count; ++i) {
+      int r = rng() % 6;
+
+      if (r < 3) {
+        uchar n = uchar(rng() % 16), x = uchar(rng()), y = uchar(rng());
+
+        ushort addr = ushort(0x300 + rng() % 0xC00);
+
+        uchar sprite[16];
+
+        for (int j = 0; j < n; ++j)
+          sprite[j] = chip.memory(addr + j);
+
+        chip.setV(0, x);
+        chip.setV(1, y);
+        chip.setI(addr);
+
+        chip.setPC(CChip8::MemDataStart + 2*n);
+
+        chip.stepDecoded();
+
+        if (chip.V(0xF) != ref.draw(sprite, n, x, y))
+          diff = "draw collision";
+      }
+      else if (r == 3) {
+        int n = int(rng() % 16);
+
+        chip.scrollDown(uchar(n)); ref.scrollDown(n);
+      }
+      else if (r == 4) {
+        int n = 1 + int(rng() % (sw - 1));
+
+        chip.scrollLeft(uchar(n)); ref.scrollLeft(n);
+      }
+      else {
+        int n = 1 + int(rng() % (sw - 1));
+
+        chip.scrollRight(uchar(n)); ref.scrollRight(n);
+      }
+
+      for (int j = 0; ! diff && j < sw*sh; ++j)
+        if (chip.screen(j) != ref.pixels[j])
+          diff = "screen";
+    }
+
+    //---
+
+    // time scrolls (SCR/SCL amount)
+    int n = (mode == 2 ? 4 : 2);
+
+    const long numScrolls = 100000;
+
+    auto t1 = Clock::now();
+
+    for (long j = 0; j < numScrolls; ++j) {
+      chip.scrollLeft (uchar(n));
+      chip.scrollRight(uchar(n + 1));
+    }
+
+    auto t2 = Clock::now();
+
+    for (long j = 0; j < numScrolls; ++j) {
+      ref.scrollLeft (n);
+      ref.scrollRight(n + 1);
+    }
+
+    auto t3 = Clock::now();
+
+    double secs1 = std::chrono::duration<double>(t2 - t1).count();
+    double secs2 = std::chrono::duration<double>(t3 - t2).count();
+
+    printf("display %dx%d%s: %s %ld draws/scrolls, scroll %.1f ns (byte per pixel %.1f ns)\n",
+           sw, sh, (mode == 1 ? " super" : ""), (diff ? "FAILED" : "OK"), i,
+           secs1*1E9/(2*numScrolls), secs2*1E9/(2*numScrolls));
+
+    if (diff) {
+      printf("  %s differs\n", diff);
+      rc = false;
+    }
+  }
+
+  return rc;
+}
+
+// compare machine state (returns name of first difference)
+const char *diffState(CChip8 &chip1, CChip8 &chip2) {
+  if (chip1.PC() != chip2.PC()) return "PC";
+  if (chip1.I () != chip2.I ()) return "I";
+  if (chip1.SP() != chip2.SP()) return "SP";
+  if (chip1.DT() != chip2.DT()) return "DT";
+  if (chip1.ST() != chip2.ST()) return "ST";
+
+  for (int i = 0; i < 16; ++i)
+    if (chip1.V(i) != chip2.V(i)) return "V";
+
+  for (int i = CChip8::MemDataStart; i <= CChip8::MemDataEnd; ++i)
+    if (chip1.memory(i) != chip2.memory(i)) return "memory";
+
+  int ss = chip1.screenWidth()*chip1.screenHeight();
+
+  for (int i = 0; i < ss; ++i)
+    if (chip1.screen(i) != chip2.screen(i)) return "screen";
+
+  return nullptr;
+}
+
+// run engine in lockstep with reference step() comparing state after each dispatch
+bool checkEngine(Engine engine, const std::vector<uchar> &rom, bool super, long count) {
+  CChip8 chip1, chip2;
+
+  initChip(chip1, rom, super);
+  initChip(chip2, rom, super);
+
+  std::unique_ptr<CChip8Jit> jit;
+
+  if (engine == Engine::JIT)
+    jit = std::make_unique<CChip8Jit>(&chip2, /*hits*/1);
+
+  long i   = 0;
+  bool rc1 = true, rc2 = true;
+
+  while (rc2 && i < count) {
+    long n = runEngine(chip2, engine, count - i, rc2);
+
+    for (long j = 0; j < n; ++j)
+      rc1 = chip1.step();
+
+    i += n;
+
+    const char *diff = (rc1 != rc2 ? "stop" : diffState(chip1, chip2));
+
+    if (diff) {
+      printf("%-8s: FAILED %s differs after %ld instructions (PC %s)\n",
+             engineName(engine), diff, i, CChip8::shortStr(chip1.PC()).c_str());
+      return false;
+    }
+  }
+
+  printf("%-8s: OK %ld instructions\n", engineName(engine), i);
+
+  return true;
+}
+
+// run pool of instances with 1 to maxThreads threads
+void poolBench(const std::vector<uchar> &rom, bool super, int numInstances,
+               long frames, int maxThreads) {
+  if (maxThreads <= 0)
+    maxThreads = std::max(int(std::thread::hardware_concurrency()), 1);
+
+  double secs1 = 0.0;
+
+  for (int numThreads = 1; numThreads <= maxThreads; ++numThreads) {
+    CChip8Pool pool(numThreads);
+
+    for (int i = 0; i < numInstances; ++i)
+      pool.addInstance(&rom[0], rom.size(), frames, super, 9, chipQuirks);
+
+    auto t1 = std::chrono::steady_clock::now();
+
+    pool.run();
+
+    auto t2 = std::chrono::steady_clock::now();
+
+    double secs = std::chrono::duration<double>(t2 - t1).count();
+
+    if (numThreads == 1)
+      secs1 = secs;
+
+    uint64_t cycles = 0;
+
+    for (int i = 0; i < numInstances; ++i)
+      cycles += pool.result(i).cycles;
+
+    printf("threads %2d: %d instances in %.3f s = %.0f instances/s, %.0f frames/s, "
+           "%.0f instructions/s, speedup %.2fx, steals %ld\n",
+           numThreads, numInstances, secs, numInstances/secs, numInstances*frames/secs,
+           cycles/secs, secs1/secs, pool.numSteals());
+  }
+}
+
+// run numLanes copies of rom in lockstep batch and as independent instances
+// (laneSeeds gives each lane its own RND sequence)
+bool batchBench(const std::vector<uchar> &rom, bool super, int numLanes, long frames,
+                bool laneSeeds=false) {
+  using Clock = std::chrono::steady_clock;
+
+  auto isRunning = [](CChip8::StopReason reason) {
+    return (reason == CChip8::StopReason::FRAME || reason == CChip8::StopReason::WAIT_KEY);
+  };
+
+  // independent instances
+  std::vector<std::unique_ptr<CChip8>> chips;
+
+  for (int k = 0; k < numLanes; ++k) {
+    chips.push_back(std::make_unique<CChip8>());
+
+    initChip(*chips.back(), rom, super);
+
+    if (laneSeeds)
+      chips.back()->setSeed(uint64_t(k + 1));
+  }
+
+  auto t1 = Clock::now();
+
+  for (auto &chip : chips) {
+    for (long f = 0; f < frames; ++f)
+      if (! isRunning(chip->runUntilFrame()))
+        break;
+  }
+
+  auto t2 = Clock::now();
+
+  double secs1 = std::chrono::duration<double>(t2 - t1).count();
+
+  printf("independent: %d instances x %ld frames in %.3f s = %.0f instances/s\n",
+         numLanes, frames, secs1, numLanes/secs1);
+
+  //---
+
+  // batch (with and without AVX2)
+  int numDiff = 0;
+
+  for (int avx2 = 1; avx2 >= 0; --avx2) {
+    CChip8Batch batch(numLanes);
+
+    batch.setUseAVX2(avx2);
+
+    if (avx2 && ! batch.isUseAVX2())
+      continue;
+
+    batch.load(&rom[0], rom.size(), super, chipQuirks);
+
+    // same RND sequence as independent instances (see initChip)
+    for (int k = 0; k < numLanes; ++k)
+      batch.setSeed(k, laneSeeds ? uint64_t(k + 1) : 1);
+
+    auto t3 = Clock::now();
+
+    for (long f = 0; f < frames; ++f)
+      if (! batch.runFrame())
+        break;
+
+    auto t4 = Clock::now();
+
+    double secs2 = std::chrono::duration<double>(t4 - t3).count();
+
+    printf("%-11s: %d instances x %ld frames in %.3f s = %.0f instances/s "
+           "(%.2fx, %.1f%% vector)\n",
+           avx2 ? "batch avx2" : "batch", numLanes, frames, secs2, numLanes/secs2,
+           secs1/secs2, 100.0*batch.numVectorOps()/
+             std::max(double(batch.numVectorOps() + batch.numScalarOps()), 1.0));
+
+    // compare lanes with independent instances
+    for (int k = 0; k < numLanes; ++k) {
+      const char *diff = diffState(*chips[k], batch.lane(k));
+
+      if (! diff && chips[k]->cycles() != batch.cycles(k))
+        diff = "cycles";
+
+      if (diff) {
+        if (numDiff == 0)
+          printf("lane %d: %s differs\n", k, diff);
+
+        ++numDiff;
+      }
+    }
+  }
+
+  if (numDiff)
+    printf("FAILED %d lanes differ\n", numDiff);
+
+  return (numDiff == 0);
+}
+
+// snapshot every frame, restore mid run into a second chip and check both
+// finish identically (also check corrupt snapshots are rejected)
+bool stateCheck(const std::vector<uchar> &rom, bool super, long frames) {
+  using Clock = std::chrono::steady_clock;
+
+  CChip8 chip1, chip2;
+
+  initChip(chip1, rom, super);
+
+  // preallocated snapshot buffers
+  std::vector<uint64_t> buffer((CChip8::stateSize() + 7)/8);
+  std::vector<uint64_t> midBuffer(buffer.size());
+
+  size_t size = CChip8::stateSize();
+
+  double saveTime = 0.0;
+
+  for (long f = 0; f < frames; ++f) {
+    chip1.runUntilFrame();
+
+    auto t1 = Clock::now();
+
+    if (chip1.saveState(&buffer[0], size) != size) {
+      printf("state: FAILED save\n");
+      return false;
+    }
+
+    auto t2 = Clock::now();
+
+    saveTime += std::chrono::duration<double>(t2 - t1).count();
+
+    if (f == frames/2)
+      midBuffer = buffer;
+  }
+
+  // restore mid run snapshot and run to end
+  auto t3 = Clock::now();
+
+  bool loaded = chip2.loadState(&midBuffer[0], size);
+
+  auto t4 = Clock::now();
+
+  if (! loaded) {
+    printf("state: FAILED load\n");
+    return false;
+  }
+
+  for (long f = frames/2 + 1; f < frames; ++f)
+    chip2.runUntilFrame();
+
+  const char *diff = diffState(chip1, chip2);
+
+  if (! diff && chip1.cycles() != chip2.cycles())
+    diff = "cycles";
+
+  if (diff) {
+    printf("state: FAILED %s differs after restore\n", diff);
+    return false;
+  }
+
+  // corrupt data and version must be rejected
+  uchar *bytes = reinterpret_cast<uchar *>(&midBuffer[0]);
+
+  bytes[size - 1] ^= 1;
+
+  bool corruptLoaded = chip2.loadState(&midBuffer[0], size);
+
+  bytes[size - 1] ^= 1;
+  bytes[4]        ^= 1;
+
+  bool versionLoaded = chip2.loadState(&midBuffer[0], size);
+
+  if (corruptLoaded || versionLoaded) {
+    printf("state: FAILED bad state accepted\n");
+    return false;
+  }
+
+  printf("state: OK %zu bytes, save %.1f ns, load %.1f ns\n", size,
+         saveTime*1E9/frames, std::chrono::duration<double>(t4 - t3).count()*1E9);
+
+  return true;
+}
+
+// capture every frame into rewind history (small budget so old frames are
+// dropped), rewind random amounts checking against full snapshots and
+// report capture cost
+bool rewindCheck(const std::vector<uchar> &rom, bool super, long frames) {
+  CChip8 chip;
+
+  initChip(chip, rom, super);
+
+  // a few seconds of typical frames
+  CChip8Rewind rewind(64*1024);
+
+  std::vector<std::vector<uint64_t>> states; // full state per frame
+
+  size_t size = CChip8::stateSize();
+
+  auto saveFrame = [&]() {
+    states.emplace_back((size + 7)/8);
+
+    chip.saveState(&states.back()[0], size);
+  };
+
+  std::mt19937 rng(1);
+
+  long numRewinds = 0, rewound = 0;
+
+  for (long f = 0; f < frames; ++f) {
+    chip.runUntilFrame();
+
+    // press a key now and then
+    if (f % 50 == 0)
+      chip.setKey(uchar(rng() & 0xF), (f % 100 == 0));
+
+    rewind.capture(chip);
+
+    saveFrame();
+
+    if (rng() % 400 != 0)
+      continue;
+
+    //---
+
+    int n = 1 + int(rng() % 300);
+
+    int maxN = rewind.numFrames();
+
+    if (! rewind.rewind(chip, n))
+      continue;
+
+    long target = long(states.size()) - 1 - std::min(n, maxN);
+
+    std::vector<uint64_t> state((size + 7)/8);
+
+    chip.saveState(&state[0], size);
+
+    if (state != states[target]) {
+      printf("rewind: FAILED state differs after rewinding %d frames at frame %ld\n", n, f);
+      return false;
+    }
+
+    states.resize(target + 1);
+
+    ++numRewinds;
+
+    rewound += std::min(n, maxN);
+  }
+
+  const auto &stats = rewind.stats();
+
+  printf("rewind: OK %ld rewinds (%ld frames), capture avg %.2f us max %.2f us, "
+         "%.0f bytes/frame (delta %.0f + key %.0f), %d frames in %zu KB\n",
+         numRewinds, rewound, stats.meanCapture()*1E6, stats.maxCapture*1E6,
+         double(stats.deltaBytes + stats.keyBytes)/stats.captures,
+         double(stats.deltaBytes)/stats.captures, double(stats.keyBytes)/stats.captures,
+         rewind.numFrames(), rewind.usedBytes()/1024);
+
+  return true;
+}
+
+// record run with random key changes at random cycles then replay movie with
+// each engine and check all finish in the recorded state
+bool movieCheck(const std::vector<uchar> &rom, bool super, long frames,
+                const std::vector<Engine> &engines) {
+  const double ips = 500.0; // fractional instructions per frame
+
+  CChip8 chip;
+
+  initChip(chip, rom, super);
+
+  CChip8Movie movie;
+
+  movie.start(chip, /*seed*/1, ips);
+
+  CChip8Scheduler scheduler(ips);
+
+  std::mt19937 rng(1);
+
+  for (long f = 0; f < frames; ++f) {
+    chip.setCyclesPerFrame(scheduler.frameCycles(uint64_t(f)));
+
+    // key change part way through some frames
+    if (rng() % 4 == 0) {
+      chip.runCycles(rng() % uint64_t(chip.cyclesPerFrame()));
+
+      uchar key  = uchar(rng() & 0xF);
+      bool  down = (rng() & 1);
+
+      chip.setKey(key, down);
+
+      movie.record(chip, key, down);
+    }
+
+    chip.runUntilFrame();
+  }
+
+  movie.setLength(chip.cycles());
+
+  //---
+
+  bool rc = true;
+
+  for (auto engine : engines) {
+    CChip8 chip1;
+
+    initChip(chip1, rom, super);
+
+    // quirks come from movie
+    chip1.setQuirks(0);
+
+    std::unique_ptr<CChip8Jit> jit;
+
+    if      (engine == Engine::STEP)
+      chip1.setEngine(CChip8::Engine::STEP);
+    else if (engine == Engine::DECODED)
+      chip1.setEngine(CChip8::Engine::DECODED);
+    else {
+      chip1.setEngine(CChip8::Engine::BLOCK);
+
+      if (engine == Engine::JIT)
+        jit = std::make_unique<CChip8Jit>(&chip1);
+    }
+
+    CChip8MoviePlayer player(movie);
+
+    if (! player.start(chip1)) {
+      printf("%-8s: FAILED rom hash\n", engineName(engine));
+      rc = false;
+      continue;
+    }
+
+    while (! player.isFinished(chip1))
+      player.runFrame(chip1);
+
+    const char *diff = diffState(chip, chip1);
+
+    if (! diff && chip.cycles() != chip1.cycles())
+      diff = "cycles";
+
+    if (diff) {
+      printf("%-8s: FAILED %s differs after replay\n", engineName(engine), diff);
+      rc = false;
+    }
+    else
+      printf("%-8s: OK replayed %zu key changes over %" PRIu64 " cycles\n",
+             engineName(engine), movie.events().size(), chip1.cycles());
+  }
+
+  return rc;
+}
+
+// check buffer disassembler gives same text as stream disassembler for every
+// opcode and listing matches stream listing, and assembler reassembles both
+// to the same bytes
+bool disasmCheck() {
+  CChip8 chip;
+
+  chip.reset();
+
+  uchar memory[CChip8::MemSize];
+
+  long numDiff = 0;
+
+  for (int opcode = 0; opcode < 0x10000; ++opcode) {
+    chip.setMemory(CChip8::MemDataStart    , uchar(opcode >> 8));
+    chip.setMemory(CChip8::MemDataStart + 1, uchar(opcode & 0xFF));
+
+    std::stringstream ss;
+
+    chip.disassemble(CChip8::MemDataStart, ss);
+
+    char buffer[CChip8::MaxDisasmSize];
+
+    size_t n = chip.disassemble(CChip8::MemDataStart, buffer);
+
+    if (ss.str() != std::string(buffer, n) + "\n") {
+      if (numDiff++ < 10)
+        printf("  %04X: '%s' != '%s'\n", opcode, buffer, ss.str().c_str());
+    }
+  }
+
+  //---
+
+  // listing of random memory
+  std::mt19937 rng(1);
+
+  for (int i = 0; i < CChip8::MemSize; ++i)
+    memory[i] = uchar(rng());
+
+  chip.setMemory(memory);
+
+  std::stringstream ss;
+
+  for (int pc = CChip8::MemDataStart; pc <= CChip8::MemDataEnd; pc += 2)
+    chip.disassemble(ushort(pc), ss);
+
+  std::vector<char> buffer(CChip8::MaxListingSize);
+
+  bool listingOk = (chip.listing(&buffer[0], buffer.size()) == ss.str());
+
+  printf("disasm  : %s 65536 opcodes (%ld differ), listing %s\n",
+         (numDiff == 0 ? "OK" : "FAILED"), numDiff, (listingOk ? "OK" : "FAILED"));
+
+  //---
+
+  // assembler round trip: each opcode and listing reassemble to same bytes
+  CChip8Assembler assembler;
+
+  long numAsmDiff = 0;
+
+  for (int opcode = 0; opcode < 0x10000; ++opcode) {
+    char inst[CChip8::MaxDisasmSize];
+
+    CChip8::disassembleOp(ushort(opcode), inst);
+
+    const auto &rom = assembler.rom();
+
+    if (! assembler.assemble(inst) || rom.size() != 2 ||
+        rom[0] != uchar(opcode >> 8) || rom[1] != uchar(opcode & 0xFF)) {
+      if (numAsmDiff++ < 10)
+        printf("  %04X: '%s' %s\n", opcode, inst,
+               assembler.errors().empty() ? "differs" : assembler.errors()[0].c_str());
+    }
+  }
+
+  bool asmListingOk =
+    (assembler.assemble(std::string(chip.listing(&buffer[0], buffer.size()))) &&
+     assembler.rom().size() == CChip8::MemSize - CChip8::MemDataStart &&
+     memcmp(&assembler.rom()[0], &memory[CChip8::MemDataStart], assembler.rom().size()) == 0);
+
+  printf("asm     : %s 65536 opcodes (%ld differ), listing %s\n",
+         (numAsmDiff == 0 ? "OK" : "FAILED"), numAsmDiff, (asmListingOk ? "OK" : "FAILED"));
+
+  return (numDiff == 0 && listingOk && numAsmDiff == 0 && asmListingOk);
+}
+
+}
+
+int
+main(int argc, char **argv)
+{
+  const char *filename = nullptr;
+  long        count    = 50000000;
+  bool        super    = false;
+  bool        check    = false;
+  int         pool     = 0;
+  long        frames   = 600;
+  int         threads  = 0;
+  int         lanes    = 0;
+  bool        draw     = false;
+  bool        display  = false;
+  bool        state    = false;
+  bool        rewind   = false;
+  bool        replay   = false;
+  bool        disasm   = false;
+
+  for (int i = 1; i < argc; ++i) {
+    if (argv[i][0] == '-') {
+      if      (argv[i][1] == 'n' && i < argc - 1)
+        count = atol(argv[++i]);
+      else if (argv[i][1] == 's')
+        super = true;
+      else if (argv[i][1] == 'c')
+        check = true;
+      else if (argv[i][1] == 'p' && i < argc - 1)
+        pool = atoi(argv[++i]);
+      else if (argv[i][1] == 'f' && i < argc - 1)
+        frames = atol(argv[++i]);
+      else if (argv[i][1] == 't' && i < argc - 1)
+        threads = atoi(argv[++i]);
+      else if (argv[i][1] == 'b' && i < argc - 1)
+        lanes = atoi(argv[++i]);
+      else if (argv[i][1] == 'd')
+        draw = true;
+      else if (argv[i][1] == 'k')
+        display = true;
+      else if (argv[i][1] == 'r')
+        state = true;
+      else if (argv[i][1] == 'w')
+        rewind = true;
+      else if (argv[i][1] == 'm')
+        replay = true;
+      else if (argv[i][1] == 'a')
+        disasm = true;
+      else if (argv[i][1] == 'q' && i < argc - 1)
+        chipQuirks = uint(strtoul(argv[++i], nullptr, 0));
+      else {
+        fprintf(stderr, "Usage: CChip8Bench [-n <count>] [-s] [-c] "
+                        "[-p <instances> [-f <frames>] [-t <max_threads>]] [-b <lanes> [-f <frames>]] "
+                        "[-d] [-k] [-r [-f <frames>]] [-w [-f <frames>]] [-m [-f <frames>]] [-a] "
+                        "[-q <quirks>] [<rom>]\n");
+        exit(1);
+      }
+    }
+    else {
+      filename = argv[i];
+    }
+  }
+
+  std::vector<uchar> rom;
+
+  if (filename) {
+    CChip8::LoadError error = loadRom(filename, rom);
+
+    if (error != CChip8::LoadError::NONE) {
+      fprintf(stderr, "Failed to read '%s' (%s)\n", filename, CChip8::loadErrorMessage(error));
+      exit(1);
+    }
+  }
+  else
+    rom = mixRom();
+
+  std::vector<Engine> engines = { Engine::STEP, Engine::DECODED, Engine::BLOCK };
+
+  if (CChip8Jit::isSupported())
+    engines.push_back(Engine::JIT);
+
+  //---
+
+  // buffer disassembler against stream disassembler
+  if (disasm)
+    return (disasmCheck() ? 0 : 1);
+
+  //---
+
+  // display kernels against reference
+  if (display)
+    return (displayCheck(std::min(count, 200000L)) ? 0 : 1);
+
+  //---
+
+  // save state round trip
+  if (state)
+    return (stateCheck(rom, super, frames) ? 0 : 1);
+
+  //---
+
+  // rewind history
+  if (rewind)
+    return (rewindCheck(rom, super, frames) ? 0 : 1);
+
+  //---
+
+  // movie replay with each engine
+  if (replay)
+    return (movieCheck(rom, super, frames, engines) ? 0 : 1);
+
+  //---
+
+  // sprite draw microbenchmark
+  if (draw) {
+    drawBench(super, count);
+    return 0;
+  }
+
+  //---
+
+  // pool thread scaling
+  if (pool > 0) {
+    poolBench(rom, super, pool, frames, threads);
+    return 0;
+  }
+
+  //---
+
+  // lockstep batch against independent instances (and with lanes diverging
+  // in self modifying code)
+  if (lanes > 0) {
+    bool rc = batchBench(rom, super, lanes, frames);
+
+    printf("self modifying:\n");
+
+    if (! batchBench(smcRom(), super, lanes, frames, true))
+      rc = false;
+
+    return (rc ? 0 : 1);
+  }
+
+  //---
+
+  // check engines against step()
+  if (check) {
+    bool rc = true;
+
+    for (auto engine : engines) {
+      if (engine != Engine::STEP && ! checkEngine(engine, rom, super, count))
+        rc = false;
+    }
+
+    return (rc ? 0 : 1);
+  }
+
+  //---
+
+  std::vector<double> ips;
+
+  for (auto engine : engines)
+    ips.push_back(runBench(engine, rom, super, count));
+
+  for (size_t i = 1; i < engines.size(); ++i) {
+    if (ips[0] > 0.0)
+      printf("%-8s speedup : %.2fx\n", engineName(engines[i]), ips[i]/ips[0]);
+  }
+
+  return 0;
+}
@@ -0,0 +1,34 @@
+TEMPLATE = app
+
+CONFIG -= qt
+CONFIG += console release thread
+
+TARGET = CChip8Bench
+
+DEPENDPATH += .
+
+INCLUDEPATH += . ../include
+
+QMAKE_CXXFLAGS += -std=c++17
+
+SOURCES += \
+CChip8Bench.cpp \
+
+HEADERS += \
+CChip8.h \
+CChip8Jit.h \
+CChip8Pool.h \
+CChip8Batch.h \
+CChip8Rewind.h \
+CChip8Movie.h \
+CChip8Asm.h \
+
+DESTDIR     = ../bin
+OBJECTS_DIR = ../obj
+LIB_DIR     = ../lib
+
+INCLUDEPATH += \
+. ../include \
+
+unix:LIBS += \
+-L$$LIB_DIR \
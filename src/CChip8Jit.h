@@ -0,0 +1,545 @@
+#ifndef CChip8Jit_H
+#define CChip8Jit_H
+
+#include <CChip8.h>
+
+#if defined(__x86_64__) && defined(__linux__)
+#define CCHIP8_JIT 1
+#include <sys/mman.h>
+#endif
+
+// x86-64 dynamic recompiler for CChip8 basic blocks.
+//
+// Hot blocks (see CChip8::setBlockCompiler) are translated to native code
+// for their longest prefix of register only instructions (ALU, LD I, ADD I,
+// LD F, skips and JP). V registers and I are held in host registers inside
+// the block and the PC is implicit. Anything needing the runtime (DRW,
+// key waits, timers, memory, stack, RND) ends the native prefix and is
+// interpreted by CChip8 which remains the reference implementation.
+class CChip8Jit {
+ public:
+  static const size_t CodeSize = 1024*1024;
+
+  static bool isSupported() {
+#ifdef CCHIP8_JIT
+    return true;
+#else
+    return false;
+#endif
+  }
+
+  CChip8Jit(CChip8 *chip8, uint hits=16) :
+   chip8_(chip8) {
+#ifdef CCHIP8_JIT
+    void *p = mmap(nullptr, CodeSize, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    if (p == MAP_FAILED)
+      return;
+
+    code_ = static_cast<uchar *>(p);
+
+    mprotect(code_, CodeSize, PROT_READ | PROT_EXEC);
+
+    chip8_->setBlockCompiler([this](CChip8::Block &block) { compile(block); }, hits);
+#else
+    (void) hits;
+#endif
+  }
+
+ ~CChip8Jit() {
+#ifdef CCHIP8_JIT
+    if (! code_)
+      return;
+
+    chip8_->setBlockCompiler(CChip8::BlockCompiler());
+
+    munmap(code_, CodeSize);
+#endif
+  }
+
+  CChip8Jit(const CChip8Jit &) = delete;
+  CChip8Jit &operator=(const CChip8Jit &) = delete;
+
+  bool isEnabled() const { return code_ != nullptr; }
+
+  // number of blocks compiled and total instructions compiled
+  int numCompiled   () const { return numCompiled_; }
+  int numCompiledOps() const { return numCompiledOps_; }
+
+  // compile native prefix of block
+  bool compile(CChip8::Block &block) {
+#ifdef CCHIP8_JIT
+    if (! code_)
+      return false;
+
+    buffer_.clear();
+
+    int numOps = allocRegs(block);
+
+    if (numOps == 0)
+      return false;
+
+    emitBlock(block, numOps);
+
+    // out of code space so drop all native code and start again
+    if (codePos_ + buffer_.size() > CodeSize) {
+      chip8_->resetNativeBlocks();
+
+      codePos_ = 0;
+    }
+
+    uchar *proc = code_ + codePos_;
+
+    mprotect(code_, CodeSize, PROT_READ | PROT_WRITE);
+
+    memcpy(proc, &buffer_[0], buffer_.size());
+
+    mprotect(code_, CodeSize, PROT_READ | PROT_EXEC);
+
+    codePos_ += (buffer_.size() + 15) & ~size_t(15);
+
+    block.native       = reinterpret_cast<CChip8::NativeProc>(proc);
+    block.numNativeOps = numOps;
+
+    ++numCompiled_;
+
+    numCompiledOps_ += numOps;
+
+    return true;
+#else
+    (void) block;
+    return false;
+#endif
+  }
+
+ private:
+  using OpCode = CChip8::OpCode;
+
+  // x86-64 registers
+  enum Reg {
+    RAX = 0, RCX = 1, RDX = 2, RBX = 3, RSP = 4, RBP = 5, RSI = 6, RDI = 7,
+    R8  = 8, R9  = 9, R10 = 10, R11 = 11, R12 = 12, R13 = 13, R14 = 14, R15 = 15,
+    NoReg = -1
+  };
+
+  // condition codes
+  enum Cond { CondAE = 0x3, CondE = 0x4, CondNE = 0x5 };
+
+  // ALU opcodes (reg, reg form) and /digit extensions (reg, imm form)
+  enum AluOp { AluAdd = 0x01, AluOr = 0x09, AluAnd = 0x21, AluSub = 0x29,
+               AluXor = 0x31, AluCmp = 0x39, AluMov = 0x89 };
+  enum AluExt { ExtAdd = 0, ExtAnd = 4, ExtCmp = 7 };
+  enum ShiftExt { ShiftLeft = 4, ShiftRight = 5 };
+
+  // rdi = V, rsi = &I, rax/rcx/rdx are scratch
+  static const int NumAllocRegs = 10;
+
+  static bool isCompiled(OpCode code) {
+    switch (code) {
+      case OpCode::JP:
+      case OpCode::SE_VX_NN:
+      case OpCode::SNE_VX_NN:
+      case OpCode::SE_VX_VY:
+      case OpCode::SNE_VX_VY:
+      case OpCode::LD_VX_NN:
+      case OpCode::ADD_VX_NN:
+      case OpCode::LD_VX_VY:
+      case OpCode::OR_VX_VY:
+      case OpCode::AND_VX_VY:
+      case OpCode::XOR_VX_VY:
+      case OpCode::ADD_VX_VY:
+      case OpCode::SUB_VX_VY:
+      case OpCode::SHR_VX_VY:
+      case OpCode::SUBN_VX_VY:
+      case OpCode::SHL_VX_VY:
+      case OpCode::LD_I_NNN:
+      case OpCode::ADD_I_VX:
+      case OpCode::LD_F_VX:
+        return true;
+      default:
+        return false;
+    }
+  }
+
+  // registers read or written by op (bit 16 is I)
+  static uint usedRegs(const CChip8::DecodedOp &op) {
+    uint x  = (1U << op.x);
+    uint y  = (1U << op.y);
+    uint vf = (1U << 0xF);
+    uint i  = (1U << 16);
+
+    switch (op.code) {
+      case OpCode::JP        : return 0;
+      case OpCode::SE_VX_NN  :
+      case OpCode::SNE_VX_NN :
+      case OpCode::LD_VX_NN  :
+      case OpCode::ADD_VX_NN : return x;
+      case OpCode::SE_VX_VY  :
+      case OpCode::SNE_VX_VY :
+      case OpCode::LD_VX_VY  :
+      case OpCode::OR_VX_VY  :
+      case OpCode::AND_VX_VY :
+      case OpCode::XOR_VX_VY : return x | y;
+      case OpCode::ADD_VX_VY :
+      case OpCode::SUB_VX_VY :
+      case OpCode::SHR_VX_VY :
+      case OpCode::SUBN_VX_VY:
+      case OpCode::SHL_VX_VY : return x | y | vf;
+      case OpCode::LD_I_NNN  : return i;
+      case OpCode::ADD_I_VX  : return x | vf | i;
+      case OpCode::LD_F_VX   : return x | i;
+      default                : return 0;
+    }
+  }
+
+  // assign host registers for longest compilable prefix of block
+  int allocRegs(const CChip8::Block &block) {
+    static const Reg allocOrder[NumAllocRegs] = {
+      R8, R9, R10, R11, RBX, RBP, R12, R13, R14, R15
+    };
+
+    for (int i = 0; i < 17; ++i)
+      regMap_[i] = NoReg;
+
+    written_ = 0;
+
+    uint used = 0;
+
+    int numOps = 0;
+
+    for ( ; numOps < block.numOps; ++numOps) {
+      const auto &op = block.ops[numOps];
+
+      if (! isCompiled(op.code))
+        break;
+
+      uint used1 = used | usedRegs(op);
+
+      if (__builtin_popcount(used1) > NumAllocRegs)
+        break;
+
+      used = used1;
+    }
+
+    int n = 0;
+
+    for (int i = 0; i < 17; ++i)
+      if (used & (1U << i))
+        regMap_[i] = allocOrder[n++];
+
+    return numOps;
+  }
+
+  Reg vreg(int i) { written_ |= (1U << i); return regMap_[i]; }
+
+  // source register of SHR/SHL (chip quirks read at compile, see CChip8::setQuirks)
+  int shiftReg(const CChip8::DecodedOp &op) const {
+    return (chip8_->quirks() & CChip8::QuirkShiftVY ? op.y : op.x);
+  }
+
+  Reg vregR(int i) const { return regMap_[i]; }
+
+  Reg ireg() { written_ |= (1U << 16); return regMap_[16]; }
+
+  Reg iregR() const { return regMap_[16]; }
+
+  static bool isCalleeSaved(Reg r) {
+    return (r == RBX || r == RBP || r >= R12);
+  }
+
+  //---
+
+  void emitBlock(const CChip8::Block &block, int numOps) {
+    // prologue: save callee saved registers and load guest registers
+    for (int i = 0; i < 17; ++i)
+      if (regMap_[i] != NoReg && isCalleeSaved(regMap_[i]))
+        emitPush(regMap_[i]);
+
+    for (int i = 0; i < 16; ++i)
+      if (regMap_[i] != NoReg)
+        emitLoadV(regMap_[i], i);
+
+    if (regMap_[16] != NoReg)
+      emitLoadI(regMap_[16]);
+
+    //---
+
+    ushort pc = block.start;
+
+    bool exited = false;
+
+    for (int i = 0; i < numOps; ++i) {
+      const auto &op = block.ops[i];
+
+      pc += 2;
+
+      exited = emitOp(op, pc);
+    }
+
+    if (! exited)
+      emitMovImm(RAX, pc);
+
+    //---
+
+    // epilogue: store modified guest registers and restore host registers
+    for (int i = 0; i < 16; ++i)
+      if (written_ & (1U << i))
+        emitStoreV(i, regMap_[i]);
+
+    if (written_ & (1U << 16))
+      emitStoreI(regMap_[16]);
+
+    for (int i = 16; i >= 0; --i)
+      if (regMap_[i] != NoReg && isCalleeSaved(regMap_[i]))
+        emitPop(regMap_[i]);
+
+    emit(0xC3); // ret
+  }
+
+  // emit op (pc is address of next instruction), returns true if new PC is in RAX
+  bool emitOp(const CChip8::DecodedOp &op, ushort pc) {
+    auto skip = [&](Cond cond, bool imm) {
+      emitMovImm(RAX, pc);
+      emitMovImm(RDX, pc + 2);
+
+      if (imm)
+        emitAluImm(ExtCmp, vregR(op.x), op.nn);
+      else
+        emitAlu(AluCmp, vregR(op.x), vregR(op.y));
+
+      emitCmov(cond, RAX, RDX);
+    };
+
+    switch (op.code) {
+      case OpCode::JP:
+        emitMovImm(RAX, op.nnn);
+        return true;
+      case OpCode::SE_VX_NN:
+        skip(CondE, true);
+        return true;
+      case OpCode::SNE_VX_NN:
+        skip(CondNE, true);
+        return true;
+      case OpCode::SE_VX_VY:
+        skip(CondE, false);
+        return true;
+      case OpCode::SNE_VX_VY:
+        skip(CondNE, false);
+        return true;
+      case OpCode::LD_VX_NN:
+        emitMovImm(vreg(op.x), op.nn);
+        break;
+      case OpCode::ADD_VX_NN:
+        emitAluImm(ExtAdd, vreg(op.x), op.nn);
+        emitAluImm(ExtAnd, vreg(op.x), 0xFF);
+        break;
+      case OpCode::LD_VX_VY:
+        if (op.x != op.y)
+          emitAlu(AluMov, vreg(op.x), vregR(op.y));
+        break;
+      case OpCode::OR_VX_VY:
+        emitAlu(AluOr, vreg(op.x), vregR(op.y));
+        break;
+      case OpCode::AND_VX_VY:
+        emitAlu(AluAnd, vreg(op.x), vregR(op.y));
+        break;
+      case OpCode::XOR_VX_VY:
+        emitAlu(AluXor, vreg(op.x), vregR(op.y));
+        break;
+      case OpCode::ADD_VX_VY:
+        // sum = Vx + Vy; VF = carry; Vx = sum & 0xFF
+        emitAlu(AluMov, RAX, vregR(op.x));
+        emitAlu(AluAdd, RAX, vregR(op.y));
+        emitAlu(AluMov, RCX, RAX);
+        emitShiftImm(ShiftRight, RCX, 8);
+        emitAluImm(ExtAnd, RAX, 0xFF);
+        emitAlu(AluMov, vreg(0xF), RCX);
+        emitAlu(AluMov, vreg(op.x), RAX);
+        break;
+      case OpCode::SUB_VX_VY:
+        // VF = (Vx >= Vy); Vx = Vx - Vy (using updated VF)
+        emitSetFlag(CondAE, vregR(op.x), vregR(op.y));
+        emitAlu(AluMov, vreg(0xF), RCX);
+        emitAlu(AluMov, RAX, vregR(op.x));
+        emitAlu(AluSub, RAX, vregR(op.y));
+        emitAluImm(ExtAnd, RAX, 0xFF);
+        emitAlu(AluMov, vreg(op.x), RAX);
+        break;
+      case OpCode::SHR_VX_VY:
+        // VF = Vs & 1; Vx = Vs >> 1 (using updated VF, Vs is Vy for shift quirk)
+        emitAlu(AluMov, RCX, vregR(shiftReg(op)));
+        emitAluImm(ExtAnd, RCX, 1);
+        emitAlu(AluMov, vreg(0xF), RCX);
+        emitAlu(AluMov, RAX, vregR(shiftReg(op)));
+        emitShiftImm(ShiftRight, RAX, 1);
+        emitAlu(AluMov, vreg(op.x), RAX);
+        break;
+      case OpCode::SUBN_VX_VY:
+        // VF = (Vy >= Vx); Vx = Vy - Vx (using updated VF)
+        emitSetFlag(CondAE, vregR(op.y), vregR(op.x));
+        emitAlu(AluMov, vreg(0xF), RCX);
+        emitAlu(AluMov, RAX, vregR(op.y));
+        emitAlu(AluSub, RAX, vregR(op.x));
+        emitAluImm(ExtAnd, RAX, 0xFF);
+        emitAlu(AluMov, vreg(op.x), RAX);
+        break;
+      case OpCode::SHL_VX_VY:
+        // VF = Vs >> 7; Vx = Vs << 1 (using updated VF, Vs is Vy for shift quirk)
+        emitAlu(AluMov, RCX, vregR(shiftReg(op)));
+        emitShiftImm(ShiftRight, RCX, 7);
+        emitAlu(AluMov, vreg(0xF), RCX);
+        emitAlu(AluMov, RAX, vregR(shiftReg(op)));
+        emitShiftImm(ShiftLeft, RAX, 1);
+        emitAluImm(ExtAnd, RAX, 0xFF);
+        emitAlu(AluMov, vreg(op.x), RAX);
+        break;
+      case OpCode::LD_I_NNN:
+        emitMovImm(ireg(), op.nnn & CChip8::MemDataEnd);
+        break;
+      case OpCode::ADD_I_VX:
+        // sum = I + Vx; I = sum & 0xFFF; VF = (sum > 0xFFF)
+        emitAlu(AluMov, RAX, iregR());
+        emitAlu(AluAdd, RAX, vregR(op.x));
+        emitAlu(AluMov, RCX, RAX);
+        emitShiftImm(ShiftRight, RCX, 12);
+        emitAluImm(ExtAnd, RAX, CChip8::MemDataEnd);
+        emitAlu(AluMov, ireg(), RAX);
+        emitAlu(AluMov, vreg(0xF), RCX);
+        break;
+      case OpCode::LD_F_VX:
+        // I = SpriteAddr + Vx*CharHeight
+        emitImul(RAX, vregR(op.x), CChip8::CharHeight);
+        if (CChip8::SpriteAddr)
+          emitAluImm(ExtAdd, RAX, CChip8::SpriteAddr);
+        emitAlu(AluMov, ireg(), RAX);
+        break;
+      default:
+        assert(false);
+        break;
+    }
+
+    return false;
+  }
+
+  //---
+
+  void emit(uchar b) { buffer_.push_back(b); }
+
+  void emit32(uint v) {
+    emit(v & 0xFF); emit((v >> 8) & 0xFF); emit((v >> 16) & 0xFF); emit((v >> 24) & 0xFF);
+  }
+
+  // REX prefix for reg (modrm.reg) and rm (modrm.rm) (emitted only if needed)
+  void emitRex(int reg, int rm, bool force=false) {
+    uchar rex = 0x40 | (reg >= 8 ? 0x04 : 0) | (rm >= 8 ? 0x01 : 0);
+
+    if (rex != 0x40 || force)
+      emit(rex);
+  }
+
+  void emitModRM(int mod, int reg, int rm) {
+    emit(uchar((mod << 6) | ((reg & 7) << 3) | (rm & 7)));
+  }
+
+  // mov r32, imm32
+  void emitMovImm(Reg r, uint imm) {
+    emitRex(0, r);
+    emit(uchar(0xB8 + (r & 7)));
+    emit32(imm);
+  }
+
+  // <op> dst32, src32
+  void emitAlu(AluOp op, Reg dst, Reg src) {
+    emitRex(src, dst);
+    emit(op);
+    emitModRM(3, src, dst);
+  }
+
+  // <op> dst32, imm32
+  void emitAluImm(AluExt ext, Reg dst, uint imm) {
+    emitRex(0, dst);
+    emit(0x81);
+    emitModRM(3, ext, dst);
+    emit32(imm);
+  }
+
+  // shl/shr r32, imm8
+  void emitShiftImm(ShiftExt ext, Reg r, uchar n) {
+    emitRex(0, r);
+    emit(0xC1);
+    emitModRM(3, ext, r);
+    emit(n);
+  }
+
+  // imul dst32, src32, imm8
+  void emitImul(Reg dst, Reg src, uchar imm) {
+    emitRex(dst, src);
+    emit(0x6B);
+    emitModRM(3, dst, src);
+    emit(imm);
+  }
+
+  // cmov<cond> dst32, src32
+  void emitCmov(Cond cond, Reg dst, Reg src) {
+    emitRex(dst, src);
+    emit(0x0F);
+    emit(uchar(0x40 + cond));
+    emitModRM(3, dst, src);
+  }
+
+  // ecx = (a <cond> b ? 1 : 0)
+  void emitSetFlag(Cond cond, Reg a, Reg b) {
+    emitAlu(AluXor, RCX, RCX);
+    emitAlu(AluCmp, a, b);
+    emit(0x0F);
+    emit(uchar(0x90 + cond));
+    emitModRM(3, 0, RCX);
+  }
+
+  // movzx r32, byte [rdi + i]
+  void emitLoadV(Reg r, int i) {
+    emitRex(r, 0);
+    emit(0x0F); emit(0xB6);
+    emitModRM(1, r, RDI);
+    emit(uchar(i));
+  }
+
+  // mov byte [rdi + i], r8
+  void emitStoreV(int i, Reg r) {
+    emitRex(r, 0, /*force*/true);
+    emit(0x88);
+    emitModRM(1, r, RDI);
+    emit(uchar(i));
+  }
+
+  // movzx r32, word [rsi]
+  void emitLoadI(Reg r) {
+    emitRex(r, 0);
+    emit(0x0F); emit(0xB7);
+    emitModRM(0, r, RSI);
+  }
+
+  // mov word [rsi], r16
+  void emitStoreI(Reg r) {
+    emit(0x66);
+    emitRex(r, 0);
+    emit(0x89);
+    emitModRM(0, r, RSI);
+  }
+
+  void emitPush(Reg r) { emitRex(0, r); emit(uchar(0x50 + (r & 7))); }
+  void emitPop (Reg r) { emitRex(0, r); emit(uchar(0x58 + (r & 7))); }
+
+ private:
+  CChip8*            chip8_          { nullptr };
+  uchar*             code_           { nullptr };
+  size_t             codePos_        { 0 };
+  std::vector<uchar> buffer_;
+  Reg                regMap_[17]     { };
+  uint               written_        { 0 };
+  int                numCompiled_    { 0 };
+  int                numCompiledOps_ { 0 };
+};
+
+#endif
@@ -0,0 +1,250 @@
+#ifndef CChip8Movie_H
+#define CChip8Movie_H
+
+#include <CChip8.h>
+#include <CChip8Scheduler.h>
+
+#include <cinttypes>
+#include <cstdio>
+#include <vector>
+
+// Recorded input for a run from reset: key transitions at cycle numbers plus
+// everything else the run depends on (rom hash, RND seed, super mode, quirks
+// and instructions per second, which gives the frame sizes, see
+// CChip8Scheduler::frameCycles()). Played back with CChip8MoviePlayer the
+// run is repeated exactly.
+//
+// File format (text):
+//   CChip8Movie 2
+//   rom <hash> seed <seed> super <0|1> quirks <hex> ips <ips> length <cycles>
+//   <cycle> <key> <0|1>
+//   ...
+// Version 1 files (no quirks) are read with no quirks set.
+class CChip8Movie {
+ public:
+  static const int Version = 2;
+
+  struct Event {
+    uint64_t cycle { 0 };
+    uchar    key   { 0 };
+    bool     down  { false };
+  };
+
+  using Events = std::vector<Event>;
+
+ public:
+  CChip8Movie() { }
+
+  uint64_t romHash() const { return romHash_; }
+  uint64_t seed   () const { return seed_; }
+  bool     isSuper() const { return super_; }
+  uint     quirks () const { return quirks_; }
+  double   ips    () const { return ips_; }
+
+  // cycles covered by recording
+  uint64_t length() const { return length_; }
+  void setLength(uint64_t n) { length_ = n; }
+
+  const Events &events() const { return events_; }
+
+  //---
+
+  // FNV-1a hash of program memory
+  static uint64_t memoryHash(const CChip8 &chip) {
+    uint64_t h = 0xcbf29ce484222325ULL;
+
+    for (int i = CChip8::MemDataStart; i <= CChip8::MemDataEnd; ++i) {
+      h ^= chip.memory(ushort(i));
+      h *= 0x100000001b3ULL;
+    }
+
+    return h;
+  }
+
+  //---
+
+  // start recording chip just reset (and seeded with seed)
+  void start(const CChip8 &chip, uint64_t seed, double ips) {
+    romHash_ = memoryHash(chip);
+    seed_    = seed;
+    super_   = chip.isSuper();
+    quirks_  = chip.quirks();
+    ips_     = ips;
+    length_  = 0;
+
+    events_.clear();
+  }
+
+  // add key change made at current cycle
+  void record(const CChip8 &chip, uchar key, bool down) {
+    Event event;
+
+    event.cycle = chip.cycles();
+    event.key   = key;
+    event.down  = down;
+
+    events_.push_back(event);
+
+    length_ = std::max(length_, event.cycle);
+  }
+
+  // drop events at or after cycle (run rewound to state captured at end of
+  // frame so changes made at that cycle came later)
+  void truncate(uint64_t cycle) {
+    while (! events_.empty() && events_.back().cycle >= cycle)
+      events_.pop_back();
+
+    length_ = std::min(length_, cycle);
+  }
+
+  //---
+
+  bool save(const char *filename) const {
+    FILE *fp = fopen(filename, "w");
+    if (! fp) return false;
+
+    fprintf(fp, "CChip8Movie %d\n", Version);
+
+    fprintf(fp, "rom %016" PRIx64 " seed %" PRIu64 " super %d quirks %X ips %.17g "
+            "length %" PRIu64 "\n", romHash_, seed_, super_ ? 1 : 0, quirks_, ips_, length_);
+
+    for (const auto &event : events_)
+      fprintf(fp, "%" PRIu64 " %X %d\n", event.cycle, event.key, event.down ? 1 : 0);
+
+    bool rc = (ferror(fp) == 0);
+
+    fclose(fp);
+
+    return rc;
+  }
+
+  // read movie (returns false if not a valid movie of this or an older version)
+  bool load(const char *filename) {
+    FILE *fp = fopen(filename, "r");
+    if (! fp) return false;
+
+    int  version = 0, super = 0;
+    uint quirks  = 0;
+
+    bool rc = (fscanf(fp, "CChip8Movie %d", &version) == 1 && version >= 1 &&
+               version <= Version &&
+               fscanf(fp, " rom %" SCNx64 " seed %" SCNu64 " super %d",
+                      &romHash_, &seed_, &super) == 3 &&
+               (version < 2 || fscanf(fp, " quirks %X", &quirks) == 1) &&
+               fscanf(fp, " ips %lf length %" SCNu64, &ips_, &length_) == 2 && ips_ > 0.0);
+
+    super_  = super;
+    quirks_ = quirks;
+
+    events_.clear();
+
+    while (rc) {
+      Event    event;
+      uint64_t cycle;
+      uint     key;
+      int      down;
+
+      int n = fscanf(fp, " %" SCNu64 " %X %d", &cycle, &key, &down);
+
+      if (n == EOF)
+        break;
+
+      if (n != 3 || key >= 16 || (! events_.empty() && cycle < events_.back().cycle)) {
+        rc = false;
+        break;
+      }
+
+      event.cycle = cycle;
+      event.key   = uchar(key);
+      event.down  = down;
+
+      events_.push_back(event);
+    }
+
+    fclose(fp);
+
+    return rc;
+  }
+
+ private:
+  uint64_t romHash_ { 0 };
+  uint64_t seed_    { 0 };
+  bool     super_   { false };
+  uint     quirks_  { 0 };
+  double   ips_     { 540.0 };
+  uint64_t length_  { 0 };
+  Events   events_;
+};
+
+//---
+
+// Replays a movie on a chip, applying each key change before the instruction
+// at its cycle (runs as fast as the core allows, pacing is up to the caller).
+class CChip8MoviePlayer {
+ public:
+  using StopReason = CChip8::StopReason;
+
+ public:
+  CChip8MoviePlayer(const CChip8Movie &movie) :
+   movie_(movie), scheduler_(movie.ips()) {
+  }
+
+  const CChip8Movie &movie() const { return movie_; }
+
+  // prepare chip (loaded with rom) for playback: set mode and quirks, reset,
+  // seed and check rom matches recording (returns false if not)
+  bool start(CChip8 &chip) {
+    chip.setSuper (movie_.isSuper());
+    chip.setQuirks(movie_.quirks());
+
+    chip.reset(/*memory*/false);
+
+    chip.setSeed(movie_.seed());
+
+    ind_   = 0;
+    frame_ = 0;
+
+    return (CChip8Movie::memoryHash(chip) == movie_.romHash());
+  }
+
+  // true when all recorded cycles run
+  bool isFinished(const CChip8 &chip) const { return chip.cycles() >= movie_.length(); }
+
+  // run next frame applying key changes at their exact cycle
+  StopReason runFrame(CChip8 &chip) {
+    chip.setCyclesPerFrame(scheduler_.frameCycles(frame_++));
+
+    const auto &events = movie_.events();
+
+    int numEvents = int(events.size());
+
+    for (;;) {
+      // apply changes due now
+      while (ind_ < numEvents && events[ind_].cycle <= chip.cycles()) {
+        chip.setKey(events[ind_].key, events[ind_].down);
+
+        ++ind_;
+      }
+
+      uint64_t left = uint64_t(chip.cyclesPerFrame() - chip.frameCycles());
+
+      // run to next change or end of frame
+      if (ind_ < numEvents && events[ind_].cycle - chip.cycles() < left) {
+        StopReason reason = chip.runCycles(events[ind_].cycle - chip.cycles());
+
+        if (reason != StopReason::BUDGET && reason != StopReason::WAIT_KEY)
+          return reason;
+      }
+      else
+        return chip.runUntilFrame();
+    }
+  }
+
+ private:
+  const CChip8Movie &movie_;
+  CChip8Scheduler    scheduler_;
+  int                ind_   { 0 }; // next event
+  uint64_t           frame_ { 0 };
+};
+
+#endif
@@ -0,0 +1,242 @@
+#ifndef CChip8Pool_H
+#define CChip8Pool_H
+
+#include <CChip8.h>
+
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+// Pool of CChip8 instances run across multiple threads.
+//
+// Each instance is run in frame sized tasks. Every worker owns a deque of
+// tasks: it runs tasks from the back of its own deque and requeues an
+// unfinished instance there (so it stays hot in that core's cache) and
+// when its deque is empty it steals from the front of another worker's.
+class CChip8Pool {
+ public:
+  // called before each frame of an instance (e.g. to set keys)
+  using InputProc = std::function<void (CChip8 &chip, long frame)>;
+
+  struct Result {
+    CChip8::StopReason reason     { CChip8::StopReason::BUDGET };
+    uint64_t           cycles     { 0 };
+    long               frames     { 0 };
+    uint64_t           screenHash { 0 };
+    double             time       { 0.0 }; // seconds spent running
+  };
+
+ public:
+  CChip8Pool(int numThreads=0) {
+    setNumThreads(numThreads);
+  }
+
+  int numThreads() const { return numThreads_; }
+
+  // set number of worker threads (0 for one per core)
+  void setNumThreads(int n) {
+    if (n <= 0)
+      n = std::max(int(std::thread::hardware_concurrency()), 1);
+
+    numThreads_ = n;
+  }
+
+  // frames run per task
+  int taskFrames() const { return taskFrames_; }
+  void setTaskFrames(int n) { assert(n > 0); taskFrames_ = n; }
+
+  //---
+
+  // add instance loaded with rom to run for given number of frames (rom
+  // copied straight to instance memory, e.g. from a shared CChip8::RomFile)
+  // with super mode, instructions per frame and quirks (see CChip8::setQuirks()).
+  // Returns instance id (-1 if rom empty or too large)
+  int addInstance(const uchar *rom, size_t len, long frames,
+                  bool super=false, int cyclesPerFrame=9, uint quirks=0) {
+    auto instance = std::make_unique<Instance>();
+
+    instance->chip.setSuper(super);
+
+    instance->chip.setQuirks(quirks);
+
+    instance->chip.reset();
+
+    if (instance->chip.loadRom(rom, len) != CChip8::LoadError::NONE)
+      return -1;
+
+    instance->chip.setCyclesPerFrame(cyclesPerFrame);
+
+    instance->frames = frames;
+
+    instances_.push_back(std::move(instance));
+
+    return int(instances_.size()) - 1;
+  }
+
+  int numInstances() const { return int(instances_.size()); }
+
+  CChip8 &instance(int id) { return instances_[id]->chip; }
+
+  void setInputProc(int id, const InputProc &proc) { instances_[id]->inputProc = proc; }
+
+  const Result &result(int id) const { return instances_[id]->result; }
+
+  void clear() { instances_.clear(); }
+
+  //---
+
+  // run all instances to completion (blocks until done)
+  void run() {
+    int numThreads = std::min(numThreads_, std::max(numInstances(), 1));
+
+    workers_.clear();
+
+    for (int i = 0; i < numThreads; ++i)
+      workers_.push_back(std::make_unique<Worker>());
+
+    remaining_ = 0;
+
+    for (int i = 0; i < numInstances(); ++i) {
+      if (instances_[i]->result.frames >= instances_[i]->frames)
+        continue;
+
+      workers_[i % numThreads]->tasks.push_back(i);
+
+      ++remaining_;
+    }
+
+    std::vector<std::thread> threads;
+
+    for (int i = 1; i < numThreads; ++i)
+      threads.emplace_back([this, i]() { workerLoop(i); });
+
+    workerLoop(0);
+
+    for (auto &thread : threads)
+      thread.join();
+  }
+
+  // number of tasks taken from another worker in last run
+  long numSteals() const {
+    long n = 0;
+
+    for (const auto &worker : workers_)
+      n += worker->steals;
+
+    return n;
+  }
+
+ private:
+  struct Instance {
+    CChip8    chip;
+    long      frames { 0 };
+    InputProc inputProc;
+    Result    result;
+  };
+
+  struct Worker {
+    std::mutex      mutex;
+    std::deque<int> tasks;
+    long            steals { 0 };
+  };
+
+  void workerLoop(int ind) {
+    Worker &worker = *workers_[ind];
+
+    int numWorkers = int(workers_.size());
+
+    while (remaining_ > 0) {
+      int id = -1;
+
+      // own tasks (newest first)
+      {
+        std::lock_guard<std::mutex> lock(worker.mutex);
+
+        if (! worker.tasks.empty()) {
+          id = worker.tasks.back();
+
+          worker.tasks.pop_back();
+        }
+      }
+
+      // steal oldest task from another worker
+      for (int i = 1; id < 0 && i < numWorkers; ++i) {
+        Worker &victim = *workers_[(ind + i) % numWorkers];
+
+        std::lock_guard<std::mutex> lock(victim.mutex);
+
+        if (! victim.tasks.empty()) {
+          id = victim.tasks.front();
+
+          victim.tasks.pop_front();
+
+          ++worker.steals;
+        }
+      }
+
+      if (id < 0) {
+        std::this_thread::yield();
+        continue;
+      }
+
+      //---
+
+      if (runTask(*instances_[id])) {
+        std::lock_guard<std::mutex> lock(worker.mutex);
+
+        worker.tasks.push_back(id);
+      }
+      else
+        --remaining_;
+    }
+  }
+
+  // run task sized number of frames (returns true if more to run)
+  bool runTask(Instance &instance) {
+    using Clock = std::chrono::steady_clock;
+
+    CChip8 &chip   = instance.chip;
+    Result &result = instance.result;
+
+    auto t1 = Clock::now();
+
+    bool more = true;
+
+    for (int i = 0; i < taskFrames_ && more; ++i) {
+      if (instance.inputProc)
+        instance.inputProc(chip, result.frames);
+
+      result.reason = chip.runUntilFrame();
+
+      ++result.frames;
+
+      more = (result.frames < instance.frames &&
+              (result.reason == CChip8::StopReason::FRAME ||
+               result.reason == CChip8::StopReason::WAIT_KEY));
+    }
+
+    auto t2 = Clock::now();
+
+    result.time  += std::chrono::duration<double>(t2 - t1).count();
+    result.cycles = chip.cycles();
+
+    if (! more)
+      result.screenHash = chip.screenHash();
+
+    return more;
+  }
+
+ private:
+  using InstanceP = std::unique_ptr<Instance>;
+  using WorkerP   = std::unique_ptr<Worker>;
+
+  int                    numThreads_ { 1 };
+  int                    taskFrames_ { 1 };
+  std::vector<InstanceP> instances_;
+  std::vector<WorkerP>   workers_;
+  std::atomic<int>       remaining_  { 0 };
+};
+
+#endif
@@ -0,0 +1,295 @@
+#ifndef CChip8Profile_H
+#define CChip8Profile_H
+
+#include <CChip8.h>
+
+#include <cinttypes>
+#include <cstdio>
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Sampling profiler of the PC of a CChip8.
+//
+// Runs the chip in short chunks of instructions (interval() on average,
+// randomly varied so samples don't lock step with program loops) and
+// samples the PC and call stack after each. Gives a per address histogram
+// of the 4K address space and the sampled call stacks (function entries
+// are the targets of the CALLs whose return addresses are on the stack).
+// Addresses are resolved to optional labels (from a file) and disassembly.
+// Stacks are exported in the folded format read by flamegraph tools:
+//   main;sub_2A0;draw_ship 123
+class CChip8Profiler {
+ public:
+  using StopReason = CChip8::StopReason;
+
+  // address and samples
+  struct HotSpot {
+    ushort   addr  { 0 };
+    uint64_t count { 0 };
+  };
+
+  using HotSpots = std::vector<HotSpot>;
+
+ public:
+  CChip8Profiler(uint interval=256) {
+    setInterval(interval);
+  }
+
+  // mean instructions between samples (1 samples every instruction)
+  uint interval() const { return interval_; }
+  void setInterval(uint n) { interval_ = std::max(n, 1U); next_ = nextInterval(); }
+
+  // add stack leaf instruction address to folded stacks
+  bool isLeafAddr() const { return leafAddr_; }
+  void setLeafAddr(bool b) { leafAddr_ = b; }
+
+  void clear() {
+    std::fill(&counts_[0], &counts_[CChip8::MemSize], 0);
+
+    stacks_.clear();
+
+    samples_ = 0;
+  }
+
+  uint64_t samples() const { return samples_; }
+
+  uint64_t count(ushort addr) const { return counts_[addr & CChip8::MemDataEnd]; }
+
+  //---
+
+  // labels ("<hex addr> <name>" per line, '#' comments)
+  bool loadLabels(const char *filename) {
+    FILE *fp = fopen(filename, "r");
+    if (! fp) return false;
+
+    char line[256];
+
+    while (fgets(line, sizeof(line), fp)) {
+      uint addr;
+      char name[128];
+
+      if (line[0] == '#' || sscanf(line, "%x %127s", &addr, name) != 2)
+        continue;
+
+      if (addr <= CChip8::MemDataEnd)
+        labels_[ushort(addr)] = name;
+    }
+
+    fclose(fp);
+
+    return true;
+  }
+
+  void setLabel(ushort addr, const std::string &name) { labels_[addr] = name; }
+
+  // label at address (empty if none)
+  std::string label(ushort addr) const {
+    auto p = labels_.find(addr);
+
+    return (p != labels_.end() ? (*p).second : std::string());
+  }
+
+  // name of function with entry addr (label, "main" for program start or sub_XXX)
+  std::string functionName(ushort addr) const {
+    std::string name = label(addr);
+
+    if (! name.empty())
+      return name;
+
+    if (addr == CChip8::MemDataStart)
+      return "main";
+
+    char buffer[16];
+
+    snprintf(buffer, sizeof(buffer), "sub_%03X", addr);
+
+    return buffer;
+  }
+
+  //---
+
+  // run n cycles sampling at random intervals
+  StopReason runCycles(CChip8 &chip, uint64_t n) {
+    StopReason reason = StopReason::BUDGET;
+
+    while (n > 0) {
+      uint64_t n1 = std::min(n, uint64_t(next_));
+
+      uint64_t c1 = chip.cycles();
+
+      reason = chip.runCycles(n1);
+
+      uint64_t run = chip.cycles() - c1;
+
+      n     -= std::min(run, n);
+      next_ -= uint(std::min(run, uint64_t(next_)));
+
+      if (next_ == 0) {
+        sample(chip);
+
+        next_ = nextInterval();
+      }
+
+      // (idle cycles waiting for a key are run and sampled)
+      if (reason != StopReason::BUDGET && reason != StopReason::WAIT_KEY)
+        break;
+    }
+
+    return reason;
+  }
+
+  // run to end of current frame sampling at random intervals
+  StopReason runUntilFrame(CChip8 &chip) {
+    StopReason reason = runCycles(chip, uint64_t(chip.cyclesPerFrame() - chip.frameCycles()));
+
+    return (reason == StopReason::BUDGET ? StopReason::FRAME : reason);
+  }
+
+  // add sample of current PC and call stack
+  void sample(const CChip8 &chip) {
+    ushort pc = chip.PC();
+
+    ++counts_[pc & CChip8::MemDataEnd];
+    ++samples_;
+
+    // function entries outermost first then leaf address
+    key_.clear();
+
+    key_.push_back(ushort(CChip8::MemDataStart));
+
+    for (uchar i = 0; i < chip.SP(); ++i) {
+      ushort ret = chip.stack(i);
+
+      // entry is target of CALL before return address (else unknown)
+      ushort call = ushort(ret - 2);
+
+      if (call >= CChip8::MemDataStart && call < CChip8::MemDataEnd &&
+          chip.decodedOp(call).code == CChip8::OpCode::CALL)
+        key_.push_back(chip.decodedOp(call).nnn);
+      else
+        key_.push_back(0);
+    }
+
+    key_.push_back(leafAddr_ ? pc : 0);
+
+    ++stacks_[key_];
+  }
+
+  //---
+
+  // addresses with samples, most sampled first
+  HotSpots hotSpots() const {
+    HotSpots spots;
+
+    for (int i = 0; i < CChip8::MemSize; ++i) {
+      if (! counts_[i]) continue;
+
+      HotSpot spot;
+
+      spot.addr  = ushort(i);
+      spot.count = counts_[i];
+
+      spots.push_back(spot);
+    }
+
+    std::sort(spots.begin(), spots.end(), [](const HotSpot &s1, const HotSpot &s2) {
+      return (s1.count != s2.count ? s1.count > s2.count : s1.addr < s2.addr);
+    });
+
+    return spots;
+  }
+
+  // print n hottest addresses (samples, percent, address, label, disassembly)
+  void printHotSpots(const CChip8 &chip, FILE *fp, int n=20) const {
+    auto spots = hotSpots();
+
+    for (int i = 0; i < int(spots.size()) && i < n; ++i) {
+      const auto &spot = spots[i];
+
+      char inst[CChip8::MaxDisasmSize];
+
+      chip.disassemble(spot.addr, inst, /*showAddr*/false);
+
+      std::string name = label(spot.addr);
+
+      fprintf(fp, "%10" PRIu64 " %6.2f%%  %03X  %-12s %s\n", spot.count,
+              100.0*spot.count/samples_, spot.addr, name.c_str(), inst);
+    }
+  }
+
+  // write sampled stacks in folded format (sorted by stack)
+  bool writeFolded(FILE *fp) const {
+    std::map<std::string, uint64_t> lines;
+
+    for (const auto &stack : stacks_) {
+      const Key &key = stack.first;
+
+      std::string line;
+
+      int n = int(key.size()) - 1;
+
+      for (int i = 0; i < n; ++i) {
+        if (i > 0) line += ";";
+
+        line += (key[i] ? functionName(key[i]) : std::string("unknown"));
+      }
+
+      if (leafAddr_) {
+        char buffer[16];
+
+        snprintf(buffer, sizeof(buffer), ";%03X", key[n]);
+
+        line += buffer;
+      }
+
+      lines[line] += stack.second;
+    }
+
+    for (const auto &line : lines)
+      fprintf(fp, "%s %" PRIu64 "\n", line.first.c_str(), line.second);
+
+    return (ferror(fp) == 0);
+  }
+
+ private:
+  using Key = std::vector<ushort>;
+
+  struct KeyHash {
+    size_t operator()(const Key &key) const {
+      size_t h = 0xcbf29ce484222325ULL;
+
+      for (auto addr : key)
+        h = (h ^ addr)*0x100000001b3ULL;
+
+      return h;
+    }
+  };
+
+  using Stacks = std::unordered_map<Key, uint64_t, KeyHash>;
+  using Labels = std::map<ushort, std::string>;
+
+  // random interval in [1, 2*interval - 1] (mean interval)
+  uint nextInterval() {
+    if (interval_ == 1)
+      return 1;
+
+    rand_ = rand_*6364136223846793005ULL + 1442695040888963407ULL;
+
+    return 1 + uint((rand_ >> 33) % (2*interval_ - 1));
+  }
+
+ private:
+  uint     interval_ { 256 };
+  uint     next_     { 1 };   // instructions to next sample
+  uint64_t rand_     { 1 };   // interval generator (LCG)
+  bool     leafAddr_ { false };
+  uint64_t counts_[CChip8::MemSize] { };
+  uint64_t samples_  { 0 };
+  Stacks   stacks_;
+  Key      key_;               // sample work key
+  Labels   labels_;
+};
+
+#endif
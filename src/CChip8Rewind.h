@@ -0,0 +1,295 @@
+#ifndef CChip8Rewind_H
+#define CChip8Rewind_H
+
+#include <CChip8.h>
+
+#include <chrono>
+#include <deque>
+#include <vector>
+
+// Rewind history of CChip8 states held in a fixed size ring buffer.
+//
+// capture() is called once per frame. Each frame is stored as the XOR of
+// its state with the previous frame's state, run length encoded (runs of
+// unchanged 8 byte words are skipped), so rewinding one frame is one XOR
+// pass over the newest state. Every keyInterval() frames the full state is
+// stored too, so seeking back n frames starts from the nearest keyframe
+// and never applies more than keyInterval() deltas. When the buffer is full
+// the oldest frames are dropped.
+class CChip8Rewind {
+ public:
+  struct Stats {
+    long     captures    { 0 };
+    double   captureTime { 0.0 }; // total seconds in capture()
+    double   maxCapture  { 0.0 }; // slowest capture (seconds)
+    uint64_t deltaBytes  { 0 };   // total delta bytes stored
+    uint64_t keyBytes    { 0 };   // total keyframe bytes stored
+
+    double meanCapture() const { return (captures > 0 ? captureTime/captures : 0.0); }
+  };
+
+ public:
+  CChip8Rewind(size_t budget=4*1024*1024, int keyInterval=60) :
+   keyInterval_(keyInterval) {
+    setBudget(budget);
+  }
+
+  // bytes used for history (clears history)
+  size_t budget() const { return ring_.size()*8; }
+
+  void setBudget(size_t bytes) {
+    // at least a few keyframes
+    size_t n = std::max(bytes/8, 4*StateWords);
+
+    ring_.assign(n, 0);
+
+    clear();
+  }
+
+  // frames between full states
+  int keyInterval() const { return keyInterval_; }
+  void setKeyInterval(int n) { keyInterval_ = std::max(n, 1); }
+
+  void clear() {
+    records_.clear();
+
+    head_    = 0;
+    frame_   = 0;
+    hasPrev_ = false;
+  }
+
+  //---
+
+  // number of frames which can be rewound
+  int numFrames() const {
+    if (records_.empty()) return 0;
+
+    return int(records_.back().frame - earliestFrame());
+  }
+
+  // ring buffer bytes in use
+  size_t usedBytes() const {
+    size_t n = 0;
+
+    for (const auto &record : records_)
+      n += record.size;
+
+    return 8*n;
+  }
+
+  const Stats &stats() const { return stats_; }
+
+  //---
+
+  // add current chip state as newest frame
+  void capture(const CChip8 &chip) {
+    using Clock = std::chrono::steady_clock;
+
+    auto t1 = Clock::now();
+
+    chip.saveState(&state_[0], StateWords*8);
+
+    bool key = (! hasPrev_ || frame_ % uint64_t(keyInterval_) == 0);
+
+    // XOR with previous frame (in place in temp buffer) then encode
+    size_t deltaSize = 0;
+
+    if (hasPrev_) {
+      for (size_t i = 0; i < StateWords; ++i)
+        prev_[i] ^= state_[i];
+
+      deltaSize = encode(&prev_[0], &delta_[0]);
+    }
+
+    size_t keySize = (key ? StateWords : 0);
+
+    Record record;
+
+    record.frame     = frame_++;
+    record.deltaSize = uint32_t(deltaSize);
+    record.keySize   = uint32_t(keySize);
+    record.size      = uint32_t(deltaSize + keySize);
+    record.offset    = allocate(record.size);
+
+    uint64_t *data = &ring_[record.offset];
+
+    std::copy(&delta_[0], &delta_[0] + deltaSize, data);
+
+    if (key)
+      std::copy(&state_[0], &state_[0] + keySize, data + deltaSize);
+
+    records_.push_back(record);
+
+    std::swap(prev_, state_);
+
+    hasPrev_ = true;
+
+    //---
+
+    auto t2 = Clock::now();
+
+    double t = std::chrono::duration<double>(t2 - t1).count();
+
+    ++stats_.captures;
+
+    stats_.captureTime += t;
+    stats_.maxCapture   = std::max(stats_.maxCapture, t);
+    stats_.deltaBytes  += 8*deltaSize;
+    stats_.keyBytes    += 8*keySize;
+  }
+
+  // restore state n frames before newest (history after it is discarded so
+  // capture continues from there). Returns false if nothing to rewind.
+  bool rewind(CChip8 &chip, int n=1) {
+    if (records_.empty() || n <= 0)
+      return false;
+
+    uint64_t target = std::max(records_.back().frame - uint64_t(std::min(n, numFrames())),
+                               earliestFrame());
+
+    // start from nearest keyframe at or after target (else newest state)
+    int ind = int(records_.size()) - 1;
+
+    for (int i = 0; i < int(records_.size()); ++i) {
+      if (records_[i].frame >= target && records_[i].keySize) {
+        ind = i;
+        break;
+      }
+    }
+
+    const Record &start = records_[ind];
+
+    if (start.keySize) {
+      const uint64_t *key = &ring_[start.offset + start.deltaSize];
+
+      std::copy(key, key + StateWords, &state_[0]);
+    }
+    else
+      std::copy(&prev_[0], &prev_[0] + StateWords, &state_[0]);
+
+    // step back to target (XOR delta of frame f gives frame f - 1)
+    for ( ; records_[ind].frame > target; --ind)
+      decode(&ring_[records_[ind].offset], records_[ind].deltaSize, &state_[0]);
+
+    if (! chip.loadState(&state_[0], StateWords*8))
+      return false;
+
+    //---
+
+    // discard later frames (target frame stays the newest, as it was captured)
+    while (records_.back().frame > target)
+      records_.pop_back();
+
+    const Record &last = records_.back();
+
+    head_  = last.offset + last.size;
+    frame_ = target + 1;
+
+    std::swap(prev_, state_);
+
+    return true;
+  }
+
+ private:
+  static constexpr size_t StateWords = (CChip8::stateSize() + 7)/8;
+
+  struct Record {
+    uint64_t frame     { 0 };
+    size_t   offset    { 0 }; // in ring (words)
+    uint32_t size      { 0 }; // words (delta then keyframe)
+    uint32_t deltaSize { 0 }; // words (0 for first frame after clear)
+    uint32_t keySize   { 0 }; // words (0 if not a keyframe)
+  };
+
+  // oldest frame which can be restored
+  uint64_t earliestFrame() const { return records_.front().frame; }
+
+  // reserve space for n words at head (dropping oldest records over it)
+  size_t allocate(size_t n) {
+    assert(n <= ring_.size());
+
+    // wrap to start (dropping records in unused tail)
+    if (head_ + n > ring_.size()) {
+      while (! records_.empty() && records_.front().offset >= head_)
+        records_.pop_front();
+
+      head_ = 0;
+    }
+
+    while (! records_.empty() &&
+           records_.front().offset < head_ + n &&
+           records_.front().offset + records_.front().size > head_)
+      records_.pop_front();
+
+    size_t offset = head_;
+
+    head_ += n;
+
+    return offset;
+  }
+
+  // run length encode words: header word (zero words to skip << 32 | literal
+  // words) followed by the literal words. Returns encoded words (at least 1).
+  static size_t encode(const uint64_t *data, uint64_t *out) {
+    size_t o = 0;
+    size_t i = 0;
+
+    while (i < StateWords) {
+      size_t i1 = i;
+
+      while (i < StateWords && data[i] == 0)
+        ++i;
+
+      size_t i2 = i;
+
+      while (i < StateWords && data[i] != 0)
+        ++i;
+
+      if (i == i2)
+        break; // trailing zeros
+
+      out[o++] = (uint64_t(i2 - i1) << 32) | uint64_t(i - i2);
+
+      for (size_t j = i2; j < i; ++j)
+        out[o++] = data[j];
+    }
+
+    // unchanged state still has a (no op) header so every frame uses space
+    if (o == 0)
+      out[o++] = 0;
+
+    return o;
+  }
+
+  // XOR encoded delta into state
+  static void decode(const uint64_t *in, size_t n, uint64_t *state) {
+    size_t i = 0;
+
+    for (size_t o = 0; o < n; ) {
+      uint64_t header = in[o++];
+
+      i += size_t(header >> 32);
+
+      size_t nl = size_t(header & 0xFFFFFFFF);
+
+      for (size_t j = 0; j < nl; ++j)
+        state[i++] ^= in[o++];
+    }
+  }
+
+ private:
+  using Words = std::vector<uint64_t>;
+
+  int                keyInterval_ { 60 };
+  Words              ring_;
+  size_t             head_        { 0 }; // next write offset (words)
+  std::deque<Record> records_;           // oldest first
+  uint64_t           frame_       { 0 }; // number of next captured frame
+  bool               hasPrev_     { false };
+  Words              prev_        = Words(StateWords); // newest captured state
+  Words              state_       = Words(StateWords); // work state
+  Words              delta_       = Words(StateWords + StateWords/2 + 1);
+  Stats              stats_;
+};
+
+#endif
@@ -0,0 +1,706 @@
+#ifndef CChip8RomDb_H
+#define CChip8RomDb_H
+
+#include <CChip8.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#ifdef CCHIP8_MMAP
+#include <dirent.h>
+#include <strings.h>
+#endif
+
+// Database of per rom settings (super mode, quirks and instructions per
+// frame) keyed by the XXH64 hash of the rom bytes.
+//
+// Settings are given in a profile file (chip8db.txt) in each rom directory,
+// one rom per line as its file name (in the directory) or hash (16 hex digits)
+// then options:
+//   # comment
+//   pong.ch8  ipf 12
+//   blitz.ch8 shift_vy load_store_i
+//   c0ffee00c0ffee00 super
+// Options are super, shift_vy (CChip8::QuirkShiftVY), load_store_i
+// (CChip8::QuirkLoadStoreI) and ipf <n>.
+//
+// The directories are compiled to an index file which is memory mapped and
+// looked up by hash in O(1) (open addressing table of fixed size records).
+// update() checks the directories, profile files and roms (times and sizes)
+// against those recorded in the index and only rebuilds it if something
+// changed, reusing the recorded hashes of unchanged roms.
+//
+// Index format (host byte order):
+//   Header, Slot[numSlots], DirRec[numDirs], FileRec[numFiles], strings
+class CChip8RomDb {
+ public:
+  static const uint32_t Magic   = 0x42443843; // "C8DB"
+  static const uint16_t Version = 1;
+
+  // settings for a rom
+  struct Profile {
+    uint64_t hash   { 0 };
+    bool     super  { false };
+    uint     quirks { 0 };
+    int      ipf    { 0 };     // instructions per frame (0 for default)
+
+    void apply(CChip8 &chip) const {
+      chip.setSuper(super);
+
+      chip.setQuirks(quirks);
+
+      if (ipf > 0)
+        chip.setCyclesPerFrame(ipf);
+    }
+  };
+
+ public:
+  CChip8RomDb() { }
+
+ ~CChip8RomDb() { close(); }
+
+  CChip8RomDb(const CChip8RomDb &) = delete;
+  CChip8RomDb &operator=(const CChip8RomDb &) = delete;
+
+  // name of profile file in rom directory
+  static const char *profileFileName() { return "chip8db.txt"; }
+
+  // XXH64 hash of data
+  static uint64_t hash(const uchar *data, size_t len, uint64_t seed=0) {
+    const uchar *p   = data;
+    const uchar *end = data + len;
+
+    uint64_t h;
+
+    if (len >= 32) {
+      uint64_t v1 = seed + Prime1 + Prime2;
+      uint64_t v2 = seed + Prime2;
+      uint64_t v3 = seed;
+      uint64_t v4 = seed - Prime1;
+
+      for ( ; p + 32 <= end; p += 32) {
+        v1 = hashRound(v1, read64(p     ));
+        v2 = hashRound(v2, read64(p +  8));
+        v3 = hashRound(v3, read64(p + 16));
+        v4 = hashRound(v4, read64(p + 24));
+      }
+
+      h = rotl(v1, 1) + rotl(v2, 7) + rotl(v3, 12) + rotl(v4, 18);
+
+      h = mergeRound(h, v1);
+      h = mergeRound(h, v2);
+      h = mergeRound(h, v3);
+      h = mergeRound(h, v4);
+    }
+    else
+      h = seed + Prime5;
+
+    h += uint64_t(len);
+
+    for ( ; p + 8 <= end; p += 8) {
+      h ^= hashRound(0, read64(p));
+      h  = rotl(h, 27)*Prime1 + Prime4;
+    }
+
+    if (p + 4 <= end) {
+      h ^= uint64_t(read32(p))*Prime1;
+      h  = rotl(h, 23)*Prime2 + Prime3;
+      p += 4;
+    }
+
+    for ( ; p < end; ++p) {
+      h ^= (*p)*Prime5;
+      h  = rotl(h, 11)*Prime1;
+    }
+
+    h ^= h >> 33; h *= Prime2;
+    h ^= h >> 29; h *= Prime3;
+    h ^= h >> 32;
+
+    return h;
+  }
+
+  //---
+
+  bool isOpen() const { return header_ != nullptr; }
+
+  // map existing index (false if missing or invalid)
+  bool open(const std::string &filename) {
+    close();
+
+    FILE *fp = fopen(filename.c_str(), "rb");
+
+    if (! fp)
+      return setError("can't open index '" + filename + "'");
+
+    fseek(fp, 0, SEEK_END);
+
+    long size = ftell(fp);
+
+    fseek(fp, 0, SEEK_SET);
+
+    bool rc = (size >= long(sizeof(Header)));
+
+    if (rc) {
+#ifdef CCHIP8_MMAP
+      void *p = mmap(nullptr, size_t(size), PROT_READ, MAP_PRIVATE, fileno(fp), 0);
+
+      if (p != MAP_FAILED) {
+        map_  = p;
+        size_ = size_t(size);
+      }
+      else
+        rc = false;
+#else
+      buffer_.resize(size_t(size));
+
+      rc = (fread(&buffer_[0], 1, buffer_.size(), fp) == buffer_.size());
+
+      size_ = buffer_.size();
+#endif
+    }
+
+    fclose(fp);
+
+    if (! rc) {
+      close();
+      return setError("can't read index '" + filename + "'");
+    }
+
+    const uchar *base = data();
+
+    header_ = reinterpret_cast<const Header *>(base);
+
+    // check layout before using offsets
+    const Header &h = *header_;
+
+    size_t size1 = sizeof(Header) + h.numSlots*sizeof(Slot) + h.numDirs*sizeof(DirRec) +
+                   h.numFiles*sizeof(FileRec) + h.stringsSize;
+
+    if (h.magic != Magic || h.version != Version || h.numSlots == 0 ||
+        (h.numSlots & (h.numSlots - 1)) != 0 || size1 != size_ ||
+        (h.stringsSize > 0 && base[size_ - 1] != '\0')) {
+      close();
+      return setError("invalid index '" + filename + "'");
+    }
+
+    slots_   = reinterpret_cast<const Slot    *>(base + sizeof(Header));
+    dirs_    = reinterpret_cast<const DirRec  *>(slots_ + h.numSlots);
+    files_   = reinterpret_cast<const FileRec *>(dirs_  + h.numDirs);
+    strings_ = reinterpret_cast<const char    *>(files_ + h.numFiles);
+
+    return true;
+  }
+
+  void close() {
+#ifdef CCHIP8_MMAP
+    if (map_)
+      munmap(map_, size_);
+#endif
+
+    map_     = nullptr;
+    size_    = 0;
+    header_  = nullptr;
+    slots_   = nullptr;
+    dirs_    = nullptr;
+    files_   = nullptr;
+    strings_ = nullptr;
+
+    buffer_.clear();
+  }
+
+  // bring index up to date with rom directories (rebuilt only if changed)
+  // and map it. Returns false on error (see errorMsg())
+  bool update(const std::string &filename, const std::vector<std::string> &dirs) {
+    rebuilt_   = false;
+    numHashed_ = 0;
+
+#ifdef CCHIP8_MMAP
+    if (open(filename) && isCurrent(dirs))
+      return true;
+
+    errorMsg_.clear(); // missing or stale index is rebuilt
+
+    Index index;
+
+    if (! scanDirs(dirs, index))
+      return false;
+
+    if (! writeIndex(filename, index))
+      return false;
+
+    rebuilt_ = true;
+
+    return open(filename);
+#else
+    (void) dirs;
+
+    return open(filename);
+#endif
+  }
+
+  // true if last update() rebuilt index
+  bool isRebuilt() const { return rebuilt_; }
+
+  // roms read and hashed by last update() (others reused recorded hash)
+  int numHashed() const { return numHashed_; }
+
+  int numProfiles() const { return (header_ ? int(header_->numProfiles) : 0); }
+  int numFiles   () const { return (header_ ? int(header_->numFiles   ) : 0); }
+
+  const std::string &errorMsg() const { return errorMsg_; }
+
+  //---
+
+  // profile for rom hash (false if none)
+  bool lookup(uint64_t hash, Profile &profile) const {
+    if (! header_) return false;
+
+    uint mask = header_->numSlots - 1;
+
+    for (uint i = uint(hash) & mask; slots_[i].flags & SlotUsed; i = (i + 1) & mask) {
+      const Slot &slot = slots_[i];
+
+      if (slot.hash != hash)
+        continue;
+
+      profile.hash   = hash;
+      profile.super  = (slot.flags & SlotSuper);
+      profile.quirks = slot.quirks;
+      profile.ipf    = slot.ipf;
+
+      return true;
+    }
+
+    return false;
+  }
+
+  // profile for rom bytes (false if none)
+  bool lookup(const uchar *rom, size_t len, Profile &profile) const {
+    return lookup(hash(rom, len), profile);
+  }
+
+ private:
+  static const uint64_t Prime1 = 11400714785074694791ULL;
+  static const uint64_t Prime2 = 14029467366897019727ULL;
+  static const uint64_t Prime3 = 1609587929392839161ULL;
+  static const uint64_t Prime4 = 9650029242287828579ULL;
+  static const uint64_t Prime5 = 2870177450012600261ULL;
+
+  enum SlotFlags : uchar {
+    SlotUsed  = 1<<0,
+    SlotSuper = 1<<1
+  };
+
+  struct Header {
+    uint32_t magic       { Magic };
+    uint16_t version     { Version };
+    uint16_t pad         { 0 };
+    uint32_t numSlots    { 0 };     // power of two
+    uint32_t numProfiles { 0 };
+    uint32_t numDirs     { 0 };
+    uint32_t numFiles    { 0 };
+    uint32_t stringsSize { 0 };
+    uint32_t pad1        { 0 };
+  };
+
+  // hash table entry
+  struct Slot {
+    uint64_t hash   { 0 };
+    uint16_t ipf    { 0 };
+    uint8_t  flags  { 0 };
+    uint8_t  quirks { 0 };
+    uint32_t pad    { 0 };
+  };
+
+  // scanned directory (path and times to detect changes)
+  struct DirRec {
+    int64_t  mtime        { 0 };
+    int64_t  profileMtime { 0 }; // 0 if no profile file
+    uint32_t path         { 0 }; // offset in strings
+    uint32_t pad          { 0 };
+  };
+
+  // scanned rom (hash reused while time and size unchanged)
+  struct FileRec {
+    int64_t  mtime { 0 };
+    uint64_t size  { 0 };
+    uint64_t hash  { 0 };
+    uint32_t path  { 0 };
+    uint32_t pad   { 0 };
+  };
+
+  static_assert(sizeof(Header) == 32 && sizeof(Slot) == 16 && sizeof(DirRec) == 24 &&
+                sizeof(FileRec) == 32, "unexpected index record size");
+
+  // index contents being built
+  struct Index {
+    std::vector<DirRec>                   dirs;
+    std::vector<FileRec>                  files;
+    std::string                           strings;
+    std::unordered_map<uint64_t, Profile> profiles;
+  };
+
+  //---
+
+  static uint64_t rotl(uint64_t x, int r) { return (x << r) | (x >> (64 - r)); }
+
+  static uint64_t hashRound(uint64_t acc, uint64_t input) {
+    acc += input*Prime2;
+    acc  = rotl(acc, 31);
+    acc *= Prime1;
+
+    return acc;
+  }
+
+  static uint64_t mergeRound(uint64_t acc, uint64_t val) {
+    acc ^= hashRound(0, val);
+
+    return acc*Prime1 + Prime4;
+  }
+
+  // little endian reads
+  static uint64_t read64(const uchar *p) {
+    uint64_t v; memcpy(&v, p, 8);
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    v = __builtin_bswap64(v);
+#endif
+    return v;
+  }
+
+  static uint32_t read32(const uchar *p) {
+    uint32_t v; memcpy(&v, p, 4);
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    v = __builtin_bswap32(v);
+#endif
+    return v;
+  }
+
+  //---
+
+  const uchar *data() const {
+    return (map_ ? static_cast<const uchar *>(map_) : buffer_.data());
+  }
+
+  const char *str(uint32_t offset) const { return strings_ + offset; }
+
+  bool setError(const std::string &msg) {
+    errorMsg_ = msg;
+
+    return false;
+  }
+
+#ifdef CCHIP8_MMAP
+  // modification time in ns (0 if missing)
+  static int64_t fileTime(const std::string &path, struct stat *st=nullptr) {
+    struct stat st1;
+
+    if (! st) st = &st1;
+
+    if (stat(path.c_str(), st) != 0)
+      return 0;
+
+#if defined(__APPLE__)
+    return int64_t(st->st_mtimespec.tv_sec)*1000000000 + st->st_mtimespec.tv_nsec;
+#else
+    return int64_t(st->st_mtim.tv_sec)*1000000000 + st->st_mtim.tv_nsec;
+#endif
+  }
+
+  static bool isRomFile(const char *name) {
+    const char *dot = strrchr(name, '.');
+    if (! dot) return false;
+
+    return (strcasecmp(dot, ".ch8") == 0 || strcasecmp(dot, ".c8" ) == 0 ||
+            strcasecmp(dot, ".sc8") == 0);
+  }
+
+  // true if mapped index was built from same directories, profile files
+  // and roms (times and sizes unchanged)
+  bool isCurrent(const std::vector<std::string> &dirs) const {
+    if (header_->numDirs != dirs.size())
+      return false;
+
+    for (uint i = 0; i < header_->numDirs; ++i) {
+      const DirRec &dir = dirs_[i];
+
+      if (dirs[i] != str(dir.path) || fileTime(dirs[i]) != dir.mtime ||
+          fileTime(dirs[i] + "/" + profileFileName()) != dir.profileMtime)
+        return false;
+    }
+
+    for (uint i = 0; i < header_->numFiles; ++i) {
+      const FileRec &file = files_[i];
+
+      struct stat st;
+
+      if (fileTime(str(file.path), &st) != file.mtime || uint64_t(st.st_size) != file.size)
+        return false;
+    }
+
+    return true;
+  }
+
+  // scan rom directories and their profile files
+  bool scanDirs(const std::vector<std::string> &dirs, Index &index) {
+    // recorded hashes of old index
+    std::unordered_map<std::string, const FileRec *> oldFiles;
+
+    if (header_) {
+      for (uint i = 0; i < header_->numFiles; ++i)
+        oldFiles[str(files_[i].path)] = &files_[i];
+    }
+
+    auto addString = [&](const std::string &s) {
+      uint32_t offset = uint32_t(index.strings.size());
+
+      index.strings.append(s.c_str(), s.size() + 1);
+
+      return offset;
+    };
+
+    for (const auto &dirName : dirs) {
+      DirRec dir;
+
+      struct stat st;
+
+      dir.mtime        = fileTime(dirName, &st);
+      dir.profileMtime = fileTime(dirName + "/" + profileFileName());
+      dir.path         = addString(dirName);
+
+      if (dir.mtime == 0 || ! S_ISDIR(st.st_mode))
+        return setError("'" + dirName + "' is not a directory");
+
+      index.dirs.push_back(dir);
+
+      //---
+
+      // roms (sorted so index is the same for the same files)
+      std::vector<std::string> names;
+
+      DIR *dp = opendir(dirName.c_str());
+
+      if (! dp)
+        return setError("can't read directory '" + dirName + "'");
+
+      while (struct dirent *entry = readdir(dp)) {
+        if (isRomFile(entry->d_name))
+          names.push_back(entry->d_name);
+      }
+
+      closedir(dp);
+
+      std::sort(names.begin(), names.end());
+
+      std::unordered_map<std::string, uint64_t> nameHashes;
+
+      for (const auto &name : names) {
+        std::string path = dirName + "/" + name;
+
+        FileRec file;
+
+        file.mtime = fileTime(path, &st);
+
+        if (file.mtime == 0 || ! S_ISREG(st.st_mode))
+          continue;
+
+        file.size = uint64_t(st.st_size);
+
+        auto p = oldFiles.find(path);
+
+        if (p != oldFiles.end() && (*p).second->mtime == file.mtime &&
+            (*p).second->size == file.size) {
+          file.hash = (*p).second->hash;
+        }
+        else {
+          // unreadable or not a rom size file is skipped
+          CChip8::RomFile rom;
+
+          if (rom.open(path.c_str()) != CChip8::LoadError::NONE)
+            continue;
+
+          file.hash = hash(rom.data(), rom.size());
+
+          ++numHashed_;
+        }
+
+        file.path = addString(path);
+
+        index.files.push_back(file);
+
+        nameHashes[name] = file.hash;
+      }
+
+      //---
+
+      if (dir.profileMtime != 0 && ! readProfiles(dirName, nameHashes, index))
+        return false;
+    }
+
+    return true;
+  }
+
+  // read profile file of directory (later entries for same rom replace earlier)
+  bool readProfiles(const std::string &dirName,
+                    const std::unordered_map<std::string, uint64_t> &nameHashes,
+                    Index &index) {
+    std::string filename = dirName + "/" + profileFileName();
+
+    FILE *fp = fopen(filename.c_str(), "r");
+
+    if (! fp)
+      return setError("can't read '" + filename + "'");
+
+    char line[512];
+    int  lineNum = 0;
+
+    bool rc = true;
+
+    while (rc && fgets(line, sizeof(line), fp)) {
+      ++lineNum;
+
+      if (char *p = strchr(line, '#'))
+        *p = '\0';
+
+      std::vector<std::string> words;
+
+      for (char *w = strtok(line, " \t\r\n"); w; w = strtok(nullptr, " \t\r\n"))
+        words.push_back(w);
+
+      if (words.empty())
+        continue;
+
+      auto error = [&](const std::string &msg) {
+        rc = setError(filename + ":" + std::to_string(lineNum) + ": " + msg);
+      };
+
+      // rom file name or hash
+      Profile profile;
+
+      auto p = nameHashes.find(words[0]);
+
+      if (p != nameHashes.end())
+        profile.hash = (*p).second;
+      else if (words[0].size() == 16 && words[0].find_first_not_of(
+                 "0123456789abcdefABCDEF") == std::string::npos)
+        profile.hash = strtoull(words[0].c_str(), nullptr, 16);
+      else
+        continue; // rom not in directory
+
+      for (size_t i = 1; rc && i < words.size(); ++i) {
+        const std::string &word = words[i];
+
+        if      (word == "super")
+          profile.super = true;
+        else if (word == "shift_vy")
+          profile.quirks |= CChip8::QuirkShiftVY;
+        else if (word == "load_store_i")
+          profile.quirks |= CChip8::QuirkLoadStoreI;
+        else if (word == "ipf" && i + 1 < words.size()) {
+          profile.ipf = atoi(words[++i].c_str());
+
+          if (profile.ipf <= 0 || profile.ipf > 0xFFFF)
+            error("bad ipf '" + words[i] + "'");
+        }
+        else
+          error("unknown option '" + word + "'");
+      }
+
+      index.profiles[profile.hash] = profile;
+    }
+
+    fclose(fp);
+
+    return rc;
+  }
+
+  // write index to temporary file and rename over old (so readers with the
+  // old index mapped are unaffected)
+  bool writeIndex(const std::string &filename, const Index &index) {
+    Header header;
+
+    header.numSlots = 16;
+
+    while (header.numSlots < 2*index.profiles.size())
+      header.numSlots *= 2;
+
+    header.numProfiles = uint32_t(index.profiles.size());
+    header.numDirs     = uint32_t(index.dirs .size());
+    header.numFiles    = uint32_t(index.files.size());
+    header.stringsSize = uint32_t(index.strings.size());
+
+    std::vector<Slot> table(header.numSlots);
+
+    uint mask = header.numSlots - 1;
+
+    for (const auto &pp : index.profiles) {
+      const Profile &profile = pp.second;
+
+      uint i = uint(profile.hash) & mask;
+
+      while (table[i].flags & SlotUsed)
+        i = (i + 1) & mask;
+
+      Slot &slot = table[i];
+
+      slot.hash   = profile.hash;
+      slot.ipf    = uint16_t(profile.ipf);
+      slot.flags  = uchar(SlotUsed | (profile.super ? SlotSuper : 0));
+      slot.quirks = uint8_t(profile.quirks);
+    }
+
+    //---
+
+    std::string tmpName = filename + ".tmp";
+
+    FILE *fp = fopen(tmpName.c_str(), "wb");
+
+    if (! fp)
+      return setError("can't write index '" + tmpName + "'");
+
+    fwrite(&header, sizeof(header), 1, fp);
+
+    fwrite(table.data(), sizeof(Slot), table.size(), fp);
+
+    if (! index.dirs.empty())
+      fwrite(index.dirs.data(), sizeof(DirRec), index.dirs.size(), fp);
+
+    if (! index.files.empty())
+      fwrite(index.files.data(), sizeof(FileRec), index.files.size(), fp);
+
+    fwrite(index.strings.data(), 1, index.strings.size(), fp);
+
+    bool rc = (ferror(fp) == 0);
+
+    if (fclose(fp) != 0)
+      rc = false;
+
+    if (! rc || rename(tmpName.c_str(), filename.c_str()) != 0) {
+      remove(tmpName.c_str());
+      return setError("can't write index '" + filename + "'");
+    }
+
+    return true;
+  }
+#endif
+
+ private:
+  void*              map_       { nullptr };
+  size_t             size_      { 0 };
+  std::vector<uchar> buffer_;                 // index read (no mapping)
+  const Header*      header_    { nullptr };
+  const Slot*        slots_     { nullptr };
+  const DirRec*      dirs_      { nullptr };
+  const FileRec*     files_     { nullptr };
+  const char*        strings_   { nullptr };
+  bool               rebuilt_   { false };
+  int                numHashed_ { 0 };
+  std::string        errorMsg_;
+};
+
+#endif
@@ -0,0 +1,557 @@
+#include <CChip8.h>
+#include <CChip8Jit.h>
+#include <CChip8Scheduler.h>
+#include <CChip8Movie.h>
+#include <CChip8Profile.h>
+#include <CChip8Analyze.h>
+#include <CChip8RomDb.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cinttypes>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace {
+
+void usage() {
+  fprintf(stderr,
+    "Usage: CChip8Run [options] <rom>|-load <state>\n"
+    "\n"
+    "  -s               super chip mode\n"
+    "  -quirks <n>      quirk flags (1 shift VY, 2 load/store increments I)\n"
+    "  -frames <n>      run n frames (default 600)\n"
+    "  -cycles <n>      run n cycles (instructions) instead of frames\n"
+    "  -ipf <n>         instructions per frame (default 9)\n"
+    "  -ips <n>         pace to n instructions per second at 60 frames per second\n"
+    "                   (default uncapped at -ipf per frame)\n"
+    "  -catchup <n>     most late frames run after a stall when paced (default 4)\n"
+    "  -engine <name>   step, decoded, block or jit (default decoded)\n"
+    "  -seed <n>        seed RND (reproducible run, default random)\n"
+    "  -romdb <file>    rom database index (super, quirks and ipf of known roms,\n"
+    "                   overridden by -s, -quirks and -ipf)\n"
+    "  -romdir <dir>    rom directory of database (repeatable, index rebuilt\n"
+    "                   when roms or their profile files change)\n"
+    "  -load <file>     continue from saved state (rom not needed)\n"
+    "  -save <file>     save state at end of run\n"
+    "  -play <file>     replay input movie (unpaced, to end of recording)\n"
+    "  -stats <file>    write execution counts as JSON (- for stdout, needs\n"
+    "                   CCHIP8_STATS build)\n"
+    "  -profile <file>  sample PC and write call stacks in folded format\n"
+    "                   (for flamegraph tools, - for stdout) and print hot spots\n"
+    "  -interval <n>    mean instructions between profile samples (default 256)\n"
+    "  -labels <file>   profile labels (\"<hex addr> <name>\" per line)\n"
+    "  -leaf            add leaf instruction address to profile stacks\n"
+    "  -list            print analyzed listing of rom (code and data) and exit\n"
+    "  -screen          print final screen\n");
+}
+
+const char *stopReasonName(CChip8::StopReason reason) {
+  switch (reason) {
+    case CChip8::StopReason::BUDGET    : return "budget";
+    case CChip8::StopReason::FRAME     : return "frame";
+    case CChip8::StopReason::WAIT_KEY  : return "wait_key";
+    case CChip8::StopReason::HALT      : return "halt";
+    case CChip8::StopReason::EXIT      : return "exit";
+    case CChip8::StopReason::BREAKPOINT: return "breakpoint";
+    case CChip8::StopReason::FAULT     : return "fault";
+    default                            : return "";
+  }
+}
+
+bool loadState(CChip8 &chip, const char *filename) {
+  FILE *fp = fopen(filename, "rb");
+  if (! fp) return false;
+
+  std::vector<uint64_t> buffer((CChip8::stateSize() + 7)/8);
+
+  size_t n = fread(&buffer[0], 1, CChip8::stateSize(), fp);
+
+  fclose(fp);
+
+  return chip.loadState(&buffer[0], n);
+}
+
+bool saveState(const CChip8 &chip, const char *filename) {
+  std::vector<uint64_t> buffer((CChip8::stateSize() + 7)/8);
+
+  size_t n = chip.saveState(&buffer[0], CChip8::stateSize());
+
+  FILE *fp = fopen(filename, "wb");
+  if (! fp) return false;
+
+  bool rc = (fwrite(&buffer[0], 1, n, fp) == n);
+
+  fclose(fp);
+
+  return rc;
+}
+
+// write execution counts (see CChip8::Stats) as JSON
+bool writeStats(const CChip8 &chip, const char *filename) {
+  FILE *fp = (strcmp(filename, "-") == 0 ? stdout : fopen(filename, "w"));
+  if (! fp) return false;
+
+  const auto &stats = chip.stats();
+
+  fprintf(fp, "{\n");
+  fprintf(fp, "  \"cycles\": %" PRIu64 ",\n", chip.cycles());
+  fprintf(fp, "  \"instructions\": %" PRIu64 ",\n", stats.instructions());
+
+  fprintf(fp, "  \"ops\": {");
+
+  bool first = true;
+
+  for (int i = 0; i < int(CChip8::OpCode::NUM_OPS); ++i) {
+    if (! stats.ops[i]) continue;
+
+    fprintf(fp, "%s\n    \"%s\": %" PRIu64, (first ? "" : ","),
+            CChip8::opCodeName(CChip8::OpCode(i)), stats.ops[i]);
+
+    first = false;
+  }
+
+  fprintf(fp, "\n  },\n");
+
+  fprintf(fp, "  \"draws\": [");
+
+  for (int i = 0; i < 16; ++i)
+    fprintf(fp, "%s%" PRIu64, (i > 0 ? ", " : ""), stats.draws[i]);
+
+  fprintf(fp, "],\n");
+
+  fprintf(fp, "  \"rows_drawn\": %" PRIu64 ",\n", stats.rowsDrawn());
+  fprintf(fp, "  \"collisions\": %" PRIu64 ",\n", stats.collisions);
+  fprintf(fp, "  \"skips\": %" PRIu64 ",\n", stats.skips);
+  fprintf(fp, "  \"skips_taken\": %" PRIu64 ",\n", stats.skipsTaken);
+  fprintf(fp, "  \"skip_ratio\": %.6f,\n", stats.skipRatio());
+  fprintf(fp, "  \"wait_key_cycles\": %" PRIu64 ",\n", stats.waitKeyCycles);
+  fprintf(fp, "  \"wait_key_ratio\": %.6f\n", stats.waitKeyRatio());
+  fprintf(fp, "}\n");
+
+  bool rc = (ferror(fp) == 0);
+
+  if (fp != stdout)
+    fclose(fp);
+
+  return rc;
+}
+
+void printState(CChip8 &chip) {
+  printf("PC %03X  I %03X  SP %X  DT %02X  ST %02X\n",
+         chip.PC(), chip.I(), chip.SP(), chip.DT(), chip.ST());
+
+  for (int i = 0; i < 16; ++i)
+    printf("V%X %02X%s", i, chip.V(i), (i % 8 == 7 ? "\n" : "  "));
+}
+
+void printScreen(CChip8 &chip) {
+  int sw = chip.screenWidth ();
+  int sh = chip.screenHeight();
+
+  for (int y = 0; y < sh; ++y) {
+    for (int x = 0; x < sw; ++x)
+      fputc(chip.screen(y*sw + x) ? '#' : '.', stdout);
+
+    fputc('\n', stdout);
+  }
+}
+
+}
+
+int
+main(int argc, char **argv)
+{
+  const char *filename   = nullptr;
+  bool        super      = false;
+  long        frames     = 600;
+  long        cycles     = 0;
+  int         ipf        = 0;
+  int         quirks     = -1;
+  double      ips        = 0.0;
+  int         catchUp    = 4;
+  bool        hasSeed    = false;
+  uint64_t    seed       = 0;
+  std::string engine     = "decoded";
+  bool        showScreen = false;
+  const char *loadFile   = nullptr;
+  const char *saveFile   = nullptr;
+  const char *movieFile  = nullptr;
+  const char *statsFile  = nullptr;
+  const char *profFile   = nullptr;
+  const char *labelsFile = nullptr;
+  int         interval   = 256;
+  bool        leafAddr   = false;
+  bool        list       = false;
+  const char *romDbFile  = nullptr;
+
+  std::vector<std::string> romDirs;
+
+  for (int i = 1; i < argc; ++i) {
+    if (argv[i][0] == '-') {
+      std::string arg = &argv[i][1];
+
+      bool hasValue = (i < argc - 1);
+
+      if      (arg == "s")
+        super = true;
+      else if (arg == "frames" && hasValue)
+        frames = atol(argv[++i]);
+      else if (arg == "cycles" && hasValue)
+        cycles = atol(argv[++i]);
+      else if (arg == "quirks" && hasValue)
+        quirks = int(strtoul(argv[++i], nullptr, 0));
+      else if (arg == "ipf" && hasValue)
+        ipf = atoi(argv[++i]);
+      else if (arg == "ips" && hasValue)
+        ips = atof(argv[++i]);
+      else if (arg == "catchup" && hasValue)
+        catchUp = atoi(argv[++i]);
+      else if (arg == "engine" && hasValue)
+        engine = argv[++i];
+      else if (arg == "seed" && hasValue) {
+        hasSeed = true;
+        seed    = strtoull(argv[++i], nullptr, 0);
+      }
+      else if (arg == "romdb" && hasValue)
+        romDbFile = argv[++i];
+      else if (arg == "romdir" && hasValue)
+        romDirs.push_back(argv[++i]);
+      else if (arg == "load" && hasValue)
+        loadFile = argv[++i];
+      else if (arg == "save" && hasValue)
+        saveFile = argv[++i];
+      else if (arg == "play" && hasValue)
+        movieFile = argv[++i];
+      else if (arg == "stats" && hasValue)
+        statsFile = argv[++i];
+      else if (arg == "profile" && hasValue)
+        profFile = argv[++i];
+      else if (arg == "interval" && hasValue)
+        interval = atoi(argv[++i]);
+      else if (arg == "labels" && hasValue)
+        labelsFile = argv[++i];
+      else if (arg == "leaf")
+        leafAddr = true;
+      else if (arg == "list")
+        list = true;
+      else if (arg == "screen")
+        showScreen = true;
+      else {
+        usage();
+        exit(1);
+      }
+    }
+    else {
+      filename = argv[i];
+    }
+  }
+
+  if ((! filename && ! loadFile) || ipf < 0 || (movieFile && ! filename) ||
+      (movieFile && profFile) || interval <= 0 || (! romDirs.empty() && ! romDbFile)) {
+    usage();
+    exit(1);
+  }
+
+  //---
+
+  // rom database (index rebuilt if rom directories changed)
+  CChip8RomDb romDb;
+
+  if (romDbFile) {
+    bool rc = (romDirs.empty() ? romDb.open(romDbFile) : romDb.update(romDbFile, romDirs));
+
+    if (! rc) {
+      fprintf(stderr, "Failed to load rom database (%s)\n", romDb.errorMsg().c_str());
+      exit(1);
+    }
+  }
+
+  //---
+
+  CChip8 chip;
+
+  chip.reset();
+
+  CChip8RomDb::Profile profile;
+
+  bool hasProfile = false;
+
+  if (filename) {
+    CChip8::RomFile rom;
+
+    CChip8::LoadError error = rom.open(filename);
+
+    if (error == CChip8::LoadError::NONE)
+      error = chip.loadRom(rom.data(), rom.size());
+
+    if (error != CChip8::LoadError::NONE) {
+      fprintf(stderr, "Failed to load '%s' (%s)\n", filename, CChip8::loadErrorMessage(error));
+      exit(1);
+    }
+
+    if (romDbFile)
+      hasProfile = romDb.lookup(rom.data(), rom.size(), profile);
+  }
+
+  // command line settings override rom profile
+  if (hasProfile) {
+    super = (super || profile.super);
+
+    if (quirks < 0) quirks = int(profile.quirks);
+    if (ipf   == 0) ipf    = profile.ipf;
+  }
+
+  if (quirks < 0) quirks = 0;
+  if (ipf   == 0) ipf    = 9;
+
+  chip.setSuper (super);
+  chip.setQuirks(uint(quirks));
+
+  // saved state replaces rom and reset state (cycles count on from save)
+  if (loadFile) {
+    if (! loadState(chip, loadFile)) {
+      fprintf(stderr, "Failed to load state '%s'\n", loadFile);
+      exit(1);
+    }
+
+    filename = loadFile;
+  }
+
+  chip.setCyclesPerFrame(ipf);
+
+  // static analysis of code and data (also names profile blocks)
+  CChip8Analyzer analyzer;
+
+  if (list || profFile)
+    analyzer.analyze(chip);
+
+  if (list) {
+    const auto &blocks = analyzer.blocks();
+
+    analyzer.writeListing(chip, stdout);
+
+    printf("; %d code, %d sprite, %d data bytes, %d blocks, %d functions, %d indirect jumps\n",
+           analyzer.numBytes(CChip8Analyzer::ByteType::CODE),
+           analyzer.numBytes(CChip8Analyzer::ByteType::SPRITE),
+           analyzer.numBytes(CChip8Analyzer::ByteType::DATA),
+           int(blocks.size()), int(analyzer.functions().size()),
+           int(analyzer.indirectJumps().size()));
+
+    return 0;
+  }
+
+  // movie gives seed, mode, quirks and frame sizes (and is run unpaced)
+  CChip8Movie movie;
+
+  std::unique_ptr<CChip8MoviePlayer> player;
+
+  if (movieFile) {
+    if (! movie.load(movieFile)) {
+      fprintf(stderr, "Failed to load movie '%s'\n", movieFile);
+      exit(1);
+    }
+
+    player = std::make_unique<CChip8MoviePlayer>(movie);
+
+    if (! player->start(chip)) {
+      fprintf(stderr, "Movie '%s' recorded with different rom\n", movieFile);
+      exit(1);
+    }
+
+    ips    = 0.0;
+    cycles = long(movie.length());
+  }
+
+  if (hasSeed)
+    chip.setSeed(seed);
+
+  std::unique_ptr<CChip8Jit> jit;
+
+  if      (engine == "step")
+    chip.setEngine(CChip8::Engine::STEP);
+  else if (engine == "decoded")
+    chip.setEngine(CChip8::Engine::DECODED);
+  else if (engine == "block")
+    chip.setEngine(CChip8::Engine::BLOCK);
+  else if (engine == "jit") {
+    chip.setEngine(CChip8::Engine::BLOCK);
+
+    jit = std::make_unique<CChip8Jit>(&chip);
+
+    if (! jit->isEnabled())
+      fprintf(stderr, "JIT not supported, using block engine\n");
+  }
+  else {
+    usage();
+    exit(1);
+  }
+
+  if (statsFile) {
+    if (! CChip8::isStatsSupported()) {
+      fprintf(stderr, "Execution counts not built (define CCHIP8_STATS)\n");
+      exit(1);
+    }
+
+    chip.setStatsEnabled(true);
+  }
+
+  std::unique_ptr<CChip8Profiler> profiler;
+
+  if (profFile) {
+    profiler = std::make_unique<CChip8Profiler>(uint(interval));
+
+    profiler->setLeafAddr(leafAddr);
+
+    if (labelsFile && ! profiler->loadLabels(labelsFile)) {
+      fprintf(stderr, "Failed to load labels '%s'\n", labelsFile);
+      exit(1);
+    }
+
+    // name unlabelled blocks found by analysis
+    for (const auto &pb : analyzer.blocks()) {
+      if (profiler->label(pb.first) == "")
+        profiler->setLabel(pb.first, analyzer.label(pb.first));
+    }
+  }
+
+  //---
+
+  using Clock = std::chrono::steady_clock;
+
+  // pace frames (if any) with ips spread over 60Hz frames
+  CChip8Scheduler scheduler(ips > 0.0 ? ips : 60.0*ipf);
+
+  scheduler.setMaxCatchUp(catchUp);
+
+  auto isDone = [&](long frame) {
+    return (cycles > 0 ? chip.cycles() >= uint64_t(cycles) : frame >= frames);
+  };
+
+  CChip8::StopReason reason = CChip8::StopReason::BUDGET;
+
+  // time spent running frames (excludes pacing)
+  double runTime = 0.0, minFrame = 1E50, maxFrame = 0.0;
+
+  long framesRun = 0;
+
+  bool stopped = false;
+
+  auto t1 = Clock::now();
+
+  scheduler.start();
+
+  while (! stopped && ! isDone(framesRun)) {
+    int n = (ips > 0.0 ? scheduler.waitFrames() : 1);
+
+    for (int i = 0; i < n && ! stopped && ! isDone(framesRun); ++i) {
+      if (ips > 0.0)
+        chip.setCyclesPerFrame(scheduler.frameCycles(uint64_t(framesRun)));
+
+      auto ft1 = Clock::now();
+
+      uint64_t left = (cycles > 0 ? uint64_t(cycles) - chip.cycles() : 0);
+
+      bool partial = (cycles > 0 && left < uint64_t(chip.cyclesPerFrame() - chip.frameCycles()));
+
+      if      (player)
+        reason = player->runFrame(chip);
+      else if (profiler)
+        reason = (partial ? profiler->runCycles(chip, left) : profiler->runUntilFrame(chip));
+      else if (partial)
+        reason = chip.runCycles(left);
+      else
+        reason = chip.runUntilFrame();
+
+      auto ft2 = Clock::now();
+
+      double ft = std::chrono::duration<double>(ft2 - ft1).count();
+
+      runTime += ft;
+
+      minFrame = std::min(minFrame, ft);
+      maxFrame = std::max(maxFrame, ft);
+
+      ++framesRun;
+
+      if (reason != CChip8::StopReason::BUDGET && reason != CChip8::StopReason::FRAME &&
+          (! player || reason != CChip8::StopReason::WAIT_KEY))
+        stopped = true;
+    }
+  }
+
+  auto t2 = Clock::now();
+
+  double secs = std::chrono::duration<double>(t2 - t1).count();
+
+  uint64_t numCycles = chip.cycles();
+
+  //---
+
+  printf("rom      %s\n", filename);
+  printf("engine   %s\n", engine.c_str());
+  if (romDbFile)
+    printf("romdb    %s (super %d quirks %X ipf %d)\n", (hasProfile ? "found" : "not found"),
+           chip.isSuper() ? 1 : 0, chip.quirks(), chip.cyclesPerFrame());
+  printf("stop     %s\n", stopReasonName(reason));
+  printf("cycles   %" PRIu64 "\n", numCycles);
+  printf("frames   %ld\n", framesRun);
+  printf("time     %.6f s\n", secs);
+  printf("ips      %.0f (%.0f running)\n", (secs    > 0.0 ? numCycles/secs    : 0.0),
+                                         (runTime > 0.0 ? numCycles/runTime : 0.0));
+
+  if (framesRun > 0)
+    printf("frame    min %.3f us  max %.3f us  avg %.3f us\n",
+           minFrame*1E6, maxFrame*1E6, runTime*1E6/framesRun);
+
+  if (ips > 0.0) {
+    const auto &stats = scheduler.stats();
+
+    printf("pacing   period %.3f ms  jitter %.3f ms  min %.3f ms  max %.3f ms\n",
+           stats.meanPeriod()*1E3, stats.jitter()*1E3,
+           stats.minPeriod*1E3, stats.maxPeriod*1E3);
+    printf("         late avg %.3f ms  max %.3f ms  catch up %ld  dropped %ld\n",
+           stats.meanLate()*1E3, stats.maxLate*1E3, stats.catchUpFrames, stats.droppedFrames);
+  }
+
+  printf("screen   %dx%d hash %016" PRIx64 "\n",
+         chip.screenWidth(), chip.screenHeight(), chip.screenHash());
+
+  printState(chip);
+
+  if (showScreen)
+    printScreen(chip);
+
+  if (saveFile && ! saveState(chip, saveFile)) {
+    fprintf(stderr, "Failed to save state '%s'\n", saveFile);
+    exit(1);
+  }
+
+  if (profiler) {
+    printf("profile  %" PRIu64 " samples\n", profiler->samples());
+
+    profiler->printHotSpots(chip, stdout);
+
+    FILE *fp = (strcmp(profFile, "-") == 0 ? stdout : fopen(profFile, "w"));
+
+    bool rc = (fp && profiler->writeFolded(fp));
+
+    if (fp && fp != stdout)
+      fclose(fp);
+
+    if (! rc) {
+      fprintf(stderr, "Failed to write profile '%s'\n", profFile);
+      exit(1);
+    }
+  }
+
+  if (statsFile && ! writeStats(chip, statsFile)) {
+    fprintf(stderr, "Failed to write stats '%s'\n", statsFile);
+    exit(1);
+  }
+
+  return 0;
+}
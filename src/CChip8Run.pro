@@ -0,0 +1,36 @@
+TEMPLATE = app
+
+CONFIG -= qt
+CONFIG += console release
+
+TARGET = CChip8Run
+
+DEPENDPATH += .
+
+INCLUDEPATH += . ../include
+
+QMAKE_CXXFLAGS += -std=c++17
+
+DEFINES += CCHIP8_STATS
+
+SOURCES += \
+CChip8Run.cpp \
+
+HEADERS += \
+CChip8.h \
+CChip8Analyze.h \
+CChip8Jit.h \
+CChip8Movie.h \
+CChip8Profile.h \
+CChip8RomDb.h \
+CChip8Scheduler.h \
+
+DESTDIR     = ../bin
+OBJECTS_DIR = ../obj
+LIB_DIR     = ../lib
+
+INCLUDEPATH += \
+. ../include \
+
+unix:LIBS += \
+-L$$LIB_DIR \
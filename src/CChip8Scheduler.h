@@ -0,0 +1,166 @@
+#ifndef CChip8Scheduler_H
+#define CChip8Scheduler_H
+
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <cmath>
+#include <thread>
+#include <cstdint>
+
+// Paces emulation to a fixed frame rate (60Hz) from a monotonic clock.
+//
+// The caller waits for the next due frame(s) with waitFrames() and runs
+// frameCycles(frame) instructions for each, so the instruction rate is exact
+// over time (fractional instructions per frame are spread across frames)
+// and the timers tick exactly once per frame. Frame sizes depend only on the
+// frame number so a run can be repeated exactly (see CChip8Movie). After a
+// stall up to maxCatchUp() late frames are run back to back and any more are
+// dropped.
+class CChip8Scheduler {
+ public:
+  using Clock = std::chrono::steady_clock;
+
+  // frame timing (times in seconds)
+  struct Stats {
+    long   frames        { 0 };   // frames run
+    long   catchUpFrames { 0 };   // frames run late to catch up
+    long   droppedFrames { 0 };   // frames skipped (beyond catch up limit)
+    double minPeriod     { 0.0 }; // time between frame wakeups
+    double maxPeriod     { 0.0 };
+    double sumPeriod     { 0.0 };
+    double sumPeriod2    { 0.0 };
+    long   numPeriods    { 0 };
+    double maxLate       { 0.0 }; // wakeup after deadline
+    double sumLate       { 0.0 };
+
+    double meanPeriod() const { return (numPeriods > 0 ? sumPeriod/numPeriods : 0.0); }
+
+    // standard deviation of period (jitter)
+    double jitter() const {
+      if (numPeriods < 2) return 0.0;
+
+      double mean = meanPeriod();
+
+      return std::sqrt(std::max(sumPeriod2/numPeriods - mean*mean, 0.0));
+    }
+
+    double meanLate() const { return (numPeriods > 0 ? sumLate/numPeriods : 0.0); }
+  };
+
+ public:
+  CChip8Scheduler(double ips=540.0, double frameRate=60.0) {
+    setFrameRate(frameRate);
+    setIPS(ips);
+  }
+
+  // frames per second
+  double frameRate() const { return frameRate_; }
+
+  void setFrameRate(double r) {
+    assert(r > 0.0);
+
+    frameRate_   = r;
+    framePeriod_ = std::chrono::duration_cast<Clock::duration>(
+                     std::chrono::duration<double>(1.0/r));
+
+    setIPS(ips_);
+  }
+
+  // instructions per second
+  double ips() const { return ips_; }
+
+  void setIPS(double ips) {
+    assert(ips > 0.0);
+
+    ips_ = ips;
+
+    // at least one instruction per frame
+    cyclesStep_ = std::max(ips_/frameRate_, 1.0);
+  }
+
+  // most late frames run back to back after a stall
+  int maxCatchUp() const { return maxCatchUp_; }
+  void setMaxCatchUp(int n) { maxCatchUp_ = std::max(n, 1); }
+
+  //---
+
+  // restart schedule (first frame due now)
+  void start() {
+    deadline_ = Clock::now();
+    lastWake_ = Clock::time_point();
+    stats_    = Stats();
+  }
+
+  // sleep until next frame is due and return number of frames to run
+  int waitFrames() {
+    std::this_thread::sleep_until(deadline_);
+
+    auto now = Clock::now();
+
+    //---
+
+    // update stats
+    if (lastWake_ != Clock::time_point()) {
+      double period = std::chrono::duration<double>(now - lastWake_).count();
+
+      if (stats_.numPeriods == 0) {
+        stats_.minPeriod = period;
+        stats_.maxPeriod = period;
+      }
+      else {
+        stats_.minPeriod = std::min(stats_.minPeriod, period);
+        stats_.maxPeriod = std::max(stats_.maxPeriod, period);
+      }
+
+      stats_.sumPeriod  += period;
+      stats_.sumPeriod2 += period*period;
+
+      double late = std::chrono::duration<double>(now - deadline_).count();
+
+      stats_.maxLate  = std::max(stats_.maxLate, late);
+      stats_.sumLate += late;
+
+      ++stats_.numPeriods;
+    }
+
+    lastWake_ = now;
+
+    //---
+
+    // frames due (this one and any missed)
+    long due = long((now - deadline_)/framePeriod_) + 1;
+
+    long n = std::min(due, long(maxCatchUp_));
+
+    stats_.frames        += n;
+    stats_.catchUpFrames += n - 1;
+    stats_.droppedFrames += due - n;
+
+    deadline_ += due*framePeriod_;
+
+    return int(n);
+  }
+
+  // instructions to run in given frame (0 is first), fractions carried to later
+  // frames (small bias so exact rates don't lose one to rounding)
+  int frameCycles(uint64_t frame) const {
+    auto cyclesBefore = [&](uint64_t f) { return uint64_t(double(f)*cyclesStep_ + 1E-6); };
+
+    return int(cyclesBefore(frame + 1) - cyclesBefore(frame));
+  }
+
+  const Stats &stats() const { return stats_; }
+
+ private:
+  double            ips_         { 540.0 };
+  double            frameRate_   { 60.0 };
+  Clock::duration   framePeriod_ { };
+  int               maxCatchUp_  { 4 };
+  Clock::time_point deadline_;
+  Clock::time_point lastWake_;
+  double            cyclesStep_  { 1.0 }; // instructions per frame
+  Stats             stats_;
+};
+
+#endif
@@ -0,0 +1,718 @@
+#include <CChip8.h>
+#include <CChip8Jit.h>
+#include <CChip8Asm.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// Benchmark suite: generated ROMs which each stress one path of the core
+// (run with every engine) and microbenchmarks of the core functions.
+//
+// Each benchmark is run for a number of discarded warmup samples and then
+// repeated, each sample timing a fixed amount of work. Results are reported
+// in ns per operation (instruction, draw, scroll, ...) as the median, 99th
+// percentile, min and mean of the samples, optionally written as JSON.
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+//---
+
+// generated test ROM
+struct Rom {
+  const char*        name  { "" };
+  bool               super { false };
+  bool               keys  { false }; // toggle keys between frames
+  std::vector<uchar> data;
+};
+
+std::vector<uchar> romData(const std::vector<ushort> &ops) {
+  std::vector<uchar> data;
+
+  for (auto op : ops) {
+    data.push_back(uchar(op >> 8));
+    data.push_back(uchar(op & 0xFF));
+  }
+
+  return data;
+}
+
+// assemble rom source (regenerated each run, errors are fatal)
+std::vector<uchar> romAsm(const char *name, const char *source) {
+  CChip8Assembler assembler;
+
+  if (! assembler.assemble(source, name)) {
+    for (const auto &error : assembler.errors())
+      fprintf(stderr, "%s\n", error.c_str());
+
+    exit(1);
+  }
+
+  return assembler.rom();
+}
+
+// 8XYn arithmetic loop
+Rom aluRom() {
+  Rom rom;
+
+  rom.name = "alu";
+  rom.data = romAsm("alu", R"(
+        LD V0, 1
+        LD V1, 3
+loop:   ADD V0, V1
+        SUB V1, V0
+        AND V2, V1
+        XOR V3, V0
+        SHR V4, V0
+        SHL V5, V0
+        SUBN V0, V1
+        OR V1, V2
+        AND V2, V3
+        ADD V3, V4
+        LD V6, V5
+        JP loop
+  )");
+
+  return rom;
+}
+
+// DRW loop at moving unaligned positions
+Rom drawRom() {
+  Rom rom;
+
+  rom.name = "draw";
+  rom.data = romAsm("draw", R"(
+        LD I, sprite
+loop:   DRW V0, V1, 5
+        DRW V2, V3, 5
+        ADD V0, 3
+        ADD V1, 5
+        ADD V2, 7
+        ADD V3, 9
+        JP loop
+sprite: DB F0 99 99 F0 3C 00
+  )");
+
+  return rom;
+}
+
+// SCHIP high res draw and scroll (down, right and left)
+Rom scrollRom() {
+  Rom rom;
+
+  rom.name  = "scroll";
+  rom.super = true;
+  rom.data  = romAsm("scroll", R"(
+        HIGH
+        LD I, sprite
+loop:   DRW V0, V1, F
+        SCD 4
+        SCR
+        ADD V0, 9
+        DRW V0, V1, F
+        SCL
+        ADD V1, 3
+        JP loop
+        ORG 220
+sprite: DB FF 81 BD A5 A5 BD 81 FF
+        DB 18 24 42 81 42 24 18 00
+  )");
+
+  return rom;
+}
+
+// FX55/FX65 block moves of all registers
+Rom memRom() {
+  Rom rom;
+
+  rom.name = "mem";
+  rom.data = romAsm("mem", R"(
+loop:   LD I, 300
+        LD [I], VF
+        LD VF, [I]
+        LD I, 320
+        LD VF, [I]
+        LD [I], VF
+        ADD V0, 1
+        JP loop
+  )");
+
+  return rom;
+}
+
+// RND loop
+Rom rndRom() {
+  Rom rom;
+
+  rom.name = "rnd";
+  rom.data = romAsm("rnd", R"(
+loop:   RND V0, FF
+        RND V1, 0F
+        RND V2, F0
+        RND V3, 7F
+        ADD V0, V1
+        JP loop
+  )");
+
+  return rom;
+}
+
+// SKP/SKNP polling of each key (keys changed every frame)
+Rom keyRom() {
+  Rom rom;
+
+  rom.name = "keys";
+  rom.keys = true;
+  rom.data = romAsm("keys", R"(
+        LD V4, 0F
+loop:   SKP V0
+        ADD V2, 1
+        SKNP V0
+        ADD V3, 1
+        ADD V0, 1
+        AND V0, V4
+        JP loop
+  )");
+
+  return rom;
+}
+
+void initChip(CChip8 &chip, const Rom &rom) {
+  chip.setSuper(rom.super);
+
+  chip.reset();
+
+  chip.loadRom(&rom.data[0], rom.data.size());
+
+  chip.setSeed(1);
+}
+
+//---
+
+struct Result {
+  std::string name;
+  std::string unit;
+  long        ops     { 0 }; // operations per sample
+  double      median  { 0.0 };
+  double      p99     { 0.0 };
+  double      min     { 0.0 };
+  double      mean    { 0.0 };
+  bool        ok      { true };
+};
+
+struct Options {
+  int         warmup  { 3 };
+  int         repeats { 20 };
+  double      scale   { 1.0 };    // multiplier for work per sample
+  std::string filter;             // run only names containing this
+  std::string json;               // JSON output file ("-" for stdout)
+  FILE*       log     { stdout }; // table output (stderr if JSON to stdout)
+};
+
+using Sample = std::function<bool()>; // do one sample's work (false on error)
+
+// time warmup and repeated samples of ops operations each
+Result measure(const Options &options, const std::string &name, const std::string &unit,
+               long ops, const Sample &sample) {
+  Result result;
+
+  result.name = name;
+  result.unit = unit;
+  result.ops  = ops;
+
+  for (int i = 0; i < options.warmup; ++i)
+    result.ok = sample() && result.ok;
+
+  std::vector<double> times; // ns per op
+
+  for (int i = 0; i < options.repeats; ++i) {
+    auto t1 = Clock::now();
+
+    result.ok = sample() && result.ok;
+
+    auto t2 = Clock::now();
+
+    times.push_back(std::chrono::duration<double, std::nano>(t2 - t1).count()/ops);
+  }
+
+  std::sort(times.begin(), times.end());
+
+  int n = int(times.size());
+
+  // nearest rank percentile
+  auto percentile = [&](double p) {
+    int i = int(p*n + 0.999999) - 1;
+
+    return times[std::min(std::max(i, 0), n - 1)];
+  };
+
+  result.median = (n & 1 ? times[n/2] : (times[n/2 - 1] + times[n/2])/2.0);
+  result.p99    = percentile(0.99);
+  result.min    = times[0];
+
+  for (auto t : times)
+    result.mean += t;
+
+  result.mean /= n;
+
+  fprintf(options.log, "%-24s %10.2f %10.2f %10.2f %10.2f  %s%s\n",
+          name.c_str(), result.median, result.p99, result.min, result.mean,
+          unit.c_str(), (result.ok ? "" : "  FAILED"));
+
+  fflush(options.log);
+
+  return result;
+}
+
+//---
+
+class Suite {
+ public:
+  Suite(const Options &options) :
+   options_(options) {
+  }
+
+  const std::vector<Result> &results() const { return results_; }
+
+  bool ok() const {
+    for (const auto &result : results_)
+      if (! result.ok) return false;
+
+    return true;
+  }
+
+  void run() {
+    fprintf(options_.log, "%-24s %10s %10s %10s %10s\n", "name", "median", "p99", "min", "mean");
+
+    runCorpus();
+
+    runMicro();
+  }
+
+  bool writeJson(const std::string &filename) const {
+    FILE *fp = (filename == "-" ? stdout : fopen(filename.c_str(), "w"));
+    if (! fp) return false;
+
+    fprintf(fp, "{\n");
+    fprintf(fp, "  \"version\": 1,\n");
+    fprintf(fp, "  \"warmup\": %d,\n", options_.warmup);
+    fprintf(fp, "  \"repeats\": %d,\n", options_.repeats);
+    fprintf(fp, "  \"jit\": %s,\n", CChip8Jit::isSupported() ? "true" : "false");
+    fprintf(fp, "  \"results\": [\n");
+
+    int n = int(results_.size());
+
+    for (int i = 0; i < n; ++i) {
+      const auto &result = results_[i];
+
+      fprintf(fp, "    {\"name\": \"%s\", \"unit\": \"%s\", \"ops\": %ld, "
+                  "\"median\": %.3f, \"p99\": %.3f, \"min\": %.3f, \"mean\": %.3f, "
+                  "\"ok\": %s}%s\n",
+              result.name.c_str(), result.unit.c_str(), result.ops,
+              result.median, result.p99, result.min, result.mean,
+              result.ok ? "true" : "false", (i < n - 1 ? "," : ""));
+    }
+
+    fprintf(fp, "  ]\n");
+    fprintf(fp, "}\n");
+
+    bool rc = (ferror(fp) == 0);
+
+    if (fp != stdout)
+      fclose(fp);
+
+    return rc;
+  }
+
+ private:
+  enum class Engine {
+    STEP,
+    DECODED,
+    BLOCK,
+    JIT
+  };
+
+  static const char *engineName(Engine engine) {
+    switch (engine) {
+      case Engine::STEP   : return "step";
+      case Engine::DECODED: return "decoded";
+      case Engine::BLOCK  : return "block";
+      case Engine::JIT    : return "jit";
+      default             : return "";
+    }
+  }
+
+  bool selected(const std::string &name) const {
+    return (options_.filter == "" || name.find(options_.filter) != std::string::npos);
+  }
+
+  long scaled(long n) const { return std::max(long(n*options_.scale), 1L); }
+
+  void add(const std::string &name, const std::string &unit, long ops, const Sample &sample) {
+    if (selected(name))
+      results_.push_back(measure(options_, name, unit, ops, sample));
+  }
+
+  //---
+
+  // each corpus ROM with each engine (frames of 1000 instructions)
+  void runCorpus() {
+    std::vector<Rom> roms = { aluRom(), drawRom(), scrollRom(), memRom(), rndRom(), keyRom() };
+
+    std::vector<Engine> engines = { Engine::STEP, Engine::DECODED, Engine::BLOCK };
+
+    if (CChip8Jit::isSupported())
+      engines.push_back(Engine::JIT);
+
+    const int  frameCycles = 1000;
+    const long frames      = scaled(200);
+
+    for (const auto &rom : roms) {
+      for (auto engine : engines) {
+        std::string name = std::string("rom/") + rom.name + "/" + engineName(engine);
+
+        if (! selected(name))
+          continue;
+
+        CChip8 chip;
+
+        initChip(chip, rom);
+
+        chip.setCyclesPerFrame(frameCycles);
+
+        std::unique_ptr<CChip8Jit> jit;
+
+        if      (engine == Engine::STEP)
+          chip.setEngine(CChip8::Engine::STEP);
+        else if (engine == Engine::DECODED)
+          chip.setEngine(CChip8::Engine::DECODED);
+        else {
+          chip.setEngine(CChip8::Engine::BLOCK);
+
+          if (engine == Engine::JIT)
+            jit = std::make_unique<CChip8Jit>(&chip);
+        }
+
+        long frame = 0;
+
+        add(name, "ns/inst", frames*frameCycles, [&]() {
+          for (long i = 0; i < frames; ++i, ++frame) {
+            if (rom.keys)
+              chip.setKey(uchar(frame & 0xF), (frame & 0x10) != 0);
+
+            if (chip.runUntilFrame() != CChip8::StopReason::FRAME)
+              return false;
+          }
+
+          return true;
+        });
+      }
+    }
+  }
+
+  //---
+
+  void runMicro() {
+    microStep();
+    microDraw();
+    microScroll();
+    microDisassemble();
+  }
+
+  // step() of ALU loop (and with execution counts enabled if built)
+  void microStep() {
+    for (int stats = 0; stats < 2; ++stats) {
+      if (stats && ! CChip8::isStatsSupported())
+        continue;
+
+      CChip8 chip;
+
+      initChip(chip, aluRom());
+
+      chip.setStatsEnabled(stats);
+
+      long n = scaled(1000000);
+
+      add(stats ? "micro/step/stats" : "micro/step", "ns/inst", n, [&]() {
+        bool rc = true;
+
+        for (long i = 0; rc && i < n; ++i)
+          rc = chip.step();
+
+        return rc;
+      });
+    }
+  }
+
+  // DRW (drawSprite()) of 8 and 15 rows at unaligned positions in each display mode
+  void microDraw() {
+    struct Mode {
+      const char *name;
+      bool        super;
+      bool        highRes;
+    };
+
+    static const Mode modes[] = {
+      { "lores" , false, false },
+      { "super" , true , false },
+      { "hires" , true , true  },
+    };
+
+    for (const auto &mode : modes) {
+      for (int rows : { 8, 15 }) {
+        std::string name = std::string("micro/draw/") + mode.name + "/" + std::to_string(rows);
+
+        if (! selected(name))
+          continue;
+
+        Rom rom;
+
+        rom.super = mode.super;
+        rom.data  = romData({ ushort(0xD010 | rows), 0x0000 });
+
+        for (int i = 0; i < 16; ++i)
+          rom.data.push_back(uchar(0x5A ^ (i*37)));
+
+        CChip8 chip;
+
+        initChip(chip, rom);
+
+        chip.setHighRes(mode.highRes);
+
+        chip.setI(CChip8::MemDataStart + 4);
+
+        long n = scaled(200000);
+
+        uchar x = 0, y = 0;
+
+        add(name, "ns/draw", n, [&]() {
+          for (long i = 0; i < n; ++i) {
+            chip.setV(0, x += 13);
+            chip.setV(1, y += 7);
+
+            chip.setPC(CChip8::MemDataStart);
+
+            chip.stepDecoded();
+          }
+
+          return true;
+        });
+      }
+    }
+  }
+
+  // scrollDown/Left/Right in low and high res
+  void microScroll() {
+    for (int highRes = 0; highRes < 2; ++highRes) {
+      const char *res = (highRes ? "hires" : "lores");
+
+      Rom rom;
+
+      rom.super = true;
+      rom.data  = romData({ 0xD01F, 0x0000 });
+
+      for (int i = 0; i < 15; ++i)
+        rom.data.push_back(uchar(0xA5 ^ (i*29)));
+
+      CChip8 chip;
+
+      initChip(chip, rom);
+
+      chip.setHighRes(highRes);
+
+      chip.setI(CChip8::MemDataStart + 4);
+
+      // non trivial screen contents
+      for (int i = 0; i < 64; ++i) {
+        chip.setV(0, uchar(i*11));
+        chip.setV(1, uchar(i*5));
+
+        chip.setPC(CChip8::MemDataStart);
+
+        chip.stepDecoded();
+      }
+
+      long n = scaled(100000);
+
+      add(std::string("micro/scroll/down/") + res, "ns/scroll", n, [&]() {
+        for (long i = 0; i < n; ++i)
+          chip.scrollDown(uchar(1 + (i & 7)));
+
+        return true;
+      });
+
+      add(std::string("micro/scroll/left/") + res, "ns/scroll", n, [&]() {
+        for (long i = 0; i < n; ++i)
+          chip.scrollLeft(4);
+
+        return true;
+      });
+
+      add(std::string("micro/scroll/right/") + res, "ns/scroll", n, [&]() {
+        for (long i = 0; i < n; ++i)
+          chip.scrollRight(4);
+
+        return true;
+      });
+    }
+  }
+
+  // disassemble() (stream and buffer) of every instruction of the corpus
+  // ROMs, listing of all memory in one pass and assembly
+  void microDisassemble() {
+    Rom rom;
+
+    rom.super = true;
+
+    for (const auto &r : { aluRom(), drawRom(), scrollRom(), memRom(), rndRom(), keyRom() })
+      rom.data.insert(rom.data.end(), r.data.begin(), r.data.end());
+
+    CChip8 chip;
+
+    initChip(chip, rom);
+
+    int numOps = int(rom.data.size()/2);
+
+    long n = scaled(20000)/numOps + 1;
+
+    std::ostringstream os;
+
+    add("micro/disassemble", "ns/inst", n*numOps, [&]() {
+      for (long i = 0; i < n; ++i) {
+        os.str("");
+
+        for (int j = 0; j < numOps; ++j)
+          chip.disassemble(ushort(CChip8::MemDataStart + 2*j), os);
+      }
+
+      return ! os.str().empty();
+    });
+
+    char inst[CChip8::MaxDisasmSize];
+
+    add("micro/disassemble/buffer", "ns/inst", n*numOps, [&]() {
+      size_t len = 0;
+
+      for (long i = 0; i < n; ++i) {
+        for (int j = 0; j < numOps; ++j)
+          len += chip.disassemble(ushort(CChip8::MemDataStart + 2*j), inst);
+      }
+
+      return (len > 0);
+    });
+
+    //---
+
+    std::vector<char> buffer(CChip8::MaxListingSize);
+
+    const int numListOps = (CChip8::MemSize - CChip8::MemDataStart)/2;
+
+    long nl = scaled(20000)/numListOps + 1;
+
+    add("micro/listing", "ns/inst", nl*numListOps, [&]() {
+      size_t len = 0;
+
+      for (long i = 0; i < nl; ++i)
+        len += chip.listing(&buffer[0], buffer.size()).size();
+
+      return (len > 0);
+    });
+
+    // same with stream disassemble() (as listing was made before)
+    add("micro/listing/stream", "ns/inst", nl*numListOps, [&]() {
+      for (long i = 0; i < nl; ++i) {
+        os.str("");
+
+        for (int pc = CChip8::MemDataStart; pc < CChip8::MemSize; pc += 2)
+          chip.disassemble(ushort(pc), os);
+      }
+
+      return ! os.str().empty();
+    });
+
+    //---
+
+    // reassemble listing of all memory
+    std::string text(chip.listing(&buffer[0], buffer.size()));
+
+    CChip8Assembler assembler;
+
+    long na = scaled(5000)/numListOps + 1;
+
+    add("micro/assemble", "ns/inst", na*numListOps, [&]() {
+      bool rc = true;
+
+      for (long i = 0; i < na; ++i)
+        rc = assembler.assemble(text) && rc;
+
+      return rc;
+    });
+
+    // regenerate all corpus ROMs from source
+    long nc = scaled(200) + 1;
+
+    add("micro/assemble/corpus", "ns/rom", nc*6, [&]() {
+      size_t len = 0;
+
+      for (long i = 0; i < nc; ++i) {
+        for (const auto &r : { aluRom(), drawRom(), scrollRom(), memRom(), rndRom(), keyRom() })
+          len += r.data.size();
+      }
+
+      return (len > 0);
+    });
+  }
+
+ private:
+  Options             options_;
+  std::vector<Result> results_;
+};
+
+}
+
+int
+main(int argc, char **argv)
+{
+  Options options;
+
+  for (int i = 1; i < argc; ++i) {
+    if      (argv[i][0] == '-' && argv[i][1] == 'w' && i < argc - 1)
+      options.warmup = std::max(atoi(argv[++i]), 0);
+    else if (argv[i][0] == '-' && argv[i][1] == 'r' && i < argc - 1)
+      options.repeats = std::max(atoi(argv[++i]), 1);
+    else if (argv[i][0] == '-' && argv[i][1] == 'x' && i < argc - 1)
+      options.scale = std::max(atof(argv[++i]), 1E-3);
+    else if (argv[i][0] == '-' && argv[i][1] == 'f' && i < argc - 1)
+      options.filter = argv[++i];
+    else if (argv[i][0] == '-' && argv[i][1] == 'j' && i < argc - 1)
+      options.json = argv[++i];
+    else {
+      fprintf(stderr, "Usage: CChip8Suite [-w <warmup>] [-r <repeats>] [-x <work_scale>] "
+                      "[-f <name_filter>] [-j <json_file>|-]\n");
+      exit(1);
+    }
+  }
+
+  if (options.json == "-")
+    options.log = stderr;
+
+  Suite suite(options);
+
+  suite.run();
+
+  if (options.json != "" && ! suite.writeJson(options.json)) {
+    fprintf(stderr, "Failed to write '%s'\n", options.json.c_str());
+    exit(1);
+  }
+
+  return (suite.ok() ? 0 : 1);
+}
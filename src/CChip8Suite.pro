@@ -0,0 +1,30 @@
+TEMPLATE = app
+
+CONFIG -= qt
+CONFIG += console release thread
+
+TARGET = CChip8Suite
+
+DEPENDPATH += .
+
+INCLUDEPATH += . ../include
+
+QMAKE_CXXFLAGS += -std=c++17
+
+SOURCES += \
+CChip8Suite.cpp \
+
+HEADERS += \
+CChip8.h \
+CChip8Jit.h \
+CChip8Asm.h \
+
+DESTDIR     = ../bin
+OBJECTS_DIR = ../obj
+LIB_DIR     = ../lib
+
+INCLUDEPATH += \
+. ../include \
+
+unix:LIBS += \
+-L$$LIB_DIR \
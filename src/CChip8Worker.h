@@ -0,0 +1,667 @@
+#ifndef CChip8Worker_H
+#define CChip8Worker_H
+
+#include <CChip8.h>
+#include <CChip8Scheduler.h>
+#include <CChip8Rewind.h>
+#include <CChip8Movie.h>
+
+#include <atomic>
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>
+
+// Lock free single producer, single consumer queue of N (power of 2) items.
+template<typename T, int N>
+class CChip8SPSCQueue {
+ public:
+  static_assert((N & (N - 1)) == 0, "queue size must be a power of 2");
+
+  // producer: add item (returns false if full)
+  bool push(const T &item) {
+    uint tail = tail_.load(std::memory_order_relaxed);
+    uint head = head_.load(std::memory_order_acquire);
+
+    if (tail - head == uint(N))
+      return false;
+
+    items_[tail & (N - 1)] = item;
+
+    tail_.store(tail + 1, std::memory_order_release);
+
+    return true;
+  }
+
+  // consumer: remove oldest item (returns false if empty)
+  bool pop(T &item) {
+    uint head = head_.load(std::memory_order_relaxed);
+    uint tail = tail_.load(std::memory_order_acquire);
+
+    if (head == tail)
+      return false;
+
+    item = items_[head & (N - 1)];
+
+    head_.store(head + 1, std::memory_order_release);
+
+    return true;
+  }
+
+ private:
+  T                             items_[N];
+  alignas(64) std::atomic<uint> head_ { 0 };
+  alignas(64) std::atomic<uint> tail_ { 0 };
+};
+
+//---
+
+// Lock free triple buffer. The writer fills back() and publishes it, the
+// reader takes the most recently published buffer with update(). Neither
+// side ever waits for the other.
+template<typename T>
+class CChip8TripleBuffer {
+ public:
+  // writer: buffer to fill
+  T &back() { return buffers_[back_]; }
+
+  // writer: make back buffer the latest
+  void publish() {
+    int prev = middle_.exchange(back_ | FreshBit, std::memory_order_acq_rel);
+
+    back_ = prev & IndexMask;
+  }
+
+  // reader: switch to latest published buffer (returns false if none since last)
+  bool update() {
+    if (! (middle_.load(std::memory_order_relaxed) & FreshBit))
+      return false;
+
+    int prev = middle_.exchange(front_, std::memory_order_acq_rel);
+
+    front_ = prev & IndexMask;
+
+    return true;
+  }
+
+  // reader: current buffer
+  const T &front() const { return buffers_[front_]; }
+
+ private:
+  static const int IndexMask = 3;
+  static const int FreshBit  = 4;
+
+  T                buffers_[3];
+  int              back_   { 0 };
+  int              front_  { 1 };
+  std::atomic<int> middle_ { 2 };
+};
+
+//---
+
+// Snapshot of machine state at end of a frame
+struct CChip8Frame {
+  using StopReason = CChip8::StopReason;
+
+  uint64_t   seq          { 0 };      // frame number (0 for none)
+  int        width        { 64 };
+  int        height       { 32 };
+  uint64_t   screen[128]  { };        // display rows (as CChip8::pscreen())
+  uint64_t   dirtyRows    { 0 };      // rows changed since previous frame
+  bool       running      { false };
+  StopReason reason       { StopReason::BUDGET };
+  uint64_t   cycles       { 0 };
+  ushort     PC           { 0 };
+  ushort     I            { 0 };
+  uchar      SP           { 0 };
+  uchar      DT           { 0 };
+  uchar      ST           { 0 };
+  uchar      V[16]        { };
+  uchar      op[2]        { };        // instruction bytes at PC
+  char       inst[32]     { };        // disassembled instruction at PC
+  ushort     keys         { 0 };      // pressed keys (bit per key)
+  double     ips          { 0.0 };    // instructions per second
+  double     framePeriod  { 0.0 };    // mean frame period (seconds)
+  double     jitter       { 0.0 };    // frame period standard deviation
+  long       dropped      { 0 };      // frames dropped after stalls
+  bool       rewinding    { false };
+  int        rewindFrames { 0 };      // frames of rewind history
+  size_t     rewindBytes  { 0 };      // bytes of rewind history
+  double     captureTime  { 0.0 };    // mean rewind capture time (seconds)
+  bool       recording    { false };  // recording movie
+  bool       playing      { false };  // playing movie
+  bool       movieError   { false };  // movie does not match loaded rom
+  bool       statsEnabled { false };  // counting instructions (see CChip8::Stats)
+  CChip8::Stats stats;                // instruction counts (if enabled)
+};
+
+//---
+
+// Runs a CChip8 on its own thread at 60 frames per second (see CChip8Scheduler).
+//
+// Commands (keys, run, stop, step, load) are sent through a lock free queue
+// and finished frames are returned through a lock free triple buffer so the
+// caller (GUI) and the emulator never block on each other. The chip must not
+// be accessed by the caller while the worker is running.
+class CChip8Worker {
+ public:
+  using StopReason = CChip8::StopReason;
+
+  enum class CommandType {
+    KEY,
+    RUN,
+    STOP,
+    CONT,
+    STEP,
+    LOAD,
+    SUPER,
+    QUIRKS,
+    IPS,
+    SEED,
+    REWIND,
+    REWIND_BUDGET,
+    RECORD,
+    PLAY,
+    STATS,
+    STATS_RESET,
+    QUIT
+  };
+
+  struct Command {
+    CommandType  type   { CommandType::STOP };
+    int          value  { 0 };       // key number, super/stats flag, quirks, ips or rewind budget
+    bool         down   { false };   // key or rewind pressed
+    uint64_t     seed   { 0 };       // RND seed
+    uchar*       memory { nullptr }; // load memory image (owned by worker once sent)
+    char*        text   { nullptr }; // record file name (owned by worker once sent)
+    CChip8Movie* movie  { nullptr }; // movie to play (owned by worker once sent)
+  };
+
+ public:
+  CChip8Worker(CChip8 *chip) :
+   chip_(chip) {
+  }
+
+ ~CChip8Worker() {
+    quit();
+
+    // free data of unprocessed commands
+    Command cmd;
+
+    while (commands_.pop(cmd)) {
+      delete [] cmd.memory;
+      delete [] cmd.text;
+      delete cmd.movie;
+    }
+  }
+
+  // start thread
+  void start() {
+    if (thread_.joinable())
+      return;
+
+    quit_ = false;
+
+    thread_ = std::thread([this]() { loop(); });
+  }
+
+  // stop thread (waits for current frame to finish)
+  void quit() {
+    if (! thread_.joinable())
+      return;
+
+    quit_ = true;
+
+    thread_.join();
+  }
+
+  //---
+
+  // send command (returns false if queue full)
+  bool send(const Command &cmd) { return commands_.push(cmd); }
+
+  void setKey(int key, bool down) {
+    Command cmd; cmd.type = CommandType::KEY; cmd.value = key; cmd.down = down; send(cmd);
+  }
+
+  void run () { sendType(CommandType::RUN ); }
+  void stop() { sendType(CommandType::STOP); }
+  void cont() { sendType(CommandType::CONT); }
+  void step() { sendType(CommandType::STEP); }
+
+  void setSuper(bool b) {
+    Command cmd; cmd.type = CommandType::SUPER; cmd.value = b; send(cmd);
+  }
+
+  // quirk flags (CChip8::QuirkShiftVY, CChip8::QuirkLoadStoreI)
+  void setQuirks(uint quirks) {
+    Command cmd; cmd.type = CommandType::QUIRKS; cmd.value = int(quirks); send(cmd);
+  }
+
+  // instructions per second (timers still tick at 60Hz)
+  void setIPS(int ips) {
+    Command cmd; cmd.type = CommandType::IPS; cmd.value = ips; send(cmd);
+  }
+
+  // seed RND (reproducible run)
+  void setSeed(uint64_t seed) {
+    Command cmd; cmd.type = CommandType::SEED; cmd.seed = seed; send(cmd);
+  }
+
+  // rewind (one frame per frame) while set
+  void setRewind(bool down) {
+    Command cmd; cmd.type = CommandType::REWIND; cmd.down = down; send(cmd);
+  }
+
+  // bytes of rewind history (clears history)
+  void setRewindBudget(int bytes) {
+    Command cmd; cmd.type = CommandType::REWIND_BUDGET; cmd.value = bytes; send(cmd);
+  }
+
+  // count executed instructions (if built with CCHIP8_STATS)
+  void setStatsEnabled(bool b) {
+    Command cmd; cmd.type = CommandType::STATS; cmd.value = b; send(cmd);
+  }
+
+  void resetStats() { sendType(CommandType::STATS_RESET); }
+
+  // record input from next run to movie file (saved at stop and quit)
+  bool recordMovie(const std::string &filename) {
+    Command cmd;
+
+    cmd.type = CommandType::RECORD;
+    cmd.text = new char [filename.size() + 1];
+
+    strcpy(cmd.text, filename.c_str());
+
+    if (! send(cmd)) {
+      delete [] cmd.text;
+      return false;
+    }
+
+    return true;
+  }
+
+  // replay movie on next run (live keys ignored while playing)
+  bool playMovie(const CChip8Movie &movie) {
+    Command cmd;
+
+    cmd.type  = CommandType::PLAY;
+    cmd.movie = new CChip8Movie(movie);
+
+    if (! send(cmd)) {
+      delete cmd.movie;
+      return false;
+    }
+
+    return true;
+  }
+
+  // load copy of memory image (MemSize bytes)
+  bool load(const uchar *memory) {
+    Command cmd;
+
+    cmd.type   = CommandType::LOAD;
+    cmd.memory = new uchar [CChip8::MemSize];
+
+    memcpy(cmd.memory, memory, CChip8::MemSize);
+
+    if (! send(cmd)) {
+      delete [] cmd.memory;
+      return false;
+    }
+
+    return true;
+  }
+
+  //---
+
+  // switch to latest finished frame (returns false if no new frame)
+  bool updateFrame() { return frames_.update(); }
+
+  // current frame (valid until next updateFrame())
+  const CChip8Frame &frame() const { return frames_.front(); }
+
+ private:
+  void sendType(CommandType type) {
+    Command cmd; cmd.type = type; send(cmd);
+  }
+
+  void loop() {
+    // publish initial state
+    publish();
+
+    scheduler_.start();
+
+    while (! quit_) {
+      // wait for next frame (more than one to catch up after a stall)
+      int n = scheduler_.waitFrames();
+
+      processCommands();
+
+      for (int i = 0; i < n; ++i) {
+        if      (rewinding_ && ! player_) {
+          // back to previous frame (stopped at oldest)
+          if (! rewind_.rewind(*chip_, 1))
+            break;
+
+          --frameNum_;
+
+          if (recording_)
+            movie_.truncate(chip_->cycles());
+
+          reason_ = StopReason::FRAME;
+        }
+        else if (running_) {
+          runFrame();
+
+          if (isStopReason(reason_))
+            setRunning(false);
+
+          rewind_.capture(*chip_);
+        }
+      }
+
+      publish();
+    }
+
+    saveMovie();
+  }
+
+  void runFrame() {
+    if (player_) {
+      reason_ = player_->runFrame(*chip_);
+
+      ++frameNum_;
+
+      if (player_->isFinished(*chip_))
+        setRunning(false);
+
+      return;
+    }
+
+    chip_->setCyclesPerFrame(scheduler_.frameCycles(frameNum_++));
+
+    reason_ = chip_->runUntilFrame();
+  }
+
+  // reset and run from start (starting movie record or playback)
+  void restart() {
+    rewind_.clear();
+
+    frameNum_ = 0;
+    reason_   = StopReason::BUDGET;
+
+    if (playMovie_) {
+      player_ = std::make_unique<CChip8MoviePlayer>(*playMovie_);
+
+      movieError_ = ! player_->start(*chip_);
+
+      if (movieError_) {
+        player_.reset();
+
+        running_ = false;
+
+        return;
+      }
+
+      scheduler_.setIPS(playMovie_->ips());
+
+      running_ = true;
+
+      return;
+    }
+
+    chip_->reset(/*memory*/false);
+
+    // recording needs known seed
+    if (recordFile_ != "" && ! hasSeed_) {
+      std::random_device rd;
+
+      seed_    = (uint64_t(rd()) << 32) | rd();
+      hasSeed_ = true;
+    }
+
+    if (hasSeed_)
+      chip_->setSeed(seed_);
+
+    if (recordFile_ != "") {
+      movie_.start(*chip_, seed_, scheduler_.ips());
+
+      recording_ = true;
+    }
+
+    running_ = true;
+  }
+
+  void setRunning(bool b) {
+    running_ = b;
+
+    if (! running_)
+      saveMovie();
+  }
+
+  // save recorded movie (if any)
+  void saveMovie() {
+    if (! recording_)
+      return;
+
+    movie_.setLength(chip_->cycles());
+
+    movie_.save(recordFile_.c_str());
+  }
+
+  void processCommands() {
+    Command cmd;
+
+    while (commands_.pop(cmd)) {
+      switch (cmd.type) {
+        case CommandType::KEY:
+          // movie input only while playing
+          if (player_ && running_)
+            break;
+
+          chip_->setKey(uchar(cmd.value), cmd.down);
+
+          if (recording_)
+            movie_.record(*chip_, uchar(cmd.value), cmd.down);
+
+          break;
+        case CommandType::RUN:
+          restart();
+          break;
+        case CommandType::STOP:
+          setRunning(false);
+          break;
+        case CommandType::CONT:
+          running_ = true;
+          break;
+        case CommandType::STEP:
+          // single instruction (timers still tick at frame boundary)
+          reason_ = chip_->runCycles(1);
+
+          if (isStopReason(reason_))
+            running_ = false;
+
+          break;
+        case CommandType::LOAD:
+          chip_->setMemory(cmd.memory);
+
+          delete [] cmd.memory;
+
+          rewind_.clear();
+
+          saveMovie();
+
+          recording_ = false;
+
+          break;
+        case CommandType::SUPER:
+          chip_->setSuper(cmd.value);
+          break;
+        case CommandType::QUIRKS:
+          chip_->setQuirks(uint(cmd.value));
+          break;
+        case CommandType::IPS:
+          // frame sizes fixed while recording or playing movie
+          if (cmd.value > 0 && ! recording_ && ! player_)
+            scheduler_.setIPS(cmd.value);
+
+          break;
+        case CommandType::SEED:
+          // also applied at each run
+          seed_    = cmd.seed;
+          hasSeed_ = true;
+
+          chip_->setSeed(seed_);
+
+          break;
+        case CommandType::REWIND:
+          rewinding_ = cmd.down;
+          break;
+        case CommandType::REWIND_BUDGET:
+          if (cmd.value > 0)
+            rewind_.setBudget(size_t(cmd.value));
+
+          break;
+        case CommandType::RECORD:
+          saveMovie();
+
+          recordFile_ = cmd.text;
+          recording_  = false;
+
+          delete [] cmd.text;
+
+          playMovie_.reset();
+          player_   .reset();
+
+          break;
+        case CommandType::PLAY:
+          saveMovie();
+
+          playMovie_.reset(cmd.movie);
+
+          player_.reset();
+
+          recordFile_ = "";
+          recording_  = false;
+
+          break;
+        case CommandType::STATS:
+          chip_->setStatsEnabled(cmd.value);
+          break;
+        case CommandType::STATS_RESET:
+          chip_->resetStats();
+          break;
+        case CommandType::QUIT:
+          quit_ = true;
+          break;
+        default:
+          break;
+      }
+    }
+  }
+
+  // copy state to back frame and publish it
+  void publish() {
+    CChip8Frame &frame = frames_.back();
+
+    frame.seq    = ++seq_;
+    frame.width  = chip_->screenWidth ();
+    frame.height = chip_->screenHeight();
+
+    memcpy(frame.screen, chip_->pscreen(), frame.width*frame.height/8);
+
+    frame.dirtyRows = chip_->dirtyRows();
+
+    chip_->clearDirtyRows();
+
+    frame.running = running_;
+    frame.reason  = reason_;
+    frame.cycles  = chip_->cycles();
+
+    frame.PC = chip_->PC();
+    frame.I  = chip_->I ();
+    frame.SP = chip_->SP();
+    frame.DT = chip_->DT();
+    frame.ST = chip_->ST();
+
+    for (int i = 0; i < 16; ++i)
+      frame.V[i] = chip_->V(i);
+
+    frame.op[0] = chip_->memory(frame.PC);
+    frame.op[1] = chip_->memory((frame.PC + 1) & CChip8::MemDataEnd);
+
+    static_assert(sizeof(frame.inst) >= CChip8::MaxDisasmSize, "inst too small");
+
+    chip_->disassemble(chip_->PC(), frame.inst, /*showAddr*/false);
+
+    frame.keys = 0;
+
+    for (int i = 0; i < 16; ++i)
+      if (chip_->isKey(i))
+        frame.keys |= ushort(1 << i);
+
+    const auto &stats = scheduler_.stats();
+
+    frame.ips         = scheduler_.ips();
+    frame.framePeriod = stats.meanPeriod();
+    frame.jitter      = stats.jitter();
+    frame.dropped     = stats.droppedFrames;
+
+    frame.rewinding    = rewinding_;
+    frame.rewindFrames = rewind_.numFrames();
+    frame.rewindBytes  = rewind_.usedBytes();
+    frame.captureTime  = rewind_.stats().meanCapture();
+
+    frame.recording  = recording_;
+    frame.playing    = (player_ && running_);
+    frame.movieError = movieError_;
+
+    frame.statsEnabled = chip_->isStatsEnabled();
+
+    if (frame.statsEnabled)
+      frame.stats = chip_->stats();
+
+    frames_.publish();
+  }
+
+  static bool isStopReason(StopReason reason) {
+    return (reason == StopReason::HALT       ||
+            reason == StopReason::EXIT       ||
+            reason == StopReason::BREAKPOINT ||
+            reason == StopReason::FAULT);
+  }
+
+ private:
+  using CommandQueue = CChip8SPSCQueue<Command, 256>;
+  using FrameBuffer  = CChip8TripleBuffer<CChip8Frame>;
+
+  CChip8*           chip_      { nullptr };
+  CChip8Scheduler   scheduler_;
+  CChip8Rewind      rewind_;
+  std::thread       thread_;
+  std::atomic<bool> quit_      { false };
+  CommandQueue      commands_;
+  FrameBuffer       frames_;
+  bool              running_   { false };    // worker thread only
+  bool              rewinding_ { false };
+  StopReason        reason_    { StopReason::BUDGET };
+  uint64_t          seq_       { 0 };
+  uint64_t          frameNum_  { 0 };        // frames since run
+  bool              hasSeed_   { false };
+  uint64_t          seed_      { 0 };
+
+  // movie
+  using MovieP  = std::unique_ptr<CChip8Movie>;
+  using PlayerP = std::unique_ptr<CChip8MoviePlayer>;
+
+  std::string       recordFile_;
+  bool              recording_  { false };
+  CChip8Movie       movie_;
+  MovieP            playMovie_;
+  PlayerP           player_;
+  bool              movieError_ { false };
+};
+
+#endif
@@ -1,11 +1,17 @@
 #include <CQChip8.h>
-#include <CChip8.h>
+#include <CChip8Worker.h>
+#include <CChip8Analyze.h>
+#include <CChip8RomDb.h>
 
 #include <QTimer>
 #include <QImage>
 #include <QPainter>
+#include <QRegion>
+#include <QtEndian>
 #include <QKeyEvent>
 
+#include <memory>
+
 CQChip8::
 CQChip8()
 {
@@ -13,7 +19,7 @@ CQChip8()
 
   connect(timer_, SIGNAL(timeout()), this, SLOT(timerSlot()));
 
-  timer_->start(2); // 500 Hz
+  timer_->start(16); // 60 Hz (one frame per timeout)
 
   setSizePolicy(QSizePolicy::Expanding, QSizePolicy::Expanding);
 
@@ -22,168 +28,302 @@ CQChip8()
   chip8_ = new CChip8;
 
   chip8_->reset();
+
+  // chip only accessed by worker thread from here
+  worker_ = new CChip8Worker(chip8_);
+
+  worker_->start();
 }
 
 CQChip8::
 ~CQChip8()
 {
+  delete worker_;
+  delete chip8_;
+  delete romDb_;
   delete image_;
 }
 
+const CChip8Frame &
+CQChip8::
+frame() const
+{
+  return worker_->frame();
+}
+
 bool
 CQChip8::
 load(const QString &filename)
 {
-  FILE *fp = fopen(filename.toStdString().c_str(), "r");
-  if (! fp) return false;
+  CChip8::RomFile file;
 
-  int i = CChip8::MemDataStart;
+  CChip8::LoadError error = file.open(filename.toStdString().c_str());
 
-  uchar memory[CChip8::MemSize];
+  if (error != CChip8::LoadError::NONE) {
+    loadError_ = CChip8::loadErrorMessage(error);
+    return false;
+  }
 
-  memset(memory, 0, CChip8::MemSize);
+  loadError_ = "";
 
-  int c;
+  memory_.assign(CChip8::MemSize, 0);
 
-  while ((c = fgetc(fp)) != EOF) {
-    memory[i++] = c;
-  }
+  memcpy(&memory_[CChip8::MemDataStart], file.data(), file.size());
+
+  if (! worker_->load(&memory_[0]))
+    return false;
+
+  // settings of known rom (defaults for unknown so previous rom's are not kept)
+  if (romDb_) {
+    CChip8RomDb::Profile profile;
 
-  chip8_->setMemory(memory);
+    romDb_->lookup(file.data(), file.size(), profile);
+
+    worker_->setSuper (profile.super);
+    worker_->setQuirks(profile.quirks);
+    worker_->setIPS   ((profile.ipf > 0 ? profile.ipf : 9)*60);
+  }
 
   return true;
 }
 
-void
+bool
 CQChip8::
-setSuper(bool b)
+setRomDb(const QString &filename, const QStringList &dirs)
 {
-  chip8_->setSuper(b);
+  if (! romDb_)
+    romDb_ = new CChip8RomDb;
 
-  delete image_;
+  std::vector<std::string> dirs1;
+
+  for (const auto &dir : dirs)
+    dirs1.push_back(dir.toStdString());
 
-  image_ = nullptr;
+  bool rc = (dirs1.empty() ? romDb_->open  (filename.toStdString()) :
+                             romDb_->update(filename.toStdString(), dirs1));
 
-  drawScreen();
+  if (! rc) {
+    loadError_ = QString::fromStdString(romDb_->errorMsg());
+
+    delete romDb_;
+
+    romDb_ = nullptr;
+  }
 
-  update();
+  return rc;
 }
 
 void
 CQChip8::
-disassemble()
+setSuper(bool b)
 {
-  int i = CChip8::MemDataStart;
+  // image resized when frame with new resolution arrives
+  worker_->setSuper(b);
+}
 
-  for (i = CChip8::MemDataStart; i <= CChip8::MemDataEnd; i += 2) {
-    chip8_->disassemble(i, std::cerr);
-  }
+void
+CQChip8::
+setIPS(int ips)
+{
+  worker_->setIPS(ips);
 }
 
 void
 CQChip8::
-timerSlot()
+setSeed(uint64_t seed)
 {
-  if (running_) {
-    step();
-  }
-  else {
-    //drawScreen();
+  worker_->setSeed(seed);
+}
 
-    //update();
-  }
+void
+CQChip8::
+setRewind(bool b)
+{
+  worker_->setRewind(b);
 }
 
 void
 CQChip8::
-run()
+setRewindBudget(int bytes)
 {
-  chip8_->reset(/*memory*/false);
+  worker_->setRewindBudget(bytes);
+}
 
-  cont();
+void
+CQChip8::
+setStatsEnabled(bool b)
+{
+  worker_->setStatsEnabled(b);
 }
 
 void
 CQChip8::
-cont()
+resetStats()
 {
-  running_ = true;
+  worker_->resetStats();
+}
 
-  drawScreen();
+bool
+CQChip8::
+recordMovie(const QString &filename)
+{
+  return worker_->recordMovie(filename.toStdString());
+}
 
-  update();
+bool
+CQChip8::
+playMovie(const QString &filename)
+{
+  CChip8Movie movie;
+
+  if (! movie.load(filename.toStdString().c_str()))
+    return false;
+
+  return worker_->playMovie(movie);
 }
 
 void
 CQChip8::
-step()
+disassemble()
 {
-  ++t_;
+  if (memory_.empty())
+    return;
 
-  if (! chip8_->step())
-    running_ = false;
+  // loaded memory (running chip belongs to worker)
+  auto chip = std::make_unique<CChip8>();
 
-  if (t_ >= 9) {
-    chip8_->tick();
+  chip->reset();
 
-    drawScreen();
+  chip->setMemory(&memory_[0]);
 
-    update();
+  // reachable code (labelled blocks) and data
+  CChip8Analyzer analyzer;
 
-    t_ = 0;
-  }
+  analyzer.analyze(*chip);
 
-  if (running_) {
-    if (t_ == 0) {
-      emit tick();
-    }
-  }
+  analyzer.writeListing(*chip, stderr);
 }
 
 void
 CQChip8::
-stop()
+timerSlot()
 {
-  running_ = false;
+  // latest frame from worker (if any)
+  if (! worker_->updateFrame())
+    return;
+
+  updateScreen();
+
+  const CChip8Frame &frame = worker_->frame();
+
+  bool changed = (frame.cycles  != lastCycles_  ||
+                  frame.running != lastRunning_ ||
+                  frame.keys    != lastKeys_);
 
-  drawScreen();
+  lastCycles_  = frame.cycles;
+  lastRunning_ = frame.running;
+  lastKeys_    = frame.keys;
 
-  update();
+  if (changed)
+    emit tick();
 }
 
 void
 CQChip8::
+run()
+{
+  worker_->run();
+}
+
+void
+CQChip8::
+cont()
+{
+  worker_->cont();
+}
+
+void
+CQChip8::
+step()
+{
+  worker_->step();
+}
+
+void
+CQChip8::
+stop()
+{
+  worker_->stop();
+}
+
+void
+CQChip8::
+updateScreen()
+{
+  QRegion region = drawScreen();
+
+  if (! region.isEmpty())
+    update(region);
+}
+
+QRegion
+CQChip8::
 drawScreen()
 {
-  int iw = chip8_->screenWidth ();
-  int ih = chip8_->screenHeight();
+  const CChip8Frame &frame = worker_->frame();
+
+  int iw = frame.width;
+  int ih = frame.height;
+
+  // skipped frame(s) so rows dirty in those are unknown
+  uint64_t dirtyRows = (frame.seq == lastSeq_ + 1 ? frame.dirtyRows : ~uint64_t(0));
+
+  lastSeq_ = frame.seq;
+
+  // resolution change redraws all (including area no longer covered)
+  bool resized = false;
 
-  int siw = iw*scale_;
-  int sih = ih*scale_;
+  if (! image_ || image_->width() != iw || image_->height() != ih) {
+    delete image_;
 
-  if (! image_ || image_->width() != siw || image_->height() != sih) {
-    image_ = new QImage(siw, sih, QImage::Format_ARGB32_Premultiplied);
+    // 1 bit per pixel (most significant bit first) as display
+    image_ = new QImage(iw, ih, QImage::Format_Mono);
+
+    image_->setColorTable(QVector<QRgb>() << qRgb(0, 0, 0) << qRgb(255, 255, 255));
+
+    dirtyRows = ~uint64_t(0);
+    resized   = true;
   }
 
-  QPainter painter(image_);
+  // nothing changed since last draw
+  if (! dirtyRows)
+    return QRegion();
+
+  //---
+
+  // copy dirty display rows to image scanlines
+  const uint64_t *screen = frame.screen;
 
-  painter.fillRect(QRect(0, 0, siw, sih), QColor(0, 0, 0));
+  int rw = iw/64;
 
-  int is = 0;
-  int iy = 0;
+  QRegion region;
 
   for (int y = 0; y < ih; ++y) {
-    int ix = 0;
+    if (! (dirtyRows & (uint64_t(1) << y)))
+      continue;
 
-    for (int x = 0; x < iw; ++x, ++is) {
-      if (chip8_->screen(is))
-        painter.fillRect(QRect(ix, iy, scale_, scale_), QColor(255, 255, 255));
+    uchar *line = image_->scanLine(y);
 
-      ix += scale_;
-    }
+    for (int i = 0; i < rw; ++i)
+      qToBigEndian<quint64>(screen[y*rw + i], line + 8*i);
 
-    iy += scale_;
+    region += QRect(0, y*scale_, iw*scale_, scale_);
   }
+
+  if (resized)
+    region = QRegion(rect());
+
+  return region;
 }
 
 void
@@ -194,8 +334,9 @@ paintEvent(QPaintEvent *)
 
   p.fillRect(rect(), QColor(50, 50, 50));
 
+  // scaled in one blit
   if (image_)
-    p.drawImage(0, 0, *image_);
+    p.drawImage(QRect(0, 0, image_->width()*scale_, image_->height()*scale_), *image_);
 }
 
 void
@@ -206,24 +347,33 @@ keyPressEvent(QKeyEvent *ke)
   // 4 5 6 D   Q W E R
   // 7 8 9 E   A S D F
   // A 0 B F   Z X C V
+  //
+  // Backspace (held) rewinds
   int k = ke->key();
 
-  if      (k == Qt::Key_1) chip8_->setKey(0x1, true);
-  else if (k == Qt::Key_2) chip8_->setKey(0x2, true);
-  else if (k == Qt::Key_3) chip8_->setKey(0x3, true);
-  else if (k == Qt::Key_4) chip8_->setKey(0xC, true);
-  else if (k == Qt::Key_Q) chip8_->setKey(0x4, true);
-  else if (k == Qt::Key_W) chip8_->setKey(0x5, true);
-  else if (k == Qt::Key_E) chip8_->setKey(0x6, true);
-  else if (k == Qt::Key_R) chip8_->setKey(0xD, true);
-  else if (k == Qt::Key_A) chip8_->setKey(0x7, true);
-  else if (k == Qt::Key_S) chip8_->setKey(0x8, true);
-  else if (k == Qt::Key_D) chip8_->setKey(0x9, true);
-  else if (k == Qt::Key_F) chip8_->setKey(0xE, true);
-  else if (k == Qt::Key_Z) chip8_->setKey(0xA, true);
-  else if (k == Qt::Key_X) chip8_->setKey(0x0, true);
-  else if (k == Qt::Key_C) chip8_->setKey(0xB, true);
-  else if (k == Qt::Key_V) chip8_->setKey(0xF, true);
+  if (k == Qt::Key_Backspace) {
+    if (! ke->isAutoRepeat())
+      setRewind(true);
+
+    return;
+  }
+
+  if      (k == Qt::Key_1) worker_->setKey(0x1, true);
+  else if (k == Qt::Key_2) worker_->setKey(0x2, true);
+  else if (k == Qt::Key_3) worker_->setKey(0x3, true);
+  else if (k == Qt::Key_4) worker_->setKey(0xC, true);
+  else if (k == Qt::Key_Q) worker_->setKey(0x4, true);
+  else if (k == Qt::Key_W) worker_->setKey(0x5, true);
+  else if (k == Qt::Key_E) worker_->setKey(0x6, true);
+  else if (k == Qt::Key_R) worker_->setKey(0xD, true);
+  else if (k == Qt::Key_A) worker_->setKey(0x7, true);
+  else if (k == Qt::Key_S) worker_->setKey(0x8, true);
+  else if (k == Qt::Key_D) worker_->setKey(0x9, true);
+  else if (k == Qt::Key_F) worker_->setKey(0xE, true);
+  else if (k == Qt::Key_Z) worker_->setKey(0xA, true);
+  else if (k == Qt::Key_X) worker_->setKey(0x0, true);
+  else if (k == Qt::Key_C) worker_->setKey(0xB, true);
+  else if (k == Qt::Key_V) worker_->setKey(0xF, true);
   else return;
 
   emit keyChanged();
@@ -239,22 +389,29 @@ keyReleaseEvent(QKeyEvent *ke)
   // Z X C V
   int k = ke->key();
 
-  if      (k == Qt::Key_1) chip8_->setKey(0x1, false);
-  else if (k == Qt::Key_2) chip8_->setKey(0x2, false);
-  else if (k == Qt::Key_3) chip8_->setKey(0x3, false);
-  else if (k == Qt::Key_4) chip8_->setKey(0xC, false);
-  else if (k == Qt::Key_Q) chip8_->setKey(0x4, false);
-  else if (k == Qt::Key_W) chip8_->setKey(0x5, false);
-  else if (k == Qt::Key_E) chip8_->setKey(0x6, false);
-  else if (k == Qt::Key_R) chip8_->setKey(0xD, false);
-  else if (k == Qt::Key_A) chip8_->setKey(0x7, false);
-  else if (k == Qt::Key_S) chip8_->setKey(0x8, false);
-  else if (k == Qt::Key_D) chip8_->setKey(0x9, false);
-  else if (k == Qt::Key_F) chip8_->setKey(0xE, false);
-  else if (k == Qt::Key_Z) chip8_->setKey(0xA, false);
-  else if (k == Qt::Key_X) chip8_->setKey(0x0, false);
-  else if (k == Qt::Key_C) chip8_->setKey(0xB, false);
-  else if (k == Qt::Key_V) chip8_->setKey(0xF, false);
+  if (k == Qt::Key_Backspace) {
+    if (! ke->isAutoRepeat())
+      setRewind(false);
+
+    return;
+  }
+
+  if      (k == Qt::Key_1) worker_->setKey(0x1, false);
+  else if (k == Qt::Key_2) worker_->setKey(0x2, false);
+  else if (k == Qt::Key_3) worker_->setKey(0x3, false);
+  else if (k == Qt::Key_4) worker_->setKey(0xC, false);
+  else if (k == Qt::Key_Q) worker_->setKey(0x4, false);
+  else if (k == Qt::Key_W) worker_->setKey(0x5, false);
+  else if (k == Qt::Key_E) worker_->setKey(0x6, false);
+  else if (k == Qt::Key_R) worker_->setKey(0xD, false);
+  else if (k == Qt::Key_A) worker_->setKey(0x7, false);
+  else if (k == Qt::Key_S) worker_->setKey(0x8, false);
+  else if (k == Qt::Key_D) worker_->setKey(0x9, false);
+  else if (k == Qt::Key_F) worker_->setKey(0xE, false);
+  else if (k == Qt::Key_Z) worker_->setKey(0xA, false);
+  else if (k == Qt::Key_X) worker_->setKey(0x0, false);
+  else if (k == Qt::Key_C) worker_->setKey(0xB, false);
+  else if (k == Qt::Key_V) worker_->setKey(0xF, false);
   else return;
 
   emit keyChanged();
@@ -264,8 +421,10 @@ QSize
 CQChip8::
 sizeHint() const
 {
-  int iw = chip8_->screenWidth ();
-  int ih = chip8_->screenHeight();
+  const CChip8Frame &frame = worker_->frame();
+
+  int iw = frame.width;
+  int ih = frame.height;
 
   return QSize(iw*scale_, ih*scale_);
 }
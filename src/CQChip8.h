@@ -2,11 +2,18 @@
 #define CQChip8_H
 
 #include <QFrame>
+#include <QStringList>
+
+#include <vector>
 
 class CChip8;
+class CChip8Worker;
+class CChip8RomDb;
+struct CChip8Frame;
 
 class QTimer;
 class QImage;
+class QRegion;
 
 class CQChip8 : public QFrame {
   Q_OBJECT
@@ -15,14 +22,46 @@ class CQChip8 : public QFrame {
   CQChip8();
  ~CQChip8();
 
-  CChip8 *chip8() const { return chip8_; }
+  // latest frame from worker thread
+  const CChip8Frame &frame() const;
 
+  // load rom file (false on error, see loadError())
   bool load(const QString &filename);
 
+  // reason last load failed
+  const QString &loadError() const { return loadError_; }
+
+  // rom database index (updated from rom directories if given). Loaded roms
+  // found in it get their super mode, quirks and speed (false on error,
+  // see loadError())
+  bool setRomDb(const QString &filename, const QStringList &dirs);
+
   void disassemble();
 
   void setSuper(bool b);
 
+  // instructions per second (timers tick at 60Hz)
+  void setIPS(int ips);
+
+  // seed RND (same seed and keys give same run)
+  void setSeed(uint64_t seed);
+
+  // rewind one frame per frame while set (also Backspace key)
+  void setRewind(bool b);
+
+  // bytes of rewind history
+  void setRewindBudget(int bytes);
+
+  // count executed instructions (shown in frame stats)
+  void setStatsEnabled(bool b);
+  void resetStats();
+
+  // record keys of next run to movie file (saved when run stops)
+  bool recordMovie(const QString &filename);
+
+  // replay movie file on next run (returns false if not a valid movie)
+  bool playMovie(const QString &filename);
+
   void step();
   void run();
   void stop();
@@ -40,18 +79,28 @@ class CQChip8 : public QFrame {
   void keyChanged();
 
  private:
-  void drawScreen();
+  void updateScreen();
+
+  QRegion drawScreen();
 
  private slots:
   void timerSlot();
 
  private:
-  CChip8* chip8_   { nullptr };
-  int     scale_   { 8 };
-  bool    running_ { false };
-  QTimer* timer_   { nullptr };
-  int     t_       { 0 };
-  QImage* image_   { nullptr };
+  using Memory = std::vector<uchar>;
+
+  CChip8*       chip8_       { nullptr };
+  CChip8Worker* worker_      { nullptr };
+  CChip8RomDb*  romDb_       { nullptr };
+  Memory        memory_;                  // last loaded memory
+  QString       loadError_;
+  int           scale_       { 8 };
+  QTimer*       timer_       { nullptr };
+  QImage*       image_       { nullptr };
+  uint64_t      lastSeq_     { 0 };
+  uint64_t      lastCycles_  { 0 };
+  bool          lastRunning_ { false };
+  ushort        lastKeys_    { 0 };
 };
 
 #endif
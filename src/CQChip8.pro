@@ -12,7 +12,9 @@ INCLUDEPATH += . ../include
 
 QMAKE_CXXFLAGS += -std=c++17
 
-CONFIG += debug
+DEFINES += CCHIP8_STATS
+
+CONFIG += debug thread
 
 SOURCES += \
 CQChip8.cpp \
@@ -20,6 +22,12 @@ CQChip8Test.cpp \
 
 HEADERS += \
 CChip8.h \
+CChip8Analyze.h \
+CChip8Movie.h \
+CChip8Rewind.h \
+CChip8RomDb.h \
+CChip8Scheduler.h \
+CChip8Worker.h \
 CQChip8.h \
 CQChip8Test.h \
 
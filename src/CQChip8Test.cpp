@@ -1,6 +1,6 @@
 #include <CQChip8Test.h>
 #include <CQChip8.h>
-#include <CChip8.h>
+#include <CChip8Worker.h>
 
 #include <QApplication>
 #include <QVBoxLayout>
@@ -8,18 +8,47 @@
 #include <QLineEdit>
 #include <QLabel>
 
+#include <iostream>
+
 int
 main(int argc, char **argv)
 {
   QApplication app(argc, argv);
 
-  QString filename;
-  bool    disassemble = false;
-  bool    super       = false;
+  QString  filename;
+  bool     disassemble = false;
+  bool     super       = false;
+  int      ips         = 0;
+  bool     hasSeed     = false;
+  uint64_t seed        = 0;
+  int      rewindKB    = 0;
+  QString  recordFile;
+  QString  playFile;
+  bool     stats       = false;
+  QString  romDbFile;
+  QStringList romDirs;
 
   for (int i = 1; i < argc; ++i) {
     if (argv[i][0] == '-') {
-      if      (argv[i][1] == 'd')
+      if      (strcmp(&argv[i][1], "ips") == 0 && i < argc - 1)
+        ips = atoi(argv[++i]);
+      else if (strcmp(&argv[i][1], "seed") == 0 && i < argc - 1) {
+        hasSeed = true;
+        seed    = strtoull(argv[++i], nullptr, 0);
+      }
+      else if (strcmp(&argv[i][1], "rewind") == 0 && i < argc - 1)
+        rewindKB = atoi(argv[++i]);
+      else if (strcmp(&argv[i][1], "record") == 0 && i < argc - 1)
+        recordFile = argv[++i];
+      else if (strcmp(&argv[i][1], "play") == 0 && i < argc - 1)
+        playFile = argv[++i];
+      else if (strcmp(&argv[i][1], "romdb") == 0 && i < argc - 1)
+        romDbFile = argv[++i];
+      else if (strcmp(&argv[i][1], "romdir") == 0 && i < argc - 1)
+        romDirs << argv[++i];
+      else if (strcmp(&argv[i][1], "stats") == 0)
+        stats = true;
+      else if (argv[i][1] == 'd')
         disassemble = true;
       else if (argv[i][1] == 's')
         super = true;
@@ -31,12 +60,35 @@ main(int argc, char **argv)
 
   CQChip8Test *test = new CQChip8Test;
 
+  // rom settings from database (-s and -ips below override)
+  if (romDbFile != "" && ! test->chip()->setRomDb(romDbFile, romDirs))
+    std::cerr << "Invalid rom database '" << romDbFile.toStdString() << "' (" <<
+                 test->chip()->loadError().toStdString() << ")\n";
+
   if (filename != "")
     test->load(filename.toStdString().c_str());
 
   if (super)
     test->chip()->setSuper(true);
 
+  if (ips > 0)
+    test->chip()->setIPS(ips);
+
+  if (hasSeed)
+    test->chip()->setSeed(seed);
+
+  if (rewindKB > 0)
+    test->chip()->setRewindBudget(rewindKB*1024);
+
+  if (recordFile != "")
+    test->chip()->recordMovie(recordFile);
+
+  if (playFile != "" && ! test->chip()->playMovie(playFile))
+    std::cerr << "Invalid movie file '" << playFile.toStdString() << "'\n";
+
+  if (stats)
+    test->setStatsEnabled(true);
+
   if (disassemble)
     test->chip()->disassemble();
 
@@ -97,6 +149,14 @@ CQChip8Test()
 
   keysEdit_ = createEdit(controlLayout, "Keys");
 
+  frameEdit_ = createEdit(controlLayout, "Frame");
+
+  rewindEdit_ = createEdit(controlLayout, "Rewind");
+
+  // execution counts (CCHIP8_STATS)
+  statsEdit_ = createEdit(controlLayout, "Stats");
+  opsEdit_   = createEdit(controlLayout, "Ops");
+
   //---
 
   auto buttonFrame = new QFrame;
@@ -110,15 +170,31 @@ CQChip8Test()
   auto stopButton = new QPushButton("Stop");
   auto contButton = new QPushButton("Continue");
 
+  // hold to rewind
+  auto rewindButton = new QPushButton("Rewind");
+
+  // toggle execution counts
+  statsButton_ = new QPushButton("Stats");
+
+  statsButton_->setCheckable(true);
+  statsButton_->setEnabled(CChip8::isStatsSupported());
+
   connect(stepButton, SIGNAL(clicked()), this, SLOT(stepSlot()));
   connect(runButton , SIGNAL(clicked()), this, SLOT(runSlot()));
   connect(stopButton, SIGNAL(clicked()), this, SLOT(stopSlot()));
   connect(contButton, SIGNAL(clicked()), this, SLOT(contSlot()));
 
+  connect(rewindButton, SIGNAL(pressed()), this, SLOT(rewindPressSlot()));
+  connect(rewindButton, SIGNAL(released()), this, SLOT(rewindReleaseSlot()));
+
+  connect(statsButton_, SIGNAL(toggled(bool)), this, SLOT(statsSlot(bool)));
+
   buttonLayout->addWidget(stepButton);
   buttonLayout->addWidget(runButton);
   buttonLayout->addWidget(stopButton);
   buttonLayout->addWidget(contButton);
+  buttonLayout->addWidget(rewindButton);
+  buttonLayout->addWidget(statsButton_);
   buttonLayout->addStretch(1);
 
   //---
@@ -134,7 +210,9 @@ void
 CQChip8Test::
 load(const QString &filename)
 {
-  chip()->load(filename.toStdString().c_str());
+  if (! chip()->load(filename.toStdString().c_str()))
+    std::cerr << "Failed to load '" << filename.toStdString() << "' (" <<
+                 chip()->loadError().toStdString() << ")\n";
 
   updateSlot();
 }
@@ -146,6 +224,14 @@ setSuper(bool b)
   chip_->setSuper(b);
 }
 
+void
+CQChip8Test::
+setStatsEnabled(bool b)
+{
+  // updates chip from toggled signal
+  statsButton_->setChecked(b && CChip8::isStatsSupported());
+}
+
 void
 CQChip8Test::
 stepSlot()
@@ -182,6 +268,31 @@ contSlot()
   updateSlot();
 }
 
+void
+CQChip8Test::
+rewindPressSlot()
+{
+  chip_->setRewind(true);
+}
+
+void
+CQChip8Test::
+rewindReleaseSlot()
+{
+  chip_->setRewind(false);
+}
+
+void
+CQChip8Test::
+statsSlot(bool b)
+{
+  // restart counts when enabled
+  if (b)
+    chip_->resetStats();
+
+  chip_->setStatsEnabled(b);
+}
+
 void
 CQChip8Test::
 updateSlot()
@@ -194,29 +305,83 @@ updateSlot()
     return QString(CChip8::shortStr(s).c_str());
   };
 
-  pcEdit_->setText(shortStr(chip_->chip8()->PC()));
-  spEdit_->setText(shortStr(chip_->chip8()->SP()));
+  const CChip8Frame &frame = chip_->frame();
+
+  pcEdit_->setText(shortStr(frame.PC));
+  spEdit_->setText(shortStr(frame.SP));
 
   for (int i = 0; i < 16; ++i)
-    vEdit_[i]->setText(charStr(chip_->chip8()->V(i)));
+    vEdit_[i]->setText(charStr(frame.V[i]));
 
-  dtEdit_->setText(shortStr(chip_->chip8()->DT()));
-  stEdit_->setText(shortStr(chip_->chip8()->ST()));
+  dtEdit_->setText(shortStr(frame.DT));
+  stEdit_->setText(shortStr(frame.ST));
 
-  std::stringstream ss; chip_->chip8()->disassemble(ss, /*showAddr*/false);
-  QString instStr = ss.str().c_str();
+  QString instStr = frame.inst;
 
   instEdit_->setText(QString("%1 [%2 %3]").arg(instStr).
-    arg(charStr(chip_->chip8()->memory(chip_->chip8()->PC()    ))).
-    arg(charStr(chip_->chip8()->memory(chip_->chip8()->PC() + 1))));
+    arg(charStr(frame.op[0])).arg(charStr(frame.op[1])));
 
   QString keysStr;
 
   for (int i = 0; i < 16; ++i)
-    if (chip_->chip8()->isKey(i))
+    if (frame.keys & (1 << i))
       keysStr += charStr(i);
 
   keysEdit_->setText(keysStr);
+
+  // pacing (mean frame period, jitter and dropped frames) and movie state
+  QString movieStr;
+
+  if      (frame.movieError)
+    movieStr = "BAD MOVIE ";
+  else if (frame.recording)
+    movieStr = "REC ";
+  else if (frame.playing)
+    movieStr = "PLAY ";
+
+  frameEdit_->setText(QString("%1%2 ips %3 ms +/- %4 ms (%5 dropped)").
+    arg(movieStr).arg(frame.ips, 0, 'f', 0).arg(frame.framePeriod*1E3, 0, 'f', 2).
+    arg(frame.jitter*1E3, 0, 'f', 2).arg(frame.dropped));
+
+  // rewind history (frames, size and capture cost)
+  rewindEdit_->setText(QString("%1%2 frames %3 KB %4 us").
+    arg(frame.rewinding ? "<< " : "").arg(frame.rewindFrames).
+    arg(int(frame.rewindBytes/1024)).arg(frame.captureTime*1E6, 0, 'f', 1));
+
+  // execution counts (instructions, skips taken, draws, wait key and most run ops)
+  if (frame.statsEnabled) {
+    const auto &stats = frame.stats;
+
+    uint64_t numInst = stats.instructions();
+
+    statsEdit_->setText(QString("%1 inst skip %2% rows %3 hit %4 wait %5%").
+      arg(numInst).arg(stats.skipRatio()*100.0, 0, 'f', 1).arg(stats.rowsDrawn()).
+      arg(stats.collisions).arg(stats.waitKeyRatio()*100.0, 0, 'f', 1));
+
+    using OpCode = CChip8::OpCode;
+
+    std::vector<int> inds;
+
+    for (int i = 0; i < int(OpCode::NUM_OPS); ++i)
+      if (stats.ops[i])
+        inds.push_back(i);
+
+    std::sort(inds.begin(), inds.end(), [&](int i1, int i2) {
+      return stats.ops[i1] > stats.ops[i2]; });
+
+    QString opsStr;
+
+    for (int i = 0; i < int(inds.size()) && i < 4; ++i)
+      opsStr += QString("%1%2 %3%").arg(i > 0 ? " " : "").
+        arg(CChip8::opCodeName(OpCode(inds[i]))).
+        arg(100.0*stats.ops[inds[i]]/numInst, 0, 'f', 1);
+
+    opsEdit_->setText(opsStr);
+  }
+  else {
+    statsEdit_->setText("");
+    opsEdit_  ->setText("");
+  }
 }
 
 QSize
@@ -5,6 +5,7 @@
 
 class CQChip8;
 class QLineEdit;
+class QPushButton;
 
 class CQChip8Test : public QFrame {
   Q_OBJECT
@@ -18,6 +19,8 @@ class CQChip8Test : public QFrame {
 
   void setSuper(bool b);
 
+  void setStatsEnabled(bool b);
+
   QSize sizeHint() const override;
 
  private slots:
@@ -26,17 +29,28 @@ class CQChip8Test : public QFrame {
   void stopSlot();
   void contSlot();
 
+  void rewindPressSlot();
+  void rewindReleaseSlot();
+
+  void statsSlot(bool b);
+
   void updateSlot();
 
  private:
-  CQChip8*   chip_      { nullptr };
-  QLineEdit* pcEdit_    { nullptr };
-  QLineEdit* spEdit_    { nullptr };
-  QLineEdit* vEdit_[16] { };
-  QLineEdit* dtEdit_    { nullptr };
-  QLineEdit* stEdit_    { nullptr };
-  QLineEdit* instEdit_  { nullptr };
-  QLineEdit* keysEdit_  { nullptr };
+  CQChip8*   chip_       { nullptr };
+  QLineEdit* pcEdit_     { nullptr };
+  QLineEdit* spEdit_     { nullptr };
+  QLineEdit* vEdit_[16]  { };
+  QLineEdit* dtEdit_     { nullptr };
+  QLineEdit* stEdit_     { nullptr };
+  QLineEdit* instEdit_   { nullptr };
+  QLineEdit* keysEdit_   { nullptr };
+  QLineEdit* frameEdit_  { nullptr };
+  QLineEdit* rewindEdit_ { nullptr };
+  QLineEdit* statsEdit_  { nullptr };
+  QLineEdit* opsEdit_    { nullptr };
+
+  QPushButton* statsButton_ { nullptr };
 };
 
 #endif